@@ -0,0 +1,300 @@
+#include "hdlc/ast/parser.h"
+#include "hdlc/ast/transforms.h"
+#include "hdlc/chip.h"
+#include "hdlc/gen/generator.h"
+#include "hdlc/jit/codegen.h"
+#include "tests/test_designs.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Design {
+  std::string name;
+  std::string code;
+  std::string top;
+  size_t inputs;
+  size_t outputs;
+};
+
+Design generated(std::string name, hdlc::gen::Design d) {
+  return {std::move(name), std::move(d.code), std::move(d.top), d.inputs,
+          d.outputs};
+}
+
+std::vector<Design> designs() {
+  std::vector<Design> res{
+      {"test_chips", g_code, "And4Way", 8, 4},
+      {"test_chips", g_code, "StrangeAnd2Way", 4, 2},
+      {"test_chips", g_code, "PrevSlice8", 8, 8},
+  };
+  for (size_t n : {8, 32, 128}) {
+    res.push_back(generated("ripple_adder", hdlc::gen::ripple_carry_adder(n)));
+    res.push_back(generated("cla_adder", hdlc::gen::carry_lookahead_adder(n)));
+  }
+  for (size_t n : {8, 16, 32}) {
+    res.push_back(generated("multiplier", hdlc::gen::array_multiplier(n)));
+  }
+  for (size_t n : {4, 16, 64}) {
+    res.push_back(generated("regfile", hdlc::gen::register_file(n, 8)));
+  }
+  for (size_t n : {64, 1024}) {
+    res.push_back(generated("shift_register", hdlc::gen::shift_register(n)));
+  }
+  for (size_t n : {64, 512, 4096}) {
+    res.push_back(generated("and_chain", hdlc::gen::and_chain(n)));
+  }
+  for (size_t n : {16, 64}) {
+    hdlc::gen::NandDagOptions options;
+    options.inputs = n;
+    options.depth = n;
+    options.width = n;
+    res.push_back(generated("nand_dag_" + std::to_string(n),
+                            hdlc::gen::nand_dag(options)));
+  }
+  return res;
+}
+
+// Packages large enough that the front end time is spent walking the AST
+// rather than in fixed costs.
+std::vector<Design> large_designs() {
+  std::vector<Design> res;
+  res.push_back(generated("ripple_adder", hdlc::gen::ripple_carry_adder(1024)));
+  res.push_back(generated("multiplier", hdlc::gen::array_multiplier(64)));
+  res.push_back(generated("regfile", hdlc::gen::register_file(256, 16)));
+  hdlc::gen::NandDagOptions options;
+  options.inputs = 64;
+  options.depth = 128;
+  options.width = 128;
+  res.push_back(generated("nand_dag_128", hdlc::gen::nand_dag(options)));
+  return res;
+}
+
+void bm_parse(benchmark::State &state, const Design &d) {
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(hdlc::ast::read_package(d.code, d.name));
+  }
+  state.SetBytesProcessed(state.iterations() * d.code.size());
+}
+
+void bm_insert_casts(benchmark::State &state, const Design &d) {
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto pkg = hdlc::ast::read_package(d.code, d.name);
+    state.ResumeTiming();
+
+    hdlc::ast::insert_casts(pkg);
+  }
+}
+
+void bm_codegen(benchmark::State &state, const Design &d) {
+  auto pkg = hdlc::ast::parse_package(d.code, d.name);
+  for (auto _ : state) {
+    auto ir = hdlc::jit::generate_ir(pkg, d.top);
+
+    state.PauseTiming();
+    ir.reset();
+    state.ResumeTiming();
+  }
+}
+
+// Everything create_chip does before handing the module to LLVM.
+void bm_parse_to_ir(benchmark::State &state, const Design &d) {
+  for (auto _ : state) {
+    auto pkg = hdlc::ast::read_package(d.code, d.name);
+    hdlc::ast::insert_casts(pkg);
+    auto ir = hdlc::jit::generate_ir(pkg, d.top);
+
+    state.PauseTiming();
+    ir.reset();
+    pkg.reset();
+    state.ResumeTiming();
+  }
+  state.SetBytesProcessed(state.iterations() * d.code.size());
+}
+
+void bm_jit_compile(benchmark::State &state, const Design &d,
+                    hdlc::jit::OptLevel level) {
+  auto pkg = hdlc::ast::parse_package(d.code, d.name);
+  hdlc::jit::ModuleOptions options;
+  options.opt_level = level;
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto ir = hdlc::jit::generate_ir(pkg, d.top);
+    state.ResumeTiming();
+
+    auto module = hdlc::jit::compile_ir(std::move(ir), options);
+
+    state.PauseTiming();
+    module.reset();
+    state.ResumeTiming();
+  }
+}
+
+void bm_run(benchmark::State &state, const Design &d,
+            hdlc::CompileOptions options) {
+  auto chip = hdlc::create_chip(d.code, d.top, options);
+
+  std::vector<int8_t> inputs[2]{std::vector<int8_t>(d.inputs, 0),
+                                std::vector<int8_t>(d.inputs, 0)};
+  for (size_t i = 0; i < d.inputs; ++i) {
+    inputs[1][i] = (i * 7 + 3) % 5 < 2;
+  }
+  std::vector<int8_t> outputs(d.outputs);
+
+  size_t cycle = 0;
+  for (auto _ : state) {
+    chip->run(inputs[cycle & 1].data(), outputs.data());
+    cycle++;
+  }
+  benchmark::DoNotOptimize(outputs.data());
+  state.counters["cycles/s"] = benchmark::Counter(
+      double(state.iterations()), benchmark::Counter::kIsRate);
+}
+
+// Compiles a chip per iteration on every thread.
+void bm_create_parallel(benchmark::State &state, const Design &d) {
+  hdlc::CompileOptions options;
+  options.opt_level = hdlc::OptLevel::O0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(hdlc::create_chip(d.code, d.top, options));
+  }
+}
+
+// Chip shared by the threads of a benchmark, compiled by the first one.
+struct SharedChip {
+  std::once_flag compiled;
+  std::shared_ptr<hdlc::Chip> chip;
+};
+
+// Same as bm_run with every thread running its own state of one chip.
+void bm_run_parallel(benchmark::State &state, const Design &d,
+                     std::shared_ptr<SharedChip> shared) {
+  std::call_once(shared->compiled, [&]() {
+    hdlc::CompileOptions options;
+    options.opt_level = hdlc::OptLevel::O3;
+    shared->chip = hdlc::create_chip(d.code, d.top, options);
+  });
+  auto chip_state = shared->chip->make_state();
+
+  std::vector<int8_t> inputs[2]{std::vector<int8_t>(d.inputs, 0),
+                                std::vector<int8_t>(d.inputs, 0)};
+  for (size_t i = 0; i < d.inputs; ++i) {
+    inputs[1][i] = (i * 7 + 3) % 5 < 2;
+  }
+  std::vector<int8_t> outputs(d.outputs);
+
+  size_t cycle = 0;
+  for (auto _ : state) {
+    shared->chip->run(chip_state, inputs[cycle & 1].data(), outputs.data());
+    cycle++;
+  }
+  benchmark::DoNotOptimize(outputs.data());
+  state.counters["cycles/s"] = benchmark::Counter(
+      double(state.iterations()), benchmark::Counter::kIsRate);
+}
+
+void alternate_inputs(void *context, uint64_t cycle, int8_t *inputs) {
+  auto &patterns = *static_cast<std::vector<int8_t>(*)[2]>(context);
+  std::copy(patterns[cycle & 1].begin(), patterns[cycle & 1].end(), inputs);
+}
+
+// Same stimulus as bm_run, driven from generated code.
+void bm_cosim(benchmark::State &state, const Design &d) {
+  std::vector<int8_t> inputs[2]{std::vector<int8_t>(d.inputs, 0),
+                                std::vector<int8_t>(d.inputs, 0)};
+  for (size_t i = 0; i < d.inputs; ++i) {
+    inputs[1][i] = (i * 7 + 3) % 5 < 2;
+  }
+
+  hdlc::CompileOptions options;
+  options.opt_level = hdlc::OptLevel::O3;
+  options.testbench.stimulus = alternate_inputs;
+  options.testbench.context = &inputs;
+  auto chip = hdlc::create_chip(d.code, d.top, options);
+
+  const uint64_t cycles = 1000;
+  for (auto _ : state) {
+    chip->cosimulate(cycles);
+  }
+  state.counters["cycles/s"] = benchmark::Counter(
+      double(state.iterations() * cycles), benchmark::Counter::kIsRate);
+}
+
+void register_benchmarks() {
+  for (auto &d : designs()) {
+    auto suffix = "/" + d.name + "/" + d.top;
+
+    benchmark::RegisterBenchmark(("parse" + suffix).c_str(), bm_parse, d)
+        ->Unit(benchmark::kMicrosecond);
+    benchmark::RegisterBenchmark(("insert_casts" + suffix).c_str(),
+                                 bm_insert_casts, d)
+        ->Unit(benchmark::kMicrosecond);
+    benchmark::RegisterBenchmark(("codegen" + suffix).c_str(), bm_codegen, d)
+        ->Unit(benchmark::kMicrosecond);
+    benchmark::RegisterBenchmark(("jit_compile_O0" + suffix).c_str(),
+                                 bm_jit_compile, d, hdlc::jit::OptLevel::O0)
+        ->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark(("jit_compile_O3" + suffix).c_str(),
+                                 bm_jit_compile, d, hdlc::jit::OptLevel::O3)
+        ->Unit(benchmark::kMillisecond);
+
+    hdlc::CompileOptions options;
+    options.opt_level = hdlc::OptLevel::O0;
+    benchmark::RegisterBenchmark(("run_O0" + suffix).c_str(), bm_run, d,
+                                 options);
+    options.opt_level = hdlc::OptLevel::O3;
+    benchmark::RegisterBenchmark(("run_O3" + suffix).c_str(), bm_run, d,
+                                 options);
+    options.double_buffer_registers = true;
+    benchmark::RegisterBenchmark(("run_O3_double_buffer" + suffix).c_str(),
+                                 bm_run, d, options);
+    options.double_buffer_registers = false;
+    options.optimize_aig = true;
+    benchmark::RegisterBenchmark(("run_O3_aig" + suffix).c_str(), bm_run, d,
+                                 options);
+    options.optimize_aig = false;
+    options.lut_max_inputs = 12;
+    benchmark::RegisterBenchmark(("run_O3_lut" + suffix).c_str(), bm_run, d,
+                                 options);
+    benchmark::RegisterBenchmark(("cosim_O3" + suffix).c_str(), bm_cosim, d)
+        ->Unit(benchmark::kMicrosecond);
+
+    auto threads = int(std::max(2u, std::thread::hardware_concurrency()));
+    benchmark::RegisterBenchmark(("create_parallel_O0" + suffix).c_str(),
+                                 bm_create_parallel, d)
+        ->ThreadRange(1, threads)
+        ->UseRealTime()
+        ->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark(("run_O3_parallel" + suffix).c_str(),
+                                 bm_run_parallel, d,
+                                 std::make_shared<SharedChip>())
+        ->ThreadRange(1, threads)
+        ->UseRealTime();
+  }
+
+  for (auto &d : large_designs()) {
+    benchmark::RegisterBenchmark(
+        ("parse_to_ir/" + d.name + "/" + d.top).c_str(), bm_parse_to_ir, d)
+        ->Unit(benchmark::kMillisecond);
+  }
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  register_benchmarks();
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -0,0 +1,142 @@
+#include "aig.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace hdlc::aig {
+
+Lit Aig::create_input(std::string name) {
+  auto var = uint32_t(nodes.size());
+  nodes.push_back({NodeKind::Input, Lit(inputs.size()), 0, 0});
+  inputs.push_back(var);
+  input_names.push_back(std::move(name));
+  return make_lit(var);
+}
+
+Lit Aig::create_latch(std::string name) {
+  auto var = uint32_t(nodes.size());
+  nodes.push_back({NodeKind::Latch, Lit(latches.size()), 0, 0});
+  latches.push_back({var, lit_false});
+  latch_names.push_back(std::move(name));
+  return make_lit(var);
+}
+
+void Aig::set_next(Lit latch, Lit next) {
+  assert(node(latch).kind == NodeKind::Latch && !is_complement(latch));
+  latches[node(latch).fanin0].next = next;
+}
+
+Lit Aig::create_and(Lit a, Lit b) {
+  if (a < b) {
+    std::swap(a, b);
+  }
+  if (b == lit_false || a == negate(b)) {
+    return lit_false;
+  }
+  if (b == lit_true || a == b) {
+    return a;
+  }
+
+  auto key = (uint64_t(a) << 32) | b;
+  auto it = strash.find(key);
+  if (it != strash.end()) {
+    return make_lit(it->second);
+  }
+
+  auto var = uint32_t(nodes.size());
+  auto level = std::max(node(a).level, node(b).level) + 1;
+  nodes.push_back({NodeKind::And, a, b, level});
+  strash.emplace(key, var);
+  return make_lit(var);
+}
+
+uint32_t Aig::depth() const {
+  uint32_t res = 0;
+  for (auto o : outputs) {
+    res = std::max(res, node(o).level);
+  }
+  for (auto &l : latches) {
+    res = std::max(res, node(l.next).level);
+  }
+  return res;
+}
+
+namespace {
+void write_varint(std::ostream &out, uint32_t x) {
+  while (x & ~0x7fU) {
+    out.put(char((x & 0x7f) | 0x80));
+    x >>= 7;
+  }
+  out.put(char(x));
+}
+} // namespace
+
+void write_aiger(std::ostream &out, const Aig &aig, bool binary) {
+  // AIGER numbers the inputs first, then the latches and then the Ands.
+  std::vector<uint32_t> vars(aig.nodes.size());
+  uint32_t next_var = 1;
+  for (auto v : aig.inputs) {
+    vars[v] = next_var++;
+  }
+  for (auto &l : aig.latches) {
+    vars[l.var] = next_var++;
+  }
+  for (size_t v = 1; v < aig.nodes.size(); ++v) {
+    if (aig.nodes[v].kind == NodeKind::And) {
+      vars[v] = next_var++;
+    }
+  }
+  auto map = [&](Lit lit) {
+    return make_lit(vars[lit_var(lit)], is_complement(lit));
+  };
+
+  out << (binary ? "aig " : "aag ") << next_var - 1 << " "
+      << aig.inputs.size() << " " << aig.latches.size() << " "
+      << aig.outputs.size() << " " << aig.and_count() << "\n";
+  if (!binary) {
+    for (auto v : aig.inputs) {
+      out << make_lit(vars[v]) << "\n";
+    }
+  }
+  for (auto &l : aig.latches) {
+    if (!binary) {
+      out << make_lit(vars[l.var]) << " ";
+    }
+    out << map(l.next) << "\n";
+  }
+  for (auto o : aig.outputs) {
+    out << map(o) << "\n";
+  }
+  for (size_t v = 1; v < aig.nodes.size(); ++v) {
+    auto &n = aig.nodes[v];
+    if (n.kind != NodeKind::And) {
+      continue;
+    }
+    auto lhs = make_lit(vars[v]);
+    auto rhs0 = map(n.fanin0);
+    auto rhs1 = map(n.fanin1);
+    if (rhs0 < rhs1) {
+      std::swap(rhs0, rhs1);
+    }
+    if (binary) {
+      write_varint(out, lhs - rhs0);
+      write_varint(out, rhs0 - rhs1);
+    } else {
+      out << lhs << " " << rhs0 << " " << rhs1 << "\n";
+    }
+  }
+
+  auto write_symbols = [&out](char kind,
+                              const std::vector<std::string> &names) {
+    for (size_t i = 0; i < names.size(); ++i) {
+      if (!names[i].empty()) {
+        out << kind << i << " " << names[i] << "\n";
+      }
+    }
+  };
+  write_symbols('i', aig.input_names);
+  write_symbols('l', aig.latch_names);
+  write_symbols('o', aig.output_names);
+  out << "c\nhdlc\n";
+}
+} // namespace hdlc::aig
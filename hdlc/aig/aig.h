@@ -0,0 +1,131 @@
+#pragma once
+
+#include "hdlc/ast/ast.h"
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace hdlc::aig {
+
+// Variable times two plus a complement bit. Variable 0 is the constant, so
+// literal 0 is false and literal 1 is true.
+using Lit = uint32_t;
+
+const Lit lit_false = 0;
+const Lit lit_true = 1;
+
+inline Lit make_lit(uint32_t var, bool complement = false) {
+  return var * 2 + complement;
+}
+inline uint32_t lit_var(Lit lit) { return lit / 2; }
+inline bool is_complement(Lit lit) { return lit & 1; }
+inline Lit negate(Lit lit) { return lit ^ 1; }
+
+enum class NodeKind : uint8_t { Const, Input, Latch, And };
+
+struct Node {
+  NodeKind kind;
+  // Fanins of an And, the larger literal first. The index into inputs or
+  // latches for the others.
+  Lit fanin0;
+  Lit fanin1;
+  // Longest path in And nodes from an input or a latch.
+  uint32_t level;
+};
+
+struct Latch {
+  uint32_t var;
+  // Value of the latch in the next cycle, every latch starts out as 0.
+  Lit next;
+};
+
+// And-inverter graph of a flattened chip. Nodes are kept in topological
+// order and structurally hashed, creating an And that already exists
+// returns the existing node.
+struct Aig {
+  std::vector<Node> nodes{{NodeKind::Const, 0, 0, 0}};
+  // Variables of the inputs and latches in the order of their creation.
+  std::vector<uint32_t> inputs;
+  std::vector<Latch> latches;
+  std::vector<Lit> outputs;
+
+  // Names of the port bits and registers, e.g. "a[3]" or "Top/p1/r[0]".
+  std::vector<std::string> input_names;
+  std::vector<std::string> latch_names;
+  std::vector<std::string> output_names;
+
+  Lit create_input(std::string name = {});
+  Lit create_latch(std::string name = {});
+  void set_next(Lit latch, Lit next);
+
+  // Applies the trivial simplifications, e.g. a & !a = 0, before hashing.
+  Lit create_and(Lit a, Lit b);
+  Lit create_or(Lit a, Lit b) {
+    return negate(create_and(negate(a), negate(b)));
+  }
+
+  const Node &node(Lit lit) const { return nodes[lit_var(lit)]; }
+  bool is_and(Lit lit) const { return node(lit).kind == NodeKind::And; }
+
+  size_t and_count() const {
+    return nodes.size() - 1 - inputs.size() - latches.size();
+  }
+  // Longest path in And nodes to an output or a latch input.
+  uint32_t depth() const;
+
+private:
+  std::unordered_map<uint64_t, uint32_t> strash;
+};
+
+// Flattens the chip and all its sub-chips. Inputs and outputs follow the
+// order of the chip's ports, bit 0 first. Throws std::invalid_argument if
+// the package has no such chip.
+Aig from_package(std::shared_ptr<ast::Package> pkg, const std::string &chip);
+
+// Writes the graph in the AIGER 1.9 format, binary ("aig") by default or
+// ASCII ("aag"), including a symbol table with the port and register names.
+void write_aiger(std::ostream &out, const Aig &aig, bool binary = true);
+
+enum class CellKind { Xor, Mux, Add };
+
+// Word-level operation computing some literals of a graph.
+struct Cell {
+  CellKind kind;
+  // Xor: a, b. Mux: s, t, e. Add: a[n], b[n] and the carry in.
+  std::vector<Lit> inputs;
+  // Xor: a ^ b. Mux: s ? t : e. Add: the sums followed by the carries out
+  // of every bit.
+  std::vector<Lit> outputs;
+};
+
+// Finds ripple-carry adders of at least two bits, exclusive ors and
+// multiplexers. Every variable is computed by at most one cell, and the
+// inputs of a cell precede its outputs in the graph.
+std::vector<Cell> find_cells(const Aig &aig);
+
+// Copies the nodes reachable from the outputs and latches. Inputs and
+// latches are kept even if unused so that the ports do not change.
+Aig cleanup(const Aig &aig);
+
+// Rebuilds the graph applying local two-level rewriting rules, e.g.
+// (a & b) & !a = 0 or !(a & b) & a = a & !b. Never makes the graph larger.
+Aig rewrite(const Aig &aig);
+
+// Rebuilds every multi-input conjunction as a tree of minimal depth.
+Aig balance(const Aig &aig);
+
+// Alternates rewriting and balancing while the graph gets smaller or
+// shallower.
+void optimize(Aig &aig);
+
+// Replaces the chip of the package with a flat chip of the same ports
+// built from the graph's Nand gates, single-bit registers and the given
+// cells. Cells are calls of primitive chips, which are added to the
+// package.
+void replace_chip(std::shared_ptr<ast::Package> pkg, const std::string &chip,
+                  const Aig &aig, const std::vector<Cell> &cells = {});
+} // namespace hdlc::aig
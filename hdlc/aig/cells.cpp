@@ -0,0 +1,337 @@
+#include "aig.h"
+
+#include <algorithm>
+#include <array>
+#include <map>
+
+namespace hdlc::aig {
+
+namespace {
+// Truth tables over up to three leaves, leaf k is bit k of the row.
+const uint8_t leaf_tables[3] = {0xAA, 0xCC, 0xF0};
+
+struct Cut {
+  std::array<uint32_t, 3> leaves;
+  uint8_t size;
+  uint8_t table;
+};
+
+const size_t max_cuts = 8;
+
+// Re-expresses a table over the leaves of a cut over a superset of them.
+uint8_t expand(const Cut &cut, const Cut &to) {
+  uint8_t res = 0;
+  for (size_t row = 0; row < 8; ++row) {
+    size_t from_row = 0;
+    for (size_t k = 0; k < cut.size; ++k) {
+      auto pos = std::find(to.leaves.begin(), to.leaves.begin() + to.size,
+                           cut.leaves[k]) -
+                 to.leaves.begin();
+      from_row |= ((row >> pos) & 1) << k;
+    }
+    res |= ((cut.table >> from_row) & 1) << row;
+  }
+  return res;
+}
+
+bool merge(const Cut &a, const Cut &b, Cut &res) {
+  res.size = 0;
+  size_t i = 0;
+  size_t j = 0;
+  while (i < a.size || j < b.size) {
+    uint32_t next;
+    if (j == b.size || (i < a.size && a.leaves[i] < b.leaves[j])) {
+      next = a.leaves[i++];
+    } else if (i == a.size || b.leaves[j] < a.leaves[i]) {
+      next = b.leaves[j++];
+    } else {
+      next = a.leaves[i++];
+      j++;
+    }
+    if (res.size == 3) {
+      return false;
+    }
+    res.leaves[res.size++] = next;
+  }
+  return true;
+}
+
+// Enumerates the cuts of up to three leaves of every And node.
+std::vector<std::vector<Cut>> enumerate_cuts(const Aig &aig) {
+  std::vector<std::vector<Cut>> res(aig.nodes.size());
+  for (size_t v = 1; v < aig.nodes.size(); ++v) {
+    auto &n = aig.nodes[v];
+    auto &cuts = res[v];
+    if (n.kind == NodeKind::And) {
+      for (auto &a : res[lit_var(n.fanin0)]) {
+        for (auto &b : res[lit_var(n.fanin1)]) {
+          Cut cut;
+          if (cuts.size() == max_cuts || !merge(a, b, cut)) {
+            continue;
+          }
+          auto same_leaves = [&cut](const Cut &c) {
+            return c.size == cut.size && c.leaves == cut.leaves;
+          };
+          if (std::any_of(cuts.begin(), cuts.end(), same_leaves)) {
+            continue;
+          }
+          uint8_t ta = expand(a, cut) ^ (is_complement(n.fanin0) ? 0xFF : 0);
+          uint8_t tb = expand(b, cut) ^ (is_complement(n.fanin1) ? 0xFF : 0);
+          cut.table = ta & tb;
+          cuts.push_back(cut);
+        }
+      }
+    }
+    cuts.push_back({{uint32_t(v), 0, 0}, 1, leaf_tables[0]});
+  }
+  return res;
+}
+
+// Polarities of the leaves and the output, bit 3, for which the table is
+// the majority or the conjunction of the leaves. Majority is self-dual, so
+// the output is inverted rather than all of the leaves.
+int match_polarity(uint8_t table, size_t size) {
+  for (int q = 0; q < 16; ++q) {
+    int p = (q >> 1) | ((q & 1) << 3);
+    if (size == 2 && (p & 4)) {
+      continue;
+    }
+    uint8_t x[3];
+    for (size_t k = 0; k < 3; ++k) {
+      x[k] = leaf_tables[k] ^ ((p >> k) & 1 ? 0xFF : 0);
+    }
+    uint8_t f = size == 3 ? (x[0] & x[1]) | (x[0] & x[2]) | (x[1] & x[2])
+                          : x[0] & x[1];
+    if (uint8_t(f ^ (p & 8 ? 0xFF : 0)) == table) {
+      return p;
+    }
+  }
+  return -1;
+}
+
+bool is_parity(uint8_t table, size_t size) {
+  return size == 3 ? table == 0x96 || table == 0x69
+                   : table == 0x66 || table == 0x99;
+}
+
+// Full adder, or half adder with inputs[2] == lit_false.
+struct Adder {
+  std::array<Lit, 3> inputs;
+  Lit sum;
+  Lit carry;
+};
+
+std::vector<Adder> find_adders(const Aig &aig) {
+  auto cuts = enumerate_cuts(aig);
+
+  // Parity and carry functions of the same leaves form an adder.
+  struct Candidates {
+    std::array<uint32_t, 3> leaves;
+    size_t size;
+    uint32_t parity = 0;
+    uint8_t parity_table = 0;
+    uint32_t carry = 0;
+    int carry_polarity = -1;
+  };
+  std::map<std::array<uint32_t, 4>, Candidates> groups;
+  for (size_t v = 1; v < aig.nodes.size(); ++v) {
+    for (auto &c : cuts[v]) {
+      if (c.size < 2) {
+        continue;
+      }
+      auto &g = groups[{c.leaves[0], c.leaves[1], c.leaves[2], c.size}];
+      g.leaves = c.leaves;
+      g.size = c.size;
+      if (!g.parity && is_parity(c.table, c.size)) {
+        g.parity = v;
+        g.parity_table = c.table;
+      } else if (!g.carry) {
+        auto p = match_polarity(c.table, c.size);
+        if (p >= 0) {
+          g.carry = v;
+          g.carry_polarity = p;
+        }
+      }
+    }
+  }
+
+  std::vector<Adder> res;
+  for (auto &[key, g] : groups) {
+    if (!g.parity || !g.carry) {
+      continue;
+    }
+    Adder adder{{lit_false, lit_false, lit_false}, 0, 0};
+    bool flip = g.parity_table == 0x69 || g.parity_table == 0x99;
+    for (size_t k = 0; k < g.size; ++k) {
+      bool complement = (g.carry_polarity >> k) & 1;
+      adder.inputs[k] = make_lit(g.leaves[k], complement);
+      flip ^= complement;
+    }
+    adder.sum = make_lit(g.parity, flip);
+    adder.carry = make_lit(g.carry, g.carry_polarity & 8);
+    res.push_back(adder);
+  }
+  return res;
+}
+
+// Joins adders whose carry feeds the next one into ripple-carry chains.
+void find_adder_chains(const Aig &aig, std::vector<Cell> &cells,
+                       std::vector<bool> &claimed) {
+  auto adders = find_adders(aig);
+  // Half adders of the carry and a partial sum come with every full adder,
+  // prefer the full adders as the next bit.
+  std::stable_partition(adders.begin(), adders.end(), [](auto &adder) {
+    return adder.inputs[2] != lit_false;
+  });
+  // An adder reads a carry in either polarity, a full adder of the
+  // inverted inputs computes the inverted sum and carry.
+  std::map<uint32_t, std::vector<size_t>> readers;
+  for (size_t i = 0; i < adders.size(); ++i) {
+    for (auto in : adders[i].inputs) {
+      if (in != lit_false) {
+        readers[lit_var(in)].push_back(i);
+      }
+    }
+  }
+
+  std::vector<int64_t> next(adders.size(), -1);
+  std::vector<bool> has_prev(adders.size());
+  for (size_t i = 0; i < adders.size(); ++i) {
+    auto it = readers.find(lit_var(adders[i].carry));
+    if (it == readers.end()) {
+      continue;
+    }
+    for (auto j : it->second) {
+      if (!has_prev[j] && j != i) {
+        next[i] = int64_t(j);
+        has_prev[j] = true;
+        break;
+      }
+    }
+  }
+
+  for (size_t start = 0; start < adders.size(); ++start) {
+    if (has_prev[start]) {
+      continue;
+    }
+    Cell cell{CellKind::Add, {}, {}};
+    std::vector<Lit> a;
+    std::vector<Lit> b;
+    std::vector<Lit> sums;
+    std::vector<Lit> carries;
+    Lit cin = lit_false;
+    uint32_t max_input = 0;
+    uint32_t min_output = UINT32_MAX;
+
+    auto flush = [&]() {
+      if (sums.size() >= 2) {
+        cell.inputs = a;
+        cell.inputs.insert(cell.inputs.end(), b.begin(), b.end());
+        cell.inputs.push_back(cin);
+        cell.outputs = sums;
+        cell.outputs.insert(cell.outputs.end(), carries.begin(),
+                            carries.end());
+        for (auto o : cell.outputs) {
+          claimed[lit_var(o)] = true;
+        }
+        cells.push_back(cell);
+      }
+      a.clear();
+      b.clear();
+      sums.clear();
+      carries.clear();
+      max_input = 0;
+      min_output = UINT32_MAX;
+    };
+
+    for (auto i = int64_t(start); i >= 0; i = next[i]) {
+      auto adder = adders[i];
+      if (claimed[lit_var(adder.sum)] || claimed[lit_var(adder.carry)]) {
+        flush();
+        continue;
+      }
+
+      // The carry in of a bit other than the first is the previous carry.
+      auto &ins = adder.inputs;
+      Lit bit_cin = sums.empty() ? ins[2] : carries.back();
+      if (!sums.empty()) {
+        auto it = std::find(ins.begin(), ins.end(), bit_cin);
+        if (it == ins.end()) {
+          for (auto &in : ins) {
+            in = negate(in);
+          }
+          adder.sum = negate(adder.sum);
+          adder.carry = negate(adder.carry);
+          it = std::find(ins.begin(), ins.end(), bit_cin);
+        }
+        std::swap(*it, ins[2]);
+      }
+      auto bit_max_input = std::max({max_input, lit_var(ins[0]),
+                                     lit_var(ins[1]),
+                                     sums.empty() ? lit_var(ins[2]) : 0});
+      auto bit_min_output = std::min(
+          {min_output, lit_var(adder.sum), lit_var(adder.carry)});
+      // Outputs of the cell cannot feed its inputs.
+      if (bit_max_input >= bit_min_output) {
+        flush();
+        bit_max_input = std::max({lit_var(ins[0]), lit_var(ins[1]),
+                                  lit_var(ins[2])});
+        bit_min_output = std::min(lit_var(adder.sum), lit_var(adder.carry));
+        if (bit_max_input >= bit_min_output) {
+          continue;
+        }
+      }
+      if (sums.empty()) {
+        cin = ins[2];
+      }
+      a.push_back(ins[0]);
+      b.push_back(ins[1]);
+      sums.push_back(adder.sum);
+      carries.push_back(adder.carry);
+      max_input = bit_max_input;
+      min_output = bit_min_output;
+    }
+    flush();
+  }
+}
+} // namespace
+
+std::vector<Cell> find_cells(const Aig &aig) {
+  std::vector<Cell> res;
+  std::vector<bool> claimed(aig.nodes.size());
+  find_adder_chains(aig, res, claimed);
+
+  // !(x & y) & !(!x & !y) = x ^ y and !(s & t) & !(!s & e) = !(s ? t : e)
+  for (size_t v = 1; v < aig.nodes.size(); ++v) {
+    auto &n = aig.nodes[v];
+    if (claimed[v] || n.kind != NodeKind::And || !is_complement(n.fanin0) ||
+        !is_complement(n.fanin1) || !aig.is_and(n.fanin0) ||
+        !aig.is_and(n.fanin1)) {
+      continue;
+    }
+    auto &x = aig.node(n.fanin0);
+    auto &y = aig.node(n.fanin1);
+    if ((y.fanin0 == negate(x.fanin0) && y.fanin1 == negate(x.fanin1)) ||
+        (y.fanin0 == negate(x.fanin1) && y.fanin1 == negate(x.fanin0))) {
+      res.push_back({CellKind::Xor, {x.fanin0, x.fanin1}, {make_lit(v)}});
+      claimed[v] = true;
+      continue;
+    }
+    for (int i = 0; i < 4 && !claimed[v]; ++i) {
+      auto s = i & 1 ? x.fanin1 : x.fanin0;
+      auto t = i & 1 ? x.fanin0 : x.fanin1;
+      auto not_s = i & 2 ? y.fanin1 : y.fanin0;
+      auto e = i & 2 ? y.fanin0 : y.fanin1;
+      if (not_s == negate(s)) {
+        if (is_complement(s)) {
+          s = negate(s);
+          std::swap(t, e);
+        }
+        res.push_back({CellKind::Mux, {s, t, e}, {make_lit(v, true)}});
+        claimed[v] = true;
+      }
+    }
+  }
+  return res;
+}
+} // namespace hdlc::aig
@@ -0,0 +1,602 @@
+#include "aig.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+
+namespace hdlc::aig {
+
+namespace {
+using Bits = std::vector<Lit>;
+
+size_t port_width(const std::shared_ptr<ast::Type> &type) {
+  if (auto st = ast::dyn_cast<ast::SliceType>(type)) {
+    return st->size;
+  }
+  return 1;
+}
+
+std::string bit_name(const std::string &name, size_t width, size_t bit) {
+  if (width == 1) {
+    return name;
+  }
+  return name + "[" + std::to_string(bit) + "]";
+}
+
+struct Flattener : ast::Visitor {
+  Aig &aig;
+  std::unordered_map<std::string, ast::Chip *> chips;
+
+  // State of the instance being flattened.
+  std::unordered_map<ast::Value *, Bits> values;
+  std::unordered_map<ast::Value *, Bits> registers;
+  std::vector<Bits> results;
+  std::string path;
+  // Name of the next sub-chip instance, the first assignee of the call.
+  std::string call_name;
+
+  // Bits of the last visited expression and, for a call, its outputs.
+  Bits bits;
+  std::vector<Bits> call_outputs;
+
+  explicit Flattener(Aig &aig) : aig(aig) {}
+
+  Bits eval(ast::Expr &e) {
+    e.visit(*this);
+    return std::move(bits);
+  }
+
+  std::vector<Bits> flatten(ast::Chip &chip, std::vector<Bits> args,
+                            std::string instance_path) {
+    auto saved_values = std::move(values);
+    auto saved_registers = std::move(registers);
+    auto saved_results = std::move(results);
+    auto saved_path = std::move(path);
+    values.clear();
+    registers.clear();
+    results.clear();
+    path = std::move(instance_path);
+
+    for (size_t i = 0; i < chip.inputs.size(); ++i) {
+      values[chip.inputs[i].get()] = std::move(args[i]);
+    }
+    chip.visit(*this);
+    auto res = std::move(results);
+
+    values = std::move(saved_values);
+    registers = std::move(saved_registers);
+    results = std::move(saved_results);
+    path = std::move(saved_path);
+    return res;
+  }
+
+  void visit(ast::Package &pkg) override {
+    for (auto &c : pkg.chips) {
+      chips[c->ident] = c.get();
+    }
+  }
+
+  void visit(ast::Chip &chip) override {
+    for (auto &s : chip.body) {
+      s->visit(*this);
+    }
+  }
+
+  void visit(ast::AssignStmt &stmt) override {
+    if (auto reg = ast::dyn_cast<ast::CreateRegisterExpr>(stmt.rhs)) {
+      auto &value = stmt.assignees[0];
+      auto width = port_width(reg->result_type());
+      auto &latches = registers[value.get()];
+      for (size_t i = 0; i < width; ++i) {
+        latches.push_back(aig.create_latch(
+            path + "/" + bit_name(value->ident, width, i)));
+      }
+      return;
+    }
+
+    if (ast::isa<ast::CallExpr>(stmt.rhs)) {
+      call_name = stmt.assignees[0]->ident;
+      stmt.rhs->visit(*this);
+      for (size_t i = 0; i < stmt.assignees.size(); ++i) {
+        values[stmt.assignees[i].get()] = std::move(call_outputs[i]);
+      }
+      return;
+    }
+
+    values[stmt.assignees[0].get()] = eval(*stmt.rhs);
+  }
+
+  Lit create_xor(Lit a, Lit b) {
+    return aig.create_and(negate(aig.create_and(a, b)),
+                          negate(aig.create_and(negate(a), negate(b))));
+  }
+
+  // Nand and the cells of replace_chip, the other builtins have no gates.
+  std::vector<Bits> builtin(const std::string &name,
+                            const std::vector<Bits> &args) {
+    if (name == "Nand") {
+      return {{negate(aig.create_and(args[0][0], args[1][0]))}};
+    }
+    if (name == "$Xor") {
+      return {{create_xor(args[0][0], args[1][0])}};
+    }
+    if (name == "$Mux") {
+      auto s = args[0][0];
+      return {{aig.create_or(aig.create_and(s, args[1][0]),
+                             aig.create_and(negate(s), args[2][0]))}};
+    }
+    if (name.compare(0, 4, "$Add") == 0) {
+      auto &a = args[0];
+      auto &b = args[1];
+      auto carry = args[2][0];
+      std::vector<Bits> res(2);
+      for (size_t i = 0; i < a.size(); ++i) {
+        auto x = create_xor(a[i], b[i]);
+        res[0].push_back(create_xor(x, carry));
+        carry = aig.create_or(aig.create_and(a[i], b[i]),
+                              aig.create_and(x, carry));
+        res[1].push_back(carry);
+      }
+      return res;
+    }
+    throw std::invalid_argument("builtin chip " + name +
+                                " cannot be flattened");
+  }
+
+  void visit(ast::CallExpr &expr) override {
+    auto name = std::exchange(call_name, {});
+    std::vector<Bits> args;
+    for (auto &a : expr.args) {
+      args.push_back(eval(*a));
+    }
+
+    auto chip = chips.at(expr.chip_name);
+    if (chip->builtin) {
+      call_outputs = builtin(expr.chip_name, args);
+    } else {
+      call_outputs = flatten(*chip, std::move(args),
+                             path + "/" +
+                                 (name.empty() ? expr.chip_name : name));
+    }
+
+    bits.clear();
+    for (auto &o : call_outputs) {
+      bits.insert(bits.end(), o.begin(), o.end());
+    }
+  }
+
+  void visit(ast::Value &val) override { bits = values.at(&val); }
+
+  void visit(ast::RetStmt &stmt) override {
+    for (auto &e : stmt.results) {
+      results.push_back(eval(*e));
+    }
+  }
+
+  void visit(ast::RegWrite &rw) override {
+    auto next = eval(*rw.rhs);
+    auto &latches = registers.at(rw.reg.get());
+    // A disabled register keeps its value.
+    if (rw.enable) {
+      auto en = eval(*rw.enable)[0];
+      for (size_t i = 0; i < latches.size(); ++i) {
+        next[i] = aig.create_or(aig.create_and(en, next[i]),
+                                aig.create_and(negate(en), latches[i]));
+      }
+    }
+    for (size_t i = 0; i < latches.size(); ++i) {
+      aig.set_next(latches[i], next[i]);
+    }
+  }
+
+  void visit(ast::RegRead &rr) override { bits = registers.at(rr.reg.get()); }
+
+  void visit(ast::SliceIdxExpr &e) override {
+    auto slice = eval(*e.slice);
+    bits.assign(slice.begin() + e.begin, slice.begin() + e.end);
+  }
+
+  void visit(ast::SliceJoinExpr &e) override {
+    Bits res;
+    for (auto &v : e.values) {
+      auto b = eval(*v);
+      res.insert(res.end(), b.begin(), b.end());
+    }
+    bits = std::move(res);
+  }
+
+  void visit(ast::SliceToWireCast &e) override { bits = eval(*e.expr); }
+
+  void visit(ast::TupleToWireCast &e) override { bits = eval(*e.expr); }
+
+  void visit(ast::CreateRegisterExpr &) override {
+    throw std::invalid_argument("registers can only be assigned to values");
+  }
+
+  void visit(ast::RamExpr &) override {
+    throw std::invalid_argument("RAM cannot be flattened");
+  }
+};
+
+std::shared_ptr<ast::Chip> find_chip(ast::Package &pkg,
+                                     const std::string &chip) {
+  auto it = std::find_if(pkg.chips.begin(), pkg.chips.end(),
+                         [&chip](auto &c) { return c->ident == chip; });
+  if (it == pkg.chips.end()) {
+    throw std::invalid_argument("unknown chip " + chip);
+  }
+  return *it;
+}
+
+// Builds a flat chip from the graph. Every And is a Nand followed by an
+// inverter when its positive value is used, every cell is a call of a
+// primitive chip.
+struct ChipBuilder {
+  const Aig &aig;
+  ast::Package &pkg;
+  const ast::Chip &chip;
+  const std::vector<Cell> &cells;
+  std::shared_ptr<ast::Chip> nand;
+  // Primitive chips missing from the package.
+  std::vector<std::shared_ptr<ast::Chip>> primitives;
+  std::vector<std::shared_ptr<ast::Stmt>> body;
+  // Prefix of the generated names, not a prefix of any port name.
+  std::string prefix = "_";
+  std::vector<std::shared_ptr<ast::Value>> pos;
+  std::vector<std::shared_ptr<ast::Value>> neg;
+  std::vector<bool> used;
+  std::vector<bool> needed;
+  std::vector<int64_t> cell_of;
+  std::vector<bool> pending_cells;
+
+  ChipBuilder(const Aig &aig, ast::Package &pkg, const ast::Chip &chip,
+              const std::vector<Cell> &cells)
+      : aig(aig), pkg(pkg), chip(chip), cells(cells),
+        pos(aig.nodes.size()), neg(aig.nodes.size()),
+        used(aig.nodes.size() * 2), needed(aig.nodes.size()),
+        cell_of(aig.nodes.size(), -1), pending_cells(cells.size()) {
+    nand = find_chip(pkg, "Nand");
+    auto clashes = [this](auto &v) {
+      return v->ident.compare(0, prefix.size(), prefix) == 0;
+    };
+    while (std::any_of(chip.inputs.begin(), chip.inputs.end(), clashes)) {
+      prefix += "_";
+    }
+    for (size_t i = 0; i < cells.size(); ++i) {
+      for (auto o : cells[i].outputs) {
+        cell_of[lit_var(o)] = int64_t(i);
+      }
+    }
+  }
+
+  const std::shared_ptr<ast::Value> &value(Lit lit) {
+    return is_complement(lit) ? neg[lit_var(lit)] : pos[lit_var(lit)];
+  }
+
+  std::string var_name(const char *kind, size_t idx) {
+    return prefix + kind + std::to_string(idx);
+  }
+
+  void assign(std::vector<std::shared_ptr<ast::Value>> values,
+              std::shared_ptr<ast::Expr> rhs) {
+    auto stmt = std::make_shared<ast::AssignStmt>();
+    stmt->assignees = std::move(values);
+    stmt->rhs = std::move(rhs);
+    body.push_back(std::move(stmt));
+  }
+
+  std::shared_ptr<ast::Value> assign_wire(const std::string &name,
+                                          std::shared_ptr<ast::Expr> rhs) {
+    auto res =
+        std::make_shared<ast::Value>(name, std::make_shared<ast::WireType>());
+    assign({res}, std::move(rhs));
+    return res;
+  }
+
+  std::shared_ptr<ast::Expr>
+  call(const ast::Chip &callee, std::vector<std::shared_ptr<ast::Expr>> args) {
+    return std::make_shared<ast::CallExpr>(callee.ident, std::move(args),
+                                           callee.output_type);
+  }
+
+  std::shared_ptr<ast::Value> assign_nand(const std::string &name,
+                                          std::shared_ptr<ast::Value> a,
+                                          std::shared_ptr<ast::Value> b) {
+    return assign_wire(name, call(*nand, {std::move(a), std::move(b)}));
+  }
+
+  std::shared_ptr<ast::Value> assign_register(const std::string &name) {
+    auto type = std::make_shared<ast::RegisterType>();
+    auto reg = std::make_shared<ast::Value>(name, type);
+    assign({reg}, std::make_shared<ast::CreateRegisterExpr>(type));
+    return reg;
+  }
+
+  // Returns the primitive chip computing the cell, e.g. "$Add8".
+  const ast::Chip &primitive(const Cell &cell) {
+    using Ports = std::vector<std::pair<std::string, size_t>>;
+    std::string name;
+    Ports inputs;
+    Ports outputs{{"res", 1}};
+    switch (cell.kind) {
+    case CellKind::Xor:
+      name = "$Xor";
+      inputs = {{"a", 1}, {"b", 1}};
+      break;
+    case CellKind::Mux:
+      name = "$Mux";
+      inputs = {{"s", 1}, {"t", 1}, {"e", 1}};
+      break;
+    case CellKind::Add: {
+      auto width = cell.outputs.size() / 2;
+      name = "$Add" + std::to_string(width);
+      inputs = {{"a", width}, {"b", width}, {"cin", 1}};
+      outputs = {{"sum", width}, {"carry", width}};
+      break;
+    }
+    }
+
+    auto same_name = [&name](auto &c) { return c->ident == name; };
+    for (auto *chips : {&pkg.chips, &primitives}) {
+      auto it = std::find_if(chips->begin(), chips->end(), same_name);
+      if (it != chips->end()) {
+        return **it;
+      }
+    }
+
+    auto port_type = [](size_t width) -> std::shared_ptr<ast::Type> {
+      auto wire = std::make_shared<ast::WireType>();
+      if (width == 1) {
+        return wire;
+      }
+      return std::make_shared<ast::SliceType>(wire, width);
+    };
+    std::vector<std::shared_ptr<ast::Value>> input_values;
+    for (auto &[ident, width] : inputs) {
+      input_values.push_back(
+          std::make_shared<ast::Value>(ident, port_type(width)));
+    }
+    std::vector<std::shared_ptr<ast::Type>> output_types;
+    std::vector<std::string> output_names;
+    for (auto &[ident, width] : outputs) {
+      output_types.push_back(port_type(width));
+      output_names.push_back(ident);
+    }
+    auto &res = primitives.emplace_back(std::make_shared<ast::Chip>(
+        name, input_values,
+        std::make_shared<ast::TupleType>(output_types, output_names),
+        std::vector<std::shared_ptr<ast::Stmt>>{}));
+    res->builtin = true;
+    return *res;
+  }
+
+  std::vector<std::shared_ptr<ast::Value>> build_inputs() {
+    std::vector<std::shared_ptr<ast::Value>> res;
+    size_t idx = 0;
+    for (auto &i : chip.inputs) {
+      auto input = res.emplace_back(
+          std::make_shared<ast::Value>(i->ident, i->type));
+      if (!ast::isa<ast::SliceType>(i->type)) {
+        pos[aig.inputs[idx]] = input;
+        idx++;
+        continue;
+      }
+      for (size_t bit = 0; bit < port_width(i->type); ++bit) {
+        auto var = aig.inputs[idx];
+        pos[var] = assign_wire(var_name("i", idx),
+                               std::make_shared<ast::SliceToWireCast>(
+                                   std::make_shared<ast::SliceIdxExpr>(
+                                       input, bit, bit + 1)));
+        idx++;
+      }
+    }
+    return res;
+  }
+
+  std::vector<std::shared_ptr<ast::Value>> build_sources() {
+    std::vector<std::shared_ptr<ast::Value>> registers;
+    for (size_t i = 0; i < aig.latches.size(); ++i) {
+      auto &reg = registers.emplace_back(assign_register(var_name("r", i)));
+      pos[aig.latches[i].var] =
+          assign_wire(var_name("l", i), std::make_shared<ast::RegRead>(reg));
+    }
+
+    for (size_t v = 1; v < aig.nodes.size(); ++v) {
+      if (aig.nodes[v].kind != NodeKind::And && used[make_lit(v, true)]) {
+        neg[v] = assign_nand(var_name("n", v), pos[v], pos[v]);
+      }
+    }
+
+    if (!used[lit_false] && !used[lit_true]) {
+      return registers;
+    }
+    if (aig.inputs.empty()) {
+      // A register that is never written reads 0.
+      auto reg = assign_register(prefix + "zero");
+      pos[0] =
+          assign_wire(prefix + "false", std::make_shared<ast::RegRead>(reg));
+      neg[0] = assign_nand(prefix + "true", pos[0], pos[0]);
+      return registers;
+    }
+    auto &x = pos[aig.inputs[0]];
+    auto not_x = assign_nand(prefix + "not", x, x);
+    neg[0] = assign_nand(prefix + "true", x, not_x);
+    pos[0] = assign_nand(prefix + "false", neg[0], neg[0]);
+    return registers;
+  }
+
+  // Marks the literals read by the nodes and cells the outputs and latches
+  // depend on.
+  void mark_used() {
+    auto use = [this](Lit lit) {
+      used[lit] = true;
+      needed[lit_var(lit)] = true;
+    };
+    for (auto &l : aig.latches) {
+      use(l.next);
+    }
+    for (auto o : aig.outputs) {
+      use(o);
+    }
+    for (size_t v = aig.nodes.size(); v-- > 1;) {
+      auto &n = aig.nodes[v];
+      if (!needed[v]) {
+        continue;
+      }
+      if (auto c = cell_of[v]; c >= 0) {
+        if (!pending_cells[c]) {
+          pending_cells[c] = true;
+          std::for_each(cells[c].inputs.begin(), cells[c].inputs.end(), use);
+        }
+      } else if (n.kind == NodeKind::And) {
+        use(n.fanin0);
+        use(n.fanin1);
+      }
+    }
+  }
+
+  void build_cell(size_t idx) {
+    auto &cell = cells[idx];
+    auto &callee = primitive(cell);
+    std::vector<std::shared_ptr<ast::Expr>> outputs;
+    if (cell.kind == CellKind::Add) {
+      auto width = cell.outputs.size() / 2;
+      auto slice = [&](const char *kind) {
+        return std::make_shared<ast::Value>(
+            var_name(kind, idx),
+            std::make_shared<ast::SliceType>(
+                std::make_shared<ast::WireType>(), width));
+      };
+      auto join = [&](size_t begin) {
+        std::vector<std::shared_ptr<ast::Expr>> bits;
+        for (size_t i = begin; i < begin + width; ++i) {
+          bits.push_back(value(cell.inputs[i]));
+        }
+        return std::make_shared<ast::SliceJoinExpr>(bits);
+      };
+      auto sum = slice("sum");
+      auto carry = slice("carry");
+      assign({sum, carry},
+             call(callee, {join(0), join(width), value(cell.inputs.back())}));
+      for (size_t i = 0; i < cell.outputs.size(); ++i) {
+        auto bit = i % width;
+        outputs.push_back(std::make_shared<ast::SliceToWireCast>(
+            std::make_shared<ast::SliceIdxExpr>(i < width ? sum : carry, bit,
+                                                bit + 1)));
+      }
+    } else {
+      std::vector<std::shared_ptr<ast::Expr>> args;
+      for (auto in : cell.inputs) {
+        args.push_back(value(in));
+      }
+      outputs.push_back(call(callee, args));
+    }
+
+    for (size_t i = 0; i < cell.outputs.size(); ++i) {
+      auto o = cell.outputs[i];
+      auto v = lit_var(o);
+      if (!used[o] && !used[negate(o)]) {
+        continue;
+      }
+      auto &res = is_complement(o) ? neg[v] : pos[v];
+      res = assign_wire(var_name(is_complement(o) ? "n" : "p", v),
+                        outputs[i]);
+      if (used[negate(o)]) {
+        auto &inv = is_complement(o) ? pos[v] : neg[v];
+        inv = assign_nand(var_name(is_complement(o) ? "p" : "n", v), res, res);
+      }
+    }
+  }
+
+  std::shared_ptr<ast::Chip> build() {
+    mark_used();
+    auto inputs = build_inputs();
+    auto registers = build_sources();
+
+    for (size_t v = 1; v < aig.nodes.size(); ++v) {
+      auto &n = aig.nodes[v];
+      if (!needed[v]) {
+        continue;
+      }
+      if (auto c = cell_of[v]; c >= 0) {
+        if (pending_cells[c]) {
+          pending_cells[c] = false;
+          build_cell(size_t(c));
+        }
+      } else if (n.kind == NodeKind::And) {
+        neg[v] = assign_nand(var_name("n", v), value(n.fanin0),
+                             value(n.fanin1));
+        if (used[make_lit(v)]) {
+          pos[v] = assign_nand(var_name("p", v), neg[v], neg[v]);
+        }
+      }
+    }
+
+    for (size_t i = 0; i < aig.latches.size(); ++i) {
+      body.push_back(std::make_shared<ast::RegWrite>(
+          registers[i], value(aig.latches[i].next)));
+    }
+
+    auto ret = std::make_shared<ast::RetStmt>();
+    auto &outputs = *chip.output_type;
+    size_t idx = 0;
+    for (auto &type : outputs.element_types) {
+      if (!ast::isa<ast::SliceType>(type)) {
+        ret->results.push_back(value(aig.outputs[idx++]));
+        continue;
+      }
+      std::vector<std::shared_ptr<ast::Expr>> bits;
+      for (size_t bit = 0; bit < port_width(type); ++bit) {
+        bits.push_back(value(aig.outputs[idx++]));
+      }
+      ret->results.push_back(std::make_shared<ast::SliceJoinExpr>(bits));
+    }
+    body.push_back(ret);
+
+    return std::make_shared<ast::Chip>(chip.ident, inputs, chip.output_type,
+                                       body);
+  }
+};
+} // namespace
+
+Aig from_package(std::shared_ptr<ast::Package> pkg, const std::string &chip) {
+  auto top = find_chip(*pkg, chip);
+
+  Aig res;
+  Flattener flattener(res);
+  flattener.visit(*pkg);
+
+  std::vector<Bits> args;
+  for (auto &i : top->inputs) {
+    auto width = port_width(i->type);
+    auto &bits = args.emplace_back();
+    for (size_t bit = 0; bit < width; ++bit) {
+      bits.push_back(res.create_input(bit_name(i->ident, width, bit)));
+    }
+  }
+
+  auto results = flattener.flatten(*top, std::move(args), chip);
+  auto &outputs = *top->output_type;
+  for (size_t i = 0; i < results.size(); ++i) {
+    auto width = port_width(outputs.element_types[i]);
+    for (size_t bit = 0; bit < width; ++bit) {
+      res.outputs.push_back(results[i][bit]);
+      res.output_names.push_back(
+          bit_name(outputs.element_names[i], width, bit));
+    }
+  }
+  return res;
+}
+
+void replace_chip(std::shared_ptr<ast::Package> pkg, const std::string &chip,
+                  const Aig &aig, const std::vector<Cell> &cells) {
+  auto top = find_chip(*pkg, chip);
+  ChipBuilder builder(aig, *pkg, *top, cells);
+  auto flat = builder.build();
+  // Primitives go before the chip, code generation needs callees first.
+  auto it = std::find(pkg->chips.begin(), pkg->chips.end(), top);
+  *it = flat;
+  pkg->chips.insert(it, builder.primitives.begin(), builder.primitives.end());
+}
+} // namespace hdlc::aig
@@ -0,0 +1,239 @@
+#include "aig.h"
+
+#include <algorithm>
+#include <queue>
+#include <tuple>
+
+namespace hdlc::aig {
+
+namespace {
+// Marks the variables the outputs and latches depend on.
+std::vector<bool> reachable(const Aig &aig) {
+  std::vector<bool> res(aig.nodes.size());
+  for (auto o : aig.outputs) {
+    res[lit_var(o)] = true;
+  }
+  for (auto &l : aig.latches) {
+    res[lit_var(l.next)] = true;
+  }
+  for (size_t v = aig.nodes.size(); v-- > 1;) {
+    auto &n = aig.nodes[v];
+    if (res[v] && n.kind == NodeKind::And) {
+      res[lit_var(n.fanin0)] = true;
+      res[lit_var(n.fanin1)] = true;
+    }
+  }
+  return res;
+}
+
+// Copies the inputs and latches of the graph, the other nodes are mapped
+// by the caller.
+Aig copy_sources(const Aig &aig, std::vector<Lit> &map) {
+  Aig res;
+  map.assign(aig.nodes.size(), lit_false);
+  for (size_t i = 0; i < aig.inputs.size(); ++i) {
+    map[aig.inputs[i]] = res.create_input(aig.input_names[i]);
+  }
+  for (size_t i = 0; i < aig.latches.size(); ++i) {
+    map[aig.latches[i].var] = res.create_latch(aig.latch_names[i]);
+  }
+  return res;
+}
+
+Lit translate(const std::vector<Lit> &map, Lit lit) {
+  return map[lit_var(lit)] ^ Lit(is_complement(lit));
+}
+
+void copy_sinks(const Aig &aig, Aig &res, const std::vector<Lit> &map) {
+  for (size_t i = 0; i < aig.latches.size(); ++i) {
+    res.latches[i].next = translate(map, aig.latches[i].next);
+  }
+  for (auto o : aig.outputs) {
+    res.outputs.push_back(translate(map, o));
+  }
+  res.output_names = aig.output_names;
+}
+
+template <typename MakeAnd> Aig rebuild(const Aig &aig, MakeAnd make_and) {
+  std::vector<Lit> map;
+  auto res = copy_sources(aig, map);
+  auto used = reachable(aig);
+  for (size_t v = 1; v < aig.nodes.size(); ++v) {
+    auto &n = aig.nodes[v];
+    if (used[v] && n.kind == NodeKind::And) {
+      map[v] =
+          make_and(res, translate(map, n.fanin0), translate(map, n.fanin1));
+    }
+  }
+  copy_sinks(aig, res, map);
+  return res;
+}
+
+// Rules of Brummayer and Biere, "Local Two-Level And-Inverter Graph
+// Minimization without Blowup", that do not add nodes.
+Lit rewrite_and(Aig &aig, Lit a, Lit b) {
+  for (int i = 0; i < 2; ++i, std::swap(a, b)) {
+    if (!aig.is_and(a)) {
+      continue;
+    }
+    auto c = aig.node(a).fanin0;
+    auto d = aig.node(a).fanin1;
+    if (!is_complement(a)) {
+      // Contradiction (c & d) & !c = 0 and idempotence (c & d) & c = c & d.
+      if (b == negate(c) || b == negate(d)) {
+        return lit_false;
+      }
+      if (b == c || b == d) {
+        return a;
+      }
+    } else {
+      // Subsumption !(c & d) & !c = !c and substitution !(c & d) & c =
+      // c & !d.
+      if (b == negate(c) || b == negate(d)) {
+        return b;
+      }
+      if (b == c) {
+        return rewrite_and(aig, b, negate(d));
+      }
+      if (b == d) {
+        return rewrite_and(aig, b, negate(c));
+      }
+    }
+  }
+
+  if (!aig.is_and(a) || !aig.is_and(b)) {
+    return aig.create_and(a, b);
+  }
+  if (is_complement(a) && !is_complement(b)) {
+    std::swap(a, b);
+  }
+  auto c = aig.node(a).fanin0;
+  auto d = aig.node(a).fanin1;
+  auto e = aig.node(b).fanin0;
+  auto f = aig.node(b).fanin1;
+  auto contradicts = [&](Lit x) { return x == negate(c) || x == negate(d); };
+
+  if (!is_complement(a) && !is_complement(b)) {
+    // (c & d) & (!c & f) = 0
+    if (contradicts(e) || contradicts(f)) {
+      return lit_false;
+    }
+  } else if (!is_complement(a)) {
+    // Subsumption (c & d) & !(!c & f) = c & d and substitution
+    // (c & d) & !(c & f) = (c & d) & !f.
+    if (contradicts(e) || contradicts(f)) {
+      return a;
+    }
+    if (e == c || e == d) {
+      return rewrite_and(aig, a, negate(f));
+    }
+    if (f == c || f == d) {
+      return rewrite_and(aig, a, negate(e));
+    }
+  } else {
+    // Resolution !(c & d) & !(c & !d) = !c
+    for (int i = 0; i < 2; ++i, std::swap(c, d)) {
+      if ((c == e && d == negate(f)) || (c == f && d == negate(e))) {
+        return negate(c);
+      }
+    }
+  }
+  return aig.create_and(a, b);
+}
+} // namespace
+
+Aig cleanup(const Aig &aig) {
+  return rebuild(aig, [](Aig &res, Lit a, Lit b) {
+    return res.create_and(a, b);
+  });
+}
+
+// Nodes replaced by simpler ones are still built, leave them out.
+Aig rewrite(const Aig &aig) { return cleanup(rebuild(aig, rewrite_and)); }
+
+Aig balance(const Aig &aig) {
+  auto used = reachable(aig);
+  std::vector<uint32_t> fanouts(aig.nodes.size());
+  auto reference = [&fanouts](Lit lit) { fanouts[lit_var(lit)]++; };
+  for (size_t v = 1; v < aig.nodes.size(); ++v) {
+    auto &n = aig.nodes[v];
+    if (used[v] && n.kind == NodeKind::And) {
+      reference(n.fanin0);
+      reference(n.fanin1);
+    }
+  }
+  for (auto o : aig.outputs) {
+    reference(o);
+  }
+  for (auto &l : aig.latches) {
+    reference(l.next);
+  }
+
+  // An And read only by another And is part of its reader's conjunction.
+  auto absorbed = [&](Lit lit) {
+    return !is_complement(lit) && aig.is_and(lit) &&
+           fanouts[lit_var(lit)] == 1;
+  };
+  std::vector<bool> is_absorbed(aig.nodes.size());
+  for (size_t v = 1; v < aig.nodes.size(); ++v) {
+    auto &n = aig.nodes[v];
+    if (used[v] && n.kind == NodeKind::And) {
+      is_absorbed[lit_var(n.fanin0)] = absorbed(n.fanin0);
+      is_absorbed[lit_var(n.fanin1)] = absorbed(n.fanin1);
+    }
+  }
+
+  std::vector<Lit> map;
+  auto res = copy_sources(aig, map);
+  std::vector<Lit> stack;
+  std::vector<Lit> leaves;
+  for (size_t v = 1; v < aig.nodes.size(); ++v) {
+    if (!used[v] || is_absorbed[v] || aig.nodes[v].kind != NodeKind::And) {
+      continue;
+    }
+
+    leaves.clear();
+    stack.assign({aig.nodes[v].fanin0, aig.nodes[v].fanin1});
+    while (!stack.empty()) {
+      auto lit = stack.back();
+      stack.pop_back();
+      if (absorbed(lit)) {
+        stack.push_back(aig.node(lit).fanin0);
+        stack.push_back(aig.node(lit).fanin1);
+      } else {
+        leaves.push_back(translate(map, lit));
+      }
+    }
+
+    // Combine the two shallowest operands until one is left.
+    auto deeper = [&res](Lit x, Lit y) {
+      return std::make_tuple(res.node(x).level, x) >
+             std::make_tuple(res.node(y).level, y);
+    };
+    std::priority_queue<Lit, std::vector<Lit>, decltype(deeper)> queue(
+        deeper, leaves);
+    while (queue.size() > 1) {
+      auto x = queue.top();
+      queue.pop();
+      auto y = queue.top();
+      queue.pop();
+      queue.push(res.create_and(x, y));
+    }
+    map[v] = queue.top();
+  }
+  copy_sinks(aig, res, map);
+  return cleanup(res);
+}
+
+void optimize(Aig &aig) {
+  aig = rewrite(aig);
+  while (true) {
+    auto next = rewrite(balance(aig));
+    if (std::make_pair(next.and_count(), next.depth()) >=
+        std::make_pair(aig.and_count(), aig.depth())) {
+      return;
+    }
+    aig = std::move(next);
+  }
+}
+} // namespace hdlc::aig
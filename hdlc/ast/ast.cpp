@@ -1,4 +1,7 @@
 #include "ast.h"
+#include "builtins.h"
+
+#include <unordered_map>
 
 namespace hdlc::ast {
 void Package::visit(Visitor &v) { v.visit(*this); }
@@ -16,27 +19,28 @@ void WireType::visit(TypeVisitor &v) { v.visit(*this); }
 void RegisterType::visit(TypeVisitor &v) { v.visit(*this); }
 
 SliceType::SliceType(std::shared_ptr<Type> element_type, size_t size)
-    : element_type(element_type), size(size) {}
+    : Type(TypeKind::Slice), element_type(element_type), size(size) {}
 
 void SliceType::visit(TypeVisitor &v) { v.visit(*this); }
 
 TupleType::TupleType(std::vector<std::shared_ptr<Type>> types,
                      std::vector<std::string> names)
-    : element_types(std::move(types)), element_names(std::move(names)) {}
+    : Type(TypeKind::Tuple), element_types(std::move(types)),
+      element_names(std::move(names)) {}
 void TupleType::visit(TypeVisitor &v) { v.visit(*this); }
 
 void AssignStmt::visit(Visitor &v) { v.visit(*this); }
 
 CallExpr::CallExpr(std::string name, std::vector<std::shared_ptr<Expr>> args,
                    std::shared_ptr<Type> res_type)
-    : chip_name(name), args(args), res_type(res_type) {}
+    : Expr(ExprKind::Call), chip_name(name), args(args), res_type(res_type) {}
 
 void CallExpr::visit(Visitor &v) { v.visit(*this); }
 
 std::shared_ptr<Type> CallExpr::result_type() { return res_type; }
 
 Value::Value(std::string name, std::shared_ptr<Type> type)
-    : ident(name), type(type) {}
+    : Expr(ExprKind::Value), ident(name), type(type) {}
 
 void Value::visit(Visitor &v) { v.visit(*this); }
 
@@ -44,23 +48,29 @@ std::shared_ptr<Type> Value::result_type() { return type; }
 
 void RetStmt::visit(Visitor &v) { v.visit(*this); }
 
-RegWrite::RegWrite(std::shared_ptr<Value> reg, std::shared_ptr<Expr> rhs)
-    : reg(reg), rhs(rhs) {}
+RegWrite::RegWrite(std::shared_ptr<Value> reg, std::shared_ptr<Expr> rhs,
+                   std::shared_ptr<Expr> enable)
+    : reg(reg), rhs(rhs), enable(std::move(enable)) {}
 
 void RegWrite::visit(Visitor &v) { v.visit(*this); }
 
-RegRead::RegRead(std::shared_ptr<Value> reg) : reg(reg) {}
+RegRead::RegRead(std::shared_ptr<Value> reg)
+    : Expr(ExprKind::RegRead), reg(reg) {}
 
 void RegRead::visit(Visitor &v) { v.visit(*this); }
 
 std::shared_ptr<Type> RegRead::result_type() {
-  if (auto t = std::dynamic_pointer_cast<SliceType>(reg->result_type())) {
+  if (auto t = dyn_cast<SliceType>(reg->type)) {
     return std::make_shared<SliceType>(std::make_shared<WireType>(), t->size);
   }
   return std::make_shared<WireType>();
 }
 
-CastExpr::CastExpr(std::shared_ptr<Expr> expr) : expr(expr) {}
+CastExpr::CastExpr(ExprKind kind, std::shared_ptr<Expr> expr)
+    : Expr(kind), expr(std::move(expr)) {}
+
+SliceToWireCast::SliceToWireCast(std::shared_ptr<Expr> expr)
+    : CastExpr(ExprKind::SliceToWireCast, std::move(expr)) {}
 
 void SliceToWireCast::visit(Visitor &v) { v.visit(*this); }
 
@@ -68,6 +78,9 @@ std::shared_ptr<Type> SliceToWireCast::result_type() {
   return std::make_shared<WireType>();
 }
 
+TupleToWireCast::TupleToWireCast(std::shared_ptr<Expr> expr)
+    : CastExpr(ExprKind::TupleToWireCast, std::move(expr)) {}
+
 void TupleToWireCast::visit(Visitor &v) { v.visit(*this); }
 
 std::shared_ptr<Type> TupleToWireCast::result_type() {
@@ -76,11 +89,12 @@ std::shared_ptr<Type> TupleToWireCast::result_type() {
 
 SliceIdxExpr::SliceIdxExpr(std::shared_ptr<Expr> slice, size_t begin,
                            size_t end)
-    : slice(slice), begin(begin), end(end) {}
+    : Expr(ExprKind::SliceIdx), slice(slice), begin(begin), end(end) {}
 
 std::shared_ptr<Type> SliceIdxExpr::result_type() {
   assert(end - begin >= 1);
-  auto slice_type = std::dynamic_pointer_cast<SliceType>(slice->result_type());
+  auto type = slice->result_type();
+  auto slice_type = cast<SliceType>(type);
   assert(slice_type->size >= end - begin);
   return std::make_shared<SliceType>(slice_type->element_type, end - begin);
 }
@@ -88,7 +102,7 @@ std::shared_ptr<Type> SliceIdxExpr::result_type() {
 void SliceIdxExpr::visit(Visitor &v) { v.visit(*this); }
 
 SliceJoinExpr::SliceJoinExpr(std::vector<std::shared_ptr<Expr>> values)
-    : values(std::move(values)) {}
+    : Expr(ExprKind::SliceJoin), values(std::move(values)) {}
 
 void SliceJoinExpr::visit(Visitor &v) { v.visit(*this); }
 
@@ -99,11 +113,34 @@ std::shared_ptr<Type> SliceJoinExpr::result_type() {
 }
 
 CreateRegisterExpr::CreateRegisterExpr(std::shared_ptr<Type> res_type)
-    : res_type(res_type) {}
+    : Expr(ExprKind::CreateRegister), res_type(res_type) {}
 
 void CreateRegisterExpr::visit(Visitor &v) { v.visit(*this); }
 std::shared_ptr<Type> CreateRegisterExpr::result_type() { return res_type; }
 
+RamExpr::RamExpr(size_t words, size_t width, std::shared_ptr<Expr> address,
+                 std::shared_ptr<Expr> data, std::shared_ptr<Expr> write)
+    : Expr(ExprKind::Ram), words(words), width(width),
+      address(std::move(address)), data(std::move(data)),
+      write(std::move(write)) {}
+
+size_t RamExpr::address_width() const {
+  size_t res = 1;
+  while (res < 64 && (size_t(1) << res) < words) {
+    res++;
+  }
+  return res;
+}
+
+void RamExpr::visit(Visitor &v) { v.visit(*this); }
+
+std::shared_ptr<Type> RamExpr::result_type() {
+  if (width == 1) {
+    return std::make_shared<WireType>();
+  }
+  return std::make_shared<SliceType>(std::make_shared<WireType>(), width);
+}
+
 struct Printer : Visitor {
 private:
   std::ostream &out;
@@ -119,14 +156,14 @@ public:
   }
 
   void visit(Chip &chip) override {
-    if (chip.ident == "Nand") {
+    if (chip.builtin) {
       return;
     }
 
     out << "chip " << chip.ident << " (";
     for (auto &i : chip.inputs) {
       i->visit(*this);
-      if (auto st = std::dynamic_pointer_cast<SliceType>(i->type)) {
+      if (auto st = dyn_cast<SliceType>(i->type)) {
         out << "[" << st->size << "]";
       }
       out << ", ";
@@ -139,7 +176,7 @@ public:
 
       out << name;
 
-      if (auto st = std::dynamic_pointer_cast<SliceType>(type)) {
+      if (auto st = dyn_cast<SliceType>(type)) {
         out << "[" << st->size << "]";
       }
 
@@ -190,6 +227,10 @@ public:
     rw.reg->visit(*this);
     out << " <- ";
     rw.rhs->visit(*this);
+    if (rw.enable) {
+      out << " if ";
+      rw.enable->visit(*this);
+    }
   }
 
   void visit(RegRead &rr) override {
@@ -221,6 +262,16 @@ public:
   }
 
   void visit(CreateRegisterExpr &) override { out << "Register()"; }
+
+  void visit(RamExpr &e) override {
+    out << "RAM(" << e.words << ", " << e.width << ")(";
+    e.address->visit(*this);
+    out << ", ";
+    e.data->visit(*this);
+    out << ", ";
+    e.write->visit(*this);
+    out << ")";
+  }
 };
 
 void print_package(std::ostream &out, std::shared_ptr<Package> pkg) {
@@ -228,4 +279,101 @@ void print_package(std::ostream &out, std::shared_ptr<Package> pkg) {
   p.visit(*pkg);
 }
 
+// Nand gates of the same function as a builtin chip, nine per bit of an
+// adder cell.
+size_t builtin_gates(const std::string &chip) {
+  if (auto builtin = find_builtin(chip)) {
+    return builtin->gates;
+  }
+  if (chip == "$Xor" || chip == "$Mux") {
+    return 4;
+  }
+  if (chip.compare(0, 4, "$Add") == 0) {
+    return 9 * std::stoul(chip.substr(4));
+  }
+  return 0;
+}
+
+struct GateCounter : Visitor {
+  std::unordered_map<std::string, size_t> gates_per_chip;
+  std::unordered_map<std::string, size_t> register_bits_per_chip;
+  size_t current_gates = 0;
+  size_t current_register_bits = 0;
+
+  void visit(Package &pkg) override {
+    for (auto &c : pkg.chips) {
+      c->visit(*this);
+    }
+  }
+
+  void visit(Chip &chip) override {
+    current_gates = chip.builtin ? builtin_gates(chip.ident) : 0;
+    current_register_bits = 0;
+    for (auto &s : chip.body) {
+      s->visit(*this);
+    }
+    gates_per_chip[chip.ident] = current_gates;
+    register_bits_per_chip[chip.ident] = current_register_bits;
+  }
+
+  void visit(AssignStmt &stmt) override { stmt.rhs->visit(*this); }
+
+  void visit(CallExpr &expr) override {
+    current_gates += gates_per_chip[expr.chip_name];
+    current_register_bits += register_bits_per_chip[expr.chip_name];
+    for (auto &a : expr.args) {
+      a->visit(*this);
+    }
+  }
+
+  void visit(RetStmt &stmt) override {
+    for (auto &e : stmt.results) {
+      e->visit(*this);
+    }
+  }
+
+  void visit(RegWrite &rw) override {
+    rw.rhs->visit(*this);
+    if (rw.enable) {
+      rw.enable->visit(*this);
+    }
+  }
+
+  void visit(SliceJoinExpr &e) override {
+    for (auto &v : e.values) {
+      v->visit(*this);
+    }
+  }
+
+  void visit(SliceToWireCast &e) override { e.expr->visit(*this); }
+  void visit(TupleToWireCast &e) override { e.expr->visit(*this); }
+  void visit(Value &) override {}
+  void visit(RegRead &) override {}
+  void visit(SliceIdxExpr &) override {}
+
+  void visit(CreateRegisterExpr &e) override {
+    auto st = dyn_cast<SliceType>(e.res_type);
+    current_register_bits += st ? st->size : 1;
+  }
+
+  void visit(RamExpr &e) override {
+    e.address->visit(*this);
+    e.data->visit(*this);
+    e.write->visit(*this);
+  }
+};
+
+size_t count_gates(std::shared_ptr<Package> pkg, const std::string &chip) {
+  GateCounter c;
+  c.visit(*pkg);
+  return c.gates_per_chip[chip];
+}
+
+size_t count_register_bits(std::shared_ptr<Package> pkg,
+                           const std::string &chip) {
+  GateCounter c;
+  c.visit(*pkg);
+  return c.register_bits_per_chip[chip];
+}
+
 } // namespace hdlc::ast
\ No newline at end of file
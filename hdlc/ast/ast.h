@@ -2,9 +2,13 @@
 
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
+#include <deque>
 #include <iostream>
 #include <memory>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 namespace hdlc::ast {
@@ -27,6 +31,7 @@ struct SliceJoinExpr;
 struct SliceToWireCast;
 struct TupleToWireCast;
 struct CreateRegisterExpr;
+struct RamExpr;
 
 struct WireType;
 struct RegisterType;
@@ -52,6 +57,7 @@ struct Visitor {
   virtual void visit(SliceToWireCast &e) = 0;
   virtual void visit(TupleToWireCast &e) = 0;
   virtual void visit(CreateRegisterExpr &e) = 0;
+  virtual void visit(RamExpr &e) = 0;
   virtual ~Visitor() = default;
 };
 
@@ -63,9 +69,31 @@ struct TypeVisitor {
   virtual ~TypeVisitor() = default;
 };
 
+// Interned identifiers of a package, numbered densely from 0 in the order
+// they are first seen, so that tables of chips can be vectors.
+class Symbols {
+  // The keys of ids view the names, which a deque never moves.
+  std::deque<std::string> names;
+  std::unordered_map<std::string_view, uint32_t> ids;
+
+public:
+  static constexpr uint32_t none = UINT32_MAX;
+
+  Symbols() = default;
+  Symbols(const Symbols &) = delete;
+  Symbols &operator=(const Symbols &) = delete;
+
+  uint32_t intern(std::string_view name);
+  // Returns none if the name was never interned.
+  uint32_t find(std::string_view name) const;
+  const std::string &name(uint32_t id) const { return names[id]; }
+  size_t size() const { return names.size(); }
+};
+
 struct Package : Node {
   std::string name;
   std::vector<std::shared_ptr<Chip>> chips;
+  Symbols symbols;
 
   void visit(Visitor &v) override;
 };
@@ -75,6 +103,14 @@ struct Chip : Node {
   std::vector<std::shared_ptr<Value>> inputs;
   std::shared_ptr<TupleType> output_type;
   std::vector<std::shared_ptr<Stmt>> body;
+  // Implemented by the code generator, the body is empty. Either a chip of
+  // the builtin registry or a cell of aig::replace_chip, whose name starts
+  // with '$'.
+  bool builtin = false;
+  // Symbol of the name, see number_symbols.
+  uint32_t id = Symbols::none;
+  // Number of values, inputs and assignees, which Value::id indexes.
+  uint32_t value_count = 0;
 
   Chip(std::string ident, std::vector<std::shared_ptr<Value>> inputs,
        std::shared_ptr<TupleType> output_type,
@@ -82,17 +118,46 @@ struct Chip : Node {
 
   void visit(Visitor &v) override;
 };
+
+// Tags of the subclasses of Type and Expr, which isa, cast and dyn_cast
+// test instead of RTTI.
+enum class TypeKind { Wire, Register, Slice, Tuple };
+
+enum class ExprKind {
+  Call,
+  Value,
+  RegRead,
+  CreateRegister,
+  Ram,
+  SliceToWireCast,
+  TupleToWireCast,
+  SliceIdx,
+  SliceJoin,
+};
+
 struct Type {
+  const TypeKind kind;
+
+  explicit Type(TypeKind kind) : kind(kind) {}
+
   virtual void visit(TypeVisitor &v) = 0;
   virtual ~Type() = default;
 };
 
 struct WireType : Type {
+  WireType() : Type(TypeKind::Wire) {}
+
   void visit(TypeVisitor &v) override;
+
+  static bool classof(const Type *t) { return t->kind == TypeKind::Wire; }
 };
 
 struct RegisterType : Type {
+  RegisterType() : Type(TypeKind::Register) {}
+
   void visit(TypeVisitor &v) override;
+
+  static bool classof(const Type *t) { return t->kind == TypeKind::Register; }
 };
 
 struct SliceType : Type {
@@ -102,6 +167,8 @@ struct SliceType : Type {
   SliceType(std::shared_ptr<Type> element_type, size_t size);
 
   void visit(TypeVisitor &v) override;
+
+  static bool classof(const Type *t) { return t->kind == TypeKind::Slice; }
 };
 
 struct TupleType : Type {
@@ -111,6 +178,8 @@ struct TupleType : Type {
             std::vector<std::string> names);
 
   void visit(TypeVisitor &v) override;
+
+  static bool classof(const Type *t) { return t->kind == TypeKind::Tuple; }
 };
 
 struct Stmt : Node {};
@@ -123,6 +192,10 @@ struct AssignStmt : Stmt {
 };
 
 struct Expr : Node {
+  const ExprKind kind;
+
+  explicit Expr(ExprKind kind) : kind(kind) {}
+
   virtual std::shared_ptr<Type> result_type() = 0;
 };
 
@@ -130,6 +203,8 @@ struct CallExpr : Expr {
   std::string chip_name;
   std::vector<std::shared_ptr<Expr>> args;
   std::shared_ptr<Type> res_type;
+  // Symbol of chip_name.
+  uint32_t chip_id = Symbols::none;
 
   CallExpr(std::string name, std::vector<std::shared_ptr<Expr>> args,
            std::shared_ptr<Type> res_type);
@@ -137,17 +212,23 @@ struct CallExpr : Expr {
   void visit(Visitor &v) override;
 
   std::shared_ptr<Type> result_type() override;
+
+  static bool classof(const Expr *e) { return e->kind == ExprKind::Call; }
 };
 
 struct Value : Expr {
   std::string ident;
   std::shared_ptr<Type> type;
+  // Index among the values of its chip, dense from 0.
+  uint32_t id = 0;
 
   Value(std::string name, std::shared_ptr<Type> type);
 
   void visit(Visitor &v) override;
 
   std::shared_ptr<Type> result_type() override;
+
+  static bool classof(const Expr *e) { return e->kind == ExprKind::Value; }
 };
 
 struct RetStmt : Stmt {
@@ -156,11 +237,16 @@ struct RetStmt : Stmt {
   void visit(Visitor &v) override;
 };
 
+// reg <- rhs, or reg <- rhs if enable, which keeps the register unchanged
+// while the enable wire is 0.
 struct RegWrite : Stmt {
   std::shared_ptr<Value> reg;
   std::shared_ptr<Expr> rhs;
+  // Null if the register is written every cycle.
+  std::shared_ptr<Expr> enable;
 
-  explicit RegWrite(std::shared_ptr<Value> reg, std::shared_ptr<Expr> rhs);
+  explicit RegWrite(std::shared_ptr<Value> reg, std::shared_ptr<Expr> rhs,
+                    std::shared_ptr<Expr> enable = nullptr);
 
   void visit(Visitor &v) override;
 };
@@ -173,12 +259,19 @@ struct RegRead : Expr {
   void visit(Visitor &v) override;
 
   std::shared_ptr<Type> result_type() override;
+
+  static bool classof(const Expr *e) { return e->kind == ExprKind::RegRead; }
 };
 
 struct CastExpr : Expr {
   std::shared_ptr<Expr> expr;
 
-  CastExpr(std::shared_ptr<Expr> expr);
+  CastExpr(ExprKind kind, std::shared_ptr<Expr> expr);
+
+  static bool classof(const Expr *e) {
+    return e->kind == ExprKind::SliceToWireCast ||
+           e->kind == ExprKind::TupleToWireCast;
+  }
 };
 
 struct CreateRegisterExpr : Expr {
@@ -188,20 +281,55 @@ struct CreateRegisterExpr : Expr {
 
   void visit(Visitor &v) override;
   std::shared_ptr<Type> result_type() override;
+
+  static bool classof(const Expr *e) {
+    return e->kind == ExprKind::CreateRegister;
+  }
+};
+
+// RAM(words, width)(address, data, write) reads the word at the address
+// and, if write is set, replaces it with data at the end of the cycle like
+// a register write. Addresses past the last word read zeros and are not
+// written.
+struct RamExpr : Expr {
+  size_t words;
+  size_t width;
+  std::shared_ptr<Expr> address;
+  std::shared_ptr<Expr> data;
+  std::shared_ptr<Expr> write;
+
+  RamExpr(size_t words, size_t width, std::shared_ptr<Expr> address,
+          std::shared_ptr<Expr> data, std::shared_ptr<Expr> write);
+
+  // Wires of the address, enough to address every word.
+  size_t address_width() const;
+
+  void visit(Visitor &v) override;
+  std::shared_ptr<Type> result_type() override;
+
+  static bool classof(const Expr *e) { return e->kind == ExprKind::Ram; }
 };
 
 struct SliceToWireCast : CastExpr {
-  using CastExpr::CastExpr;
+  explicit SliceToWireCast(std::shared_ptr<Expr> expr);
 
   void visit(Visitor &v) override;
   std::shared_ptr<Type> result_type() override;
+
+  static bool classof(const Expr *e) {
+    return e->kind == ExprKind::SliceToWireCast;
+  }
 };
 
 struct TupleToWireCast : CastExpr {
-  using CastExpr::CastExpr;
+  explicit TupleToWireCast(std::shared_ptr<Expr> expr);
 
   void visit(Visitor &v) override;
   std::shared_ptr<Type> result_type() override;
+
+  static bool classof(const Expr *e) {
+    return e->kind == ExprKind::TupleToWireCast;
+  }
 };
 
 struct SliceIdxExpr : Expr {
@@ -214,6 +342,8 @@ struct SliceIdxExpr : Expr {
   std::shared_ptr<Type> result_type() override;
 
   void visit(Visitor &v) override;
+
+  static bool classof(const Expr *e) { return e->kind == ExprKind::SliceIdx; }
 };
 
 struct SliceJoinExpr : Expr {
@@ -224,7 +354,52 @@ struct SliceJoinExpr : Expr {
   void visit(Visitor &v) override;
 
   std::shared_ptr<Type> result_type() override;
+
+  static bool classof(const Expr *e) { return e->kind == ExprKind::SliceJoin; }
 };
 
+// LLVM-style casts of types and expressions by their kind. They take raw
+// or shared pointers and return raw pointers, so they copy no shared
+// pointer, and are deleted for temporary shared pointers like the result
+// of Expr::result_type, whose object the result could outlive.
+template <typename T, typename U> bool isa(const U *node) {
+  assert(node && "isa on a null pointer");
+  return T::classof(node);
+}
+
+template <typename T, typename U> bool isa(const std::shared_ptr<U> &node) {
+  return isa<T>(node.get());
+}
+
+template <typename T, typename U> T *cast(U *node) {
+  assert(isa<T>(node) && "cast to an incompatible kind");
+  return static_cast<T *>(node);
+}
+
+template <typename T, typename U> T *cast(const std::shared_ptr<U> &node) {
+  return cast<T>(node.get());
+}
+
+template <typename T, typename U> T *cast(std::shared_ptr<U> &&node) = delete;
+
+template <typename T, typename U> T *dyn_cast(U *node) {
+  return isa<T>(node) ? static_cast<T *>(node) : nullptr;
+}
+
+template <typename T, typename U> T *dyn_cast(const std::shared_ptr<U> &node) {
+  return dyn_cast<T>(node.get());
+}
+
+template <typename T, typename U>
+T *dyn_cast(std::shared_ptr<U> &&node) = delete;
+
 void print_package(std::ostream &out, std::shared_ptr<Package> pkg);
+
+// Returns the number of Nand gates of the chip with all sub-chips flattened.
+size_t count_gates(std::shared_ptr<Package> pkg, const std::string &chip);
+
+// Returns the number of register bits of the chip with all sub-chips
+// flattened. RAM words are not counted.
+size_t count_register_bits(std::shared_ptr<Package> pkg,
+                           const std::string &chip);
 } // namespace hdlc::ast
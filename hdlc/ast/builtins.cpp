@@ -0,0 +1,119 @@
+#include "builtins.h"
+
+#include <algorithm>
+#include <map>
+
+namespace hdlc::ast {
+
+namespace {
+std::map<std::string, Builtin> &registry() {
+  static std::map<std::string, Builtin> res = [] {
+    const size_t w = 16;
+    std::vector<Builtin> builtins{
+        {"Nand", {{"a", 1}, {"b", 1}}, {{"res", 1}}, 1, true},
+        {"Not", {{"in", 1}}, {{"out", 1}}, 1, true},
+        {"And", {{"a", 1}, {"b", 1}}, {{"out", 1}}, 2, true},
+        {"Or", {{"a", 1}, {"b", 1}}, {{"out", 1}}, 3, true},
+        {"Xor", {{"a", 1}, {"b", 1}}, {{"out", 1}}, 4, true},
+        {"Mux", {{"a", 1}, {"b", 1}, {"sel", 1}}, {{"out", 1}}, 4, true},
+        {"Add16", {{"a", w}, {"b", w}}, {{"out", w}}, 9 * w, false},
+        {"Inc16", {{"in", w}}, {{"out", w}}, 5 * w, false},
+        {"ALU",
+         {{"x", w},
+          {"y", w},
+          {"zx", 1},
+          {"nx", 1},
+          {"zy", 1},
+          {"ny", 1},
+          {"f", 1},
+          {"no", 1}},
+         {{"out", w}, {"zr", 1}, {"ng", 1}},
+         40 * w + 46,
+         false},
+    };
+    std::map<std::string, Builtin> map;
+    for (auto &b : builtins) {
+      map.emplace(b.name, b);
+    }
+    return map;
+  }();
+  return res;
+}
+
+std::shared_ptr<Type> port_type(size_t width) {
+  auto wire = std::make_shared<WireType>();
+  if (width == 1) {
+    return wire;
+  }
+  return std::make_shared<SliceType>(wire, width);
+}
+
+bool has_width(const std::shared_ptr<Type> &type, size_t width) {
+  if (auto st = dyn_cast<SliceType>(type)) {
+    return width > 1 && st->size == width;
+  }
+  return width == 1 && isa<WireType>(type);
+}
+} // namespace
+
+bool has_ports_of(const Chip &chip, const Builtin &builtin) {
+  auto &outputs = chip.output_type->element_types;
+  auto same_width = [](auto &value, auto &port) {
+    return has_width(value->type, port.width);
+  };
+  auto same_output_width = [](auto &type, auto &port) {
+    return has_width(type, port.width);
+  };
+  return std::equal(chip.inputs.begin(), chip.inputs.end(),
+                    builtin.inputs.begin(), builtin.inputs.end(),
+                    same_width) &&
+         std::equal(outputs.begin(), outputs.end(), builtin.outputs.begin(),
+                    builtin.outputs.end(), same_output_width);
+}
+
+void register_builtin(Builtin builtin) {
+  auto name = builtin.name;
+  registry()[name] = std::move(builtin);
+}
+
+const Builtin *find_builtin(const std::string &name) {
+  auto it = registry().find(name);
+  return it == registry().end() ? nullptr : &it->second;
+}
+
+std::shared_ptr<Chip> make_builtin_chip(const Builtin &builtin) {
+  std::vector<std::shared_ptr<Value>> inputs;
+  for (auto &p : builtin.inputs) {
+    inputs.push_back(std::make_shared<Value>(p.name, port_type(p.width)));
+  }
+  std::vector<std::shared_ptr<Type>> output_types;
+  std::vector<std::string> output_names;
+  for (auto &p : builtin.outputs) {
+    output_types.push_back(port_type(p.width));
+    output_names.push_back(p.name);
+  }
+  auto res = std::make_shared<Chip>(
+      builtin.name, inputs,
+      std::make_shared<TupleType>(output_types, output_names),
+      std::vector<std::shared_ptr<Stmt>>{});
+  res->builtin = true;
+  return res;
+}
+
+bool replace_with_builtin(Package &pkg, const std::string &chip) {
+  auto builtin = find_builtin(chip);
+  auto it = std::find_if(pkg.chips.begin(), pkg.chips.end(),
+                         [&chip](auto &c) { return c->ident == chip; });
+  if (!builtin || it == pkg.chips.end()) {
+    return false;
+  }
+
+  if (!has_ports_of(**it, *builtin)) {
+    return false;
+  }
+  if (!(*it)->builtin) {
+    *it = make_builtin_chip(*builtin);
+  }
+  return true;
+}
+} // namespace hdlc::ast
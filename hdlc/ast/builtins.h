@@ -0,0 +1,48 @@
+#pragma once
+
+#include "ast.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace hdlc::ast {
+
+struct BuiltinPort {
+  std::string name;
+  // A wire when 1, a slice otherwise.
+  size_t width;
+};
+
+// Chip implemented by the code generator instead of Nand gates, see
+// jit::register_builtin for its lowering. A package gets the declaration
+// of a builtin when it calls the builtin without defining a chip of that
+// name.
+struct Builtin {
+  std::string name;
+  std::vector<BuiltinPort> inputs;
+  std::vector<BuiltinPort> outputs;
+  // Nand gates of a gate-level implementation, used for gate counts.
+  size_t gates;
+  // Output wire i only depends on input wire i of every slice and on the
+  // single wires, e.g. And or Mux.
+  bool bitwise;
+};
+
+// Adds the builtin to the registry or replaces the one of the same name.
+// Not safe while chips are compiled.
+void register_builtin(Builtin builtin);
+
+// Returns null if there is no such builtin.
+const Builtin *find_builtin(const std::string &name);
+
+// Returns a declaration of the builtin, a chip without a body.
+std::shared_ptr<Chip> make_builtin_chip(const Builtin &builtin);
+
+// Whether the ports of the chip have the widths of the builtin's ports.
+bool has_ports_of(const Chip &chip, const Builtin &builtin);
+
+// Replaces the chip with the builtin of the same name if their ports have
+// the same widths. Returns false if there is no such builtin.
+bool replace_with_builtin(Package &pkg, const std::string &chip);
+} // namespace hdlc::ast
@@ -1,22 +1,27 @@
 #include "transforms.h"
-#include <algorithm>
 #include <cassert>
+#include <stdexcept>
+#include <string>
 
 namespace hdlc::ast {
 
 struct InsertCastsVisitor : Visitor {
-  Package *cur_pkg;
+  // Chips by their symbols.
+  std::vector<Chip *> chips;
   Chip *cur_chip;
 
   void visit(Package &pkg) override {
-    cur_pkg = &pkg;
+    chips.assign(pkg.symbols.size(), nullptr);
+    for (auto &c : pkg.chips) {
+      chips[c->id] = c.get();
+    }
     for (auto &c : pkg.chips) {
       c->visit(*this);
     }
   }
 
   void visit(Chip &chip) override {
-    if (chip.ident == "Nand") {
+    if (chip.builtin) {
       return;
     }
 
@@ -27,7 +32,7 @@ struct InsertCastsVisitor : Visitor {
   }
 
   void visit(AssignStmt &stmt) override {
-    if (std::dynamic_pointer_cast<CallExpr>(stmt.rhs)) {
+    if (isa<CallExpr>(stmt.rhs)) {
       // Correctly propogate types at first as we don't do this at parsing time
       auto args_count = stmt.assignees.size();
       // TODO: Check
@@ -40,34 +45,29 @@ struct InsertCastsVisitor : Visitor {
         auto type = tuple_type->element_types[i];
         stmt.assignees[i]->type = type;
       }
-    }
-
-    if (std::dynamic_pointer_cast<CreateRegisterExpr>(stmt.rhs)) {
+    } else {
       stmt.assignees[0]->type = stmt.rhs->result_type();
     }
     stmt.rhs->visit(*this);
   }
 
   std::shared_ptr<Expr> cast(std::shared_ptr<Expr> expr,
-                             std::shared_ptr<Type> type) {
-    if (auto wt = std::dynamic_pointer_cast<WireType>(type)) {
-      if (std::dynamic_pointer_cast<WireType>(expr->result_type())) {
+                             const std::shared_ptr<Type> &type) {
+    auto expr_type = expr->result_type();
+    if (isa<WireType>(type)) {
+      if (isa<WireType>(expr_type)) {
         return expr;
       }
-      if (auto st = std::dynamic_pointer_cast<SliceType>(expr->result_type())) {
-        assert(st->size == 1);
+      if (isa<SliceType>(expr_type)) {
+        assert(ast::cast<SliceType>(expr_type)->size == 1);
         return std::make_shared<SliceToWireCast>(expr);
       }
-      auto tt = std::dynamic_pointer_cast<TupleType>(expr->result_type());
-      assert(tt);
-      assert(tt->element_types.size() == 1);
+      assert(ast::cast<TupleType>(expr_type)->element_types.size() == 1);
 
       return std::make_shared<TupleToWireCast>(expr);
     }
-    if (auto st = std::dynamic_pointer_cast<SliceType>(type)) {
-      if (std::dynamic_pointer_cast<SliceType>(expr->result_type())) {
-        return expr;
-      }
+    if (isa<SliceType>(type) && isa<SliceType>(expr_type)) {
+      return expr;
     }
     assert(false);
     return nullptr;
@@ -78,15 +78,13 @@ struct InsertCastsVisitor : Visitor {
       arg->visit(*this);
     }
 
-    auto chip_iter =
-        std::find_if(cur_pkg->chips.begin(), cur_pkg->chips.end(),
-                     [&expr](auto c) { return c->ident == expr.chip_name; });
+    auto chip = chips[expr.chip_id];
 
     // TODO: throw
-    assert(chip_iter != cur_pkg->chips.end());
+    assert(chip);
 
     for (size_t i = 0; i < expr.args.size(); ++i) {
-      auto type = (*chip_iter)->inputs[i]->type;
+      auto type = chip->inputs[i]->type;
       expr.args[i] = cast(expr.args[i], type);
     }
   }
@@ -113,16 +111,73 @@ struct InsertCastsVisitor : Visitor {
     }
   }
 
+  void visit(RegWrite &rw) override {
+    rw.rhs->visit(*this);
+
+    if (auto st = dyn_cast<SliceType>(rw.reg->type)) {
+      rw.rhs = cast(rw.rhs, std::make_shared<SliceType>(
+                                std::make_shared<WireType>(), st->size));
+    } else {
+      rw.rhs = cast(rw.rhs, std::make_shared<WireType>());
+    }
+    if (rw.enable) {
+      rw.enable->visit(*this);
+      rw.enable = cast(rw.enable, std::make_shared<WireType>());
+    }
+  }
+
+  void visit(RamExpr &e) override {
+    e.address->visit(*this);
+    e.data->visit(*this);
+    e.write->visit(*this);
+
+    auto port_type = [](size_t width) -> std::shared_ptr<Type> {
+      auto wire = std::make_shared<WireType>();
+      if (width == 1) {
+        return wire;
+      }
+      return std::make_shared<SliceType>(wire, width);
+    };
+    // Slices are cast to any size, but the RAM is lowered to copies of
+    // exactly this many wires.
+    auto check_width = [](const std::shared_ptr<Expr> &port, size_t width,
+                          const char *name) {
+      auto type = port->result_type();
+      if (auto tt = dyn_cast<TupleType>(type)) {
+        if (tt->element_types.size() == 1) {
+          type = tt->element_types[0];
+        }
+      }
+      size_t port_width = 0;
+      if (auto st = dyn_cast<SliceType>(type)) {
+        port_width = st->size;
+      } else if (isa<WireType>(type)) {
+        port_width = 1;
+      }
+      if (port_width != width) {
+        throw std::invalid_argument(std::string("RAM ") + name + " has " +
+                                    std::to_string(port_width) +
+                                    " wires, expected " +
+                                    std::to_string(width));
+      }
+    };
+    check_width(e.address, e.address_width(), "address");
+    check_width(e.data, e.width, "data");
+    e.address = cast(e.address, port_type(e.address_width()));
+    e.data = cast(e.data, port_type(e.width));
+    e.write = cast(e.write, std::make_shared<WireType>());
+  }
+
   void visit(SliceIdxExpr &) override {}
   void visit(Value &) override {}
   void visit(SliceToWireCast &) override {}
   void visit(TupleToWireCast &) override {}
-  void visit(RegWrite &) override {}
   void visit(RegRead &) override {}
   void visit(CreateRegisterExpr &) override {}
 };
 
 void insert_casts(std::shared_ptr<Package> pakage) {
+  number_symbols(*pakage);
   InsertCastsVisitor v;
   v.visit(*pakage);
 }
@@ -1,9 +1,38 @@
 #include "parser.h"
+#include "builtins.h"
 #include "transforms.h"
 
+#include <algorithm>
+#include <set>
+
 namespace hdlc::ast {
 
-using SymbolMap = std::unordered_map<std::string, std::shared_ptr<Value>>;
+// Values of the chip being read by the symbols of their names.
+class SymbolMap {
+  std::vector<std::shared_ptr<Value>> values;
+  // Symbols with a value, which clear resets.
+  std::vector<uint32_t> defined;
+
+public:
+  bool count(uint32_t id) const { return id < values.size() && values[id]; }
+
+  std::shared_ptr<Value> &operator[](uint32_t id) {
+    if (id >= values.size()) {
+      values.resize(id + 1);
+    }
+    if (!values[id]) {
+      defined.push_back(id);
+    }
+    return values[id];
+  }
+
+  void clear() {
+    for (auto id : defined) {
+      values[id] = nullptr;
+    }
+    defined.clear();
+  }
+};
 
 class Parser {
 private:
@@ -14,7 +43,57 @@ private:
 
   std::vector<size_t> line_length;
 
-  std::unordered_map<std::string, std::shared_ptr<Chip>> chips;
+  // Chips read so far by their symbols.
+  std::vector<std::shared_ptr<Chip>> chips;
+  // Builtins declared by a call, which a later chip of the same name may
+  // replace, and the chips called by the chip being read.
+  std::set<uint32_t> bound_builtins;
+  std::vector<uint32_t> calls;
+  SymbolMap local_vars;
+  Package *pkg = nullptr;
+
+  uint32_t intern(std::string_view name) { return pkg->symbols.intern(name); }
+
+  std::shared_ptr<Chip> &find_chip(uint32_t id) {
+    if (id >= chips.size()) {
+      chips.resize(id + 1);
+    }
+    return chips[id];
+  }
+
+  void add_chip(std::shared_ptr<Chip> chip) {
+    chip->id = intern(chip->ident);
+    find_chip(chip->id) = chip;
+    pkg->chips.push_back(std::move(chip));
+  }
+
+  void declare_builtin(const Builtin &builtin) {
+    add_chip(make_builtin_chip(builtin));
+  }
+
+  // Calls of the builtin read so far call the chip instead. The chip must
+  // have the ports of the builtin and only call chips declared before it.
+  void replace_bound_builtin(std::shared_ptr<Chip> chip, size_t chip_line,
+                             size_t chip_line_pos) {
+    auto id = intern(chip->ident);
+    auto &declared = find_chip(id);
+    auto it = std::find(pkg->chips.begin(), pkg->chips.end(), declared);
+    auto builtin = find_builtin(chip->ident);
+    auto declared_before = [&](uint32_t callee) {
+      return std::find(pkg->chips.begin(), it, chips[callee]) != it;
+    };
+    if (!builtin || !has_ports_of(*chip, *builtin) ||
+        !std::all_of(calls.begin(), calls.end(), declared_before)) {
+      throw ParserError("chip with name " + chip->ident +
+                            " already declared as a builtin by an earlier "
+                            "call",
+                        chip_line, chip_line_pos);
+    }
+    chip->id = id;
+    *it = chip;
+    declared = std::move(chip);
+    bound_builtins.erase(id);
+  }
 
 public:
   explicit Parser(std::string data)
@@ -23,19 +102,8 @@ public:
   std::shared_ptr<Package> read_package(std::string name) {
     auto res = std::make_shared<Package>();
     res->name = name;
-    {
-      auto out_types =
-          std::vector<std::shared_ptr<Type>>{std::make_shared<WireType>()};
-      auto out_names = std::vector<std::string>{std::string("res")};
-
-      auto a = std::make_shared<Value>("a", std::make_shared<WireType>());
-      auto b = std::make_shared<Value>("b", std::make_shared<WireType>());
-      auto res_type = std::make_shared<TupleType>(out_types, out_names);
-      chips["Nand"] = std::make_shared<Chip>(
-          "Nand", std::vector<std::shared_ptr<ast::Value>>{a, b}, res_type,
-          std::vector<std::shared_ptr<ast::Stmt>>{});
-      res->chips.push_back(chips["Nand"]);
-    }
+    pkg = res.get();
+    declare_builtin(*find_builtin("Nand"));
 
     skip_spaces();
 
@@ -45,13 +113,15 @@ public:
 
       auto chip = read_chip();
 
-      if (chips.count(chip->ident)) {
+      auto id = intern(chip->ident);
+      if (bound_builtins.count(id)) {
+        replace_bound_builtin(std::move(chip), cur_line, cur_line_pos);
+      } else if (find_chip(id)) {
         throw ParserError("chip with name " + chip->ident + " already declared",
                           cur_line, cur_line_pos);
+      } else {
+        add_chip(chip);
       }
-
-      res->chips.push_back(chip);
-      chips[chip->ident] = chip;
       skip_spaces();
     }
 
@@ -111,6 +181,10 @@ private:
     move_to(get_end_pos([](char c) { return std::isspace(c); }));
   }
 
+  void skip_line_spaces() {
+    move_to(get_end_pos([](char c) { return c == ' ' || c == '\t'; }));
+  }
+
   template <typename P> std::string_view peak_symbol_sequence(P predicate) {
     auto end = get_end_pos([&predicate](char c) { return predicate(c); });
     auto len = end - pos;
@@ -156,15 +230,16 @@ private:
     std::string name(read_ident());
     skip_spaces();
     expect_symbol_sequence("(");
+    calls.clear();
 
     skip_spaces();
 
-    SymbolMap local_vars;
+    local_vars.clear();
 
     auto params = read_params();
 
     for (auto &p : params) {
-      local_vars[p->ident] = p;
+      local_vars[intern(p->ident)] = p;
     }
 
     skip_spaces();
@@ -303,19 +378,31 @@ private:
   }
 
   std::shared_ptr<RegWrite> read_reg_write(SymbolMap &symbol_map) {
-    std::string reg_name(read_ident());
+    auto reg_name = read_ident();
+    auto reg_id = intern(reg_name);
 
-    if (!symbol_map.count(reg_name)) {
-      throw ParserError("Register with name " + reg_name +
+    if (!symbol_map.count(reg_id)) {
+      throw ParserError("Register with name " + std::string(reg_name) +
                             " was not initialized",
                         line, line_pos);
     }
-    auto reg = symbol_map[reg_name];
+    auto reg = symbol_map[reg_id];
     skip_spaces();
     expect_symbol_sequence("<-");
     skip_spaces();
     auto rhs = read_expr(symbol_map);
-    return std::make_shared<RegWrite>(reg, rhs);
+    // The enable is on the line of the write, the next statement may start
+    // with a variable named if.
+    skip_line_spaces();
+    std::shared_ptr<Expr> enable;
+    auto keyword = peak_symbol_sequence(
+        [](char c) { return std::isalnum(c) || c == '_'; });
+    if (keyword == "if") {
+      expect_symbol_sequence("if");
+      skip_spaces();
+      enable = read_expr(symbol_map);
+    }
+    return std::make_shared<RegWrite>(reg, rhs, enable);
   }
 
   std::shared_ptr<RetStmt> read_ret_stmt(SymbolMap &symbol_map) {
@@ -339,12 +426,12 @@ private:
   }
 
   std::shared_ptr<SliceIdxExpr> read_slice_idx_expr(SymbolMap &symbol_map) {
-    std::string slice_name(read_ident());
-    if (!symbol_map.count(slice_name)) {
+    auto slice_id = intern(read_ident());
+    if (!symbol_map.count(slice_id)) {
       throw ParserError("slice with the following name not found", line,
                         line_pos);
     }
-    auto slice = symbol_map[slice_name];
+    auto slice = symbol_map[slice_id];
     skip_spaces();
 
     expect_symbol_sequence("[");
@@ -383,6 +470,44 @@ private:
     return std::make_shared<CreateRegisterExpr>(register_type);
   }
 
+  // RAM(words, width)(address, data, write), unless the package has a chip
+  // named RAM.
+  bool peek_ram() {
+    auto ident = peak_symbol_sequence(
+        [](char c) { return std::isalnum(c) || c == '_'; });
+    return ident == "RAM" && !find_chip(intern(ident));
+  }
+
+  std::shared_ptr<RamExpr> read_ram(SymbolMap &symbol_map) {
+    expect_symbol_sequence("RAM");
+    skip_spaces();
+    expect_symbol_sequence("(");
+    skip_spaces();
+    auto words = read_uint();
+    skip_spaces();
+    expect_symbol_sequence(",");
+    skip_spaces();
+    auto width = read_uint();
+    skip_spaces();
+    expect_symbol_sequence(")");
+    if (!words || !width) {
+      throw ParserError("RAM must have at least one word of one wire", line,
+                        line_pos);
+    }
+    skip_spaces();
+    expect_symbol_sequence("(");
+    skip_spaces();
+    auto ports = read_expr_list(symbol_map);
+    skip_spaces();
+    expect_symbol_sequence(")");
+    if (ports.size() != 3) {
+      throw ParserError("RAM takes an address, data and a write enable", line,
+                        line_pos);
+    }
+    return std::make_shared<RamExpr>(words, width, ports[0], ports[1],
+                                     ports[2]);
+  }
+
   std::shared_ptr<Expr> read_expr(SymbolMap &symbol_map) {
     if (peek_symbol() == '<') {
       return read_reg_read(symbol_map);
@@ -393,28 +518,45 @@ private:
     if (peek_string() == "Register") {
       return read_create_register();
     }
+    if (peek_ram()) {
+      return read_ram(symbol_map);
+    }
 
     auto cur_pos = pos;
-    std::string ident(read_ident());
-    skip_spaces();
+    auto ident = read_ident();
+    auto id = intern(ident);
+    // A variable may end the statement, the next line is not part of it.
+    skip_line_spaces();
     if (peek_symbol() == '(') {
       expect_symbol_sequence("(");
       skip_spaces();
       auto params = read_expr_list(symbol_map);
       skip_spaces();
       expect_symbol_sequence(")");
-      return std::make_shared<CallExpr>(ident, params,
-                                        chips[ident]->output_type);
+      if (!find_chip(id)) {
+        auto builtin = find_builtin(std::string(ident));
+        if (!builtin) {
+          throw ParserError("unknown chip " + std::string(ident), line,
+                            line_pos);
+        }
+        declare_builtin(*builtin);
+        bound_builtins.insert(id);
+      }
+      calls.push_back(id);
+      auto res = std::make_shared<CallExpr>(std::string(ident), params,
+                                            chips[id]->output_type);
+      res->chip_id = id;
+      return res;
     }
     if (peek_symbol() == '[') {
       move_to(cur_pos);
       return read_slice_idx_expr(symbol_map);
     }
 
-    if (!symbol_map.count(ident)) {
+    if (!symbol_map.count(id)) {
       throw ParserError("Referenced variable not initialized", line, line_pos);
     }
-    return symbol_map[ident];
+    return symbol_map[id];
   }
 
   std::shared_ptr<SliceJoinExpr> read_slice_join_expr(SymbolMap &symbol_map) {
@@ -429,13 +571,13 @@ private:
   std::shared_ptr<RegRead> read_reg_read(SymbolMap &symbol_map) {
     expect_symbol_sequence("<-");
     skip_spaces();
-    std::string ident(read_ident());
+    auto id = intern(read_ident());
 
-    if (!symbol_map.count(ident)) {
+    if (!symbol_map.count(id)) {
       throw ParserError("Referenced variable not initialized", line, line_pos);
     }
 
-    return std::make_shared<RegRead>(symbol_map[ident]);
+    return std::make_shared<RegRead>(symbol_map[id]);
   }
 
   std::vector<std::shared_ptr<Expr>> read_expr_list(SymbolMap &symbol_map) {
@@ -460,15 +602,17 @@ private:
     std::vector<std::shared_ptr<Value>> res;
 
     while (true) {
-      auto val = std::make_shared<Value>(std::string(read_ident()),
+      auto ident = read_ident();
+      auto id = intern(ident);
+      auto val = std::make_shared<Value>(std::string(ident),
                                          std::make_shared<WireType>());
 
-      if (symbol_map.count(val->ident)) {
+      if (symbol_map.count(id)) {
         throw ParserError("Multiple assign to local variable", line, line_pos);
       }
 
       res.emplace_back(val);
-      symbol_map[val->ident] = val;
+      symbol_map[id] = val;
 
       skip_spaces();
       if (peek_symbol() == ',') {
@@ -482,10 +626,15 @@ private:
     return res;
   }
 };
+std::shared_ptr<Package> read_package(const std::string &data,
+                                      const std::string &name) {
+  Parser parser(data);
+  return parser.read_package(name);
+}
+
 std::shared_ptr<Package> parse_package(const std::string &data,
                                        const std::string &name) {
-  Parser parser(data);
-  auto pkg = parser.read_package(name);
+  auto pkg = read_package(data, name);
   insert_casts(pkg);
   return pkg;
 }
@@ -10,6 +10,10 @@
 #include <unordered_map>
 
 namespace hdlc::ast {
+// Parses the package without running any transforms on it.
+std::shared_ptr<Package> read_package(const std::string &data,
+                                      const std::string &name);
+
 std::shared_ptr<Package> parse_package(const std::string &data,
                                        const std::string &name);
 }
\ No newline at end of file
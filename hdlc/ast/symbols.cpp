@@ -0,0 +1,101 @@
+#include "transforms.h"
+
+namespace hdlc::ast {
+
+uint32_t Symbols::intern(std::string_view name) {
+  auto it = ids.find(name);
+  if (it != ids.end()) {
+    return it->second;
+  }
+  auto id = uint32_t(names.size());
+  names.emplace_back(name);
+  ids.emplace(names.back(), id);
+  return id;
+}
+
+uint32_t Symbols::find(std::string_view name) const {
+  auto it = ids.find(name);
+  return it == ids.end() ? none : it->second;
+}
+
+struct NumberSymbolsVisitor : Visitor {
+  Symbols &symbols;
+  Chip *cur_chip = nullptr;
+
+  explicit NumberSymbolsVisitor(Symbols &symbols) : symbols(symbols) {}
+
+  void visit(Package &pkg) override {
+    for (auto &c : pkg.chips) {
+      c->visit(*this);
+    }
+  }
+
+  void visit(Chip &chip) override {
+    if (chip.id == Symbols::none) {
+      chip.id = symbols.intern(chip.ident);
+    }
+    cur_chip = &chip;
+    chip.value_count = 0;
+    for (auto &i : chip.inputs) {
+      i->id = chip.value_count++;
+    }
+    for (auto &s : chip.body) {
+      s->visit(*this);
+    }
+  }
+
+  void visit(AssignStmt &stmt) override {
+    for (auto &a : stmt.assignees) {
+      a->id = cur_chip->value_count++;
+    }
+    stmt.rhs->visit(*this);
+  }
+
+  void visit(CallExpr &expr) override {
+    if (expr.chip_id == Symbols::none) {
+      expr.chip_id = symbols.intern(expr.chip_name);
+    }
+    for (auto &a : expr.args) {
+      a->visit(*this);
+    }
+  }
+
+  void visit(RetStmt &stmt) override {
+    for (auto &e : stmt.results) {
+      e->visit(*this);
+    }
+  }
+
+  void visit(RegWrite &rw) override {
+    rw.rhs->visit(*this);
+    if (rw.enable) {
+      rw.enable->visit(*this);
+    }
+  }
+
+  void visit(SliceJoinExpr &e) override {
+    for (auto &v : e.values) {
+      v->visit(*this);
+    }
+  }
+
+  void visit(SliceToWireCast &e) override { e.expr->visit(*this); }
+  void visit(TupleToWireCast &e) override { e.expr->visit(*this); }
+
+  void visit(RamExpr &e) override {
+    e.address->visit(*this);
+    e.data->visit(*this);
+    e.write->visit(*this);
+  }
+
+  void visit(Value &) override {}
+  void visit(RegRead &) override {}
+  void visit(SliceIdxExpr &) override {}
+  void visit(CreateRegisterExpr &) override {}
+};
+
+void number_symbols(Package &pkg) {
+  NumberSymbolsVisitor v(pkg.symbols);
+  v.visit(pkg);
+}
+} // namespace hdlc::ast
@@ -4,4 +4,9 @@
 
 namespace hdlc::ast {
 void insert_casts(std::shared_ptr<Package> pakage);
-}
\ No newline at end of file
+
+// Assigns the symbols of chips and calls that have none and numbers the
+// values of every chip. Packages changed after parsing, for example by
+// aig::replace_chip, are numbered again before their code is generated.
+void number_symbols(Package &pkg);
+} // namespace hdlc::ast
\ No newline at end of file
@@ -0,0 +1,190 @@
+#include "async.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+
+namespace hdlc {
+
+// Priority and submission number of a queued job.
+using JobKey = std::pair<int, uint64_t>;
+
+// Higher priority first, then first submitted first.
+struct JobOrder {
+  bool operator()(const JobKey &a, const JobKey &b) const {
+    if (a.first != b.first) {
+      return a.first > b.first;
+    }
+    return a.second < b.second;
+  }
+};
+
+struct CompileJob {
+  std::string code;
+  std::string chip_name;
+  CompileOptions options;
+  std::shared_ptr<CompileQueue> queue;
+  // Position in the queue, guarded by the queue's mutex like started.
+  JobKey key;
+  bool started = false;
+
+  std::mutex mutex;
+  std::condition_variable finished_cv;
+  bool finished = false;
+  std::shared_ptr<Chip> chip;
+  std::exception_ptr error;
+  std::function<void()> callback;
+
+  void finish(std::shared_ptr<Chip> res, std::exception_ptr e) {
+    std::function<void()> run_callback;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      chip = std::move(res);
+      error = std::move(e);
+      finished = true;
+      run_callback = std::move(callback);
+    }
+    finished_cv.notify_all();
+    if (run_callback) {
+      run_callback();
+    }
+  }
+
+  void cancel(const std::string &reason) {
+    finish(nullptr, std::make_exception_ptr(CompileCanceled(reason)));
+  }
+};
+
+struct CompileQueue {
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::map<JobKey, std::shared_ptr<CompileJob>, JobOrder> jobs;
+  uint64_t submitted = 0;
+  size_t max_queued;
+  bool stopping = false;
+
+  // Returns nullptr once the pool stops.
+  std::shared_ptr<CompileJob> pop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [this]() { return stopping || !jobs.empty(); });
+    if (stopping) {
+      return nullptr;
+    }
+    auto job = std::move(jobs.begin()->second);
+    jobs.erase(jobs.begin());
+    job->started = true;
+    return job;
+  }
+};
+
+ChipFuture::ChipFuture(std::shared_ptr<CompileJob> job)
+    : job(std::move(job)) {}
+
+bool ChipFuture::on_finish(std::function<void()> callback) {
+  std::lock_guard<std::mutex> lock(job->mutex);
+  if (job->finished) {
+    return false;
+  }
+  if (job->callback) {
+    throw std::logic_error("compile is already awaited");
+  }
+  job->callback = std::move(callback);
+  return true;
+}
+
+bool ChipFuture::ready() const {
+  std::lock_guard<std::mutex> lock(job->mutex);
+  return job->finished;
+}
+
+void ChipFuture::wait() const {
+  std::unique_lock<std::mutex> lock(job->mutex);
+  job->finished_cv.wait(lock, [this]() { return job->finished; });
+}
+
+std::shared_ptr<Chip> ChipFuture::get() const {
+  wait();
+  if (job->error) {
+    std::rethrow_exception(job->error);
+  }
+  return job->chip;
+}
+
+bool ChipFuture::cancel() {
+  if (!job->queue) {
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> lock(job->queue->mutex);
+    if (job->started || !job->queue->jobs.erase(job->key)) {
+      return false;
+    }
+  }
+  job->cancel("compile was canceled");
+  return true;
+}
+
+CompilePool::CompilePool(size_t threads, size_t max_queued)
+    : queue(std::make_shared<CompileQueue>()) {
+  queue->max_queued = max_queued;
+  if (!threads) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for (size_t t = 0; t < threads; ++t) {
+    this->threads.emplace_back([queue = queue.get()]() {
+      while (auto job = queue->pop()) {
+        try {
+          job->finish(create_chip(job->code, job->chip_name, job->options),
+                      nullptr);
+        } catch (...) {
+          job->finish(nullptr, std::current_exception());
+        }
+      }
+    });
+  }
+}
+
+CompilePool::~CompilePool() {
+  decltype(queue->jobs) dropped;
+  {
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    queue->stopping = true;
+    dropped.swap(queue->jobs);
+  }
+  queue->cv.notify_all();
+  for (auto &[key, job] : dropped) {
+    job->cancel("compile pool was destroyed");
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+}
+
+ChipFuture CompilePool::submit(std::string code, std::string chip_name,
+                               CompileOptions options, int priority) {
+  auto job = std::make_shared<CompileJob>();
+  job->code = std::move(code);
+  job->chip_name = std::move(chip_name);
+  job->options = std::move(options);
+  {
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    if (queue->jobs.size() < queue->max_queued) {
+      job->queue = queue;
+      job->key = {priority, queue->submitted++};
+      queue->jobs.emplace(job->key, job);
+    }
+  }
+  if (!job->queue) {
+    job->cancel("compile queue is full");
+  } else {
+    queue->cv.notify_one();
+  }
+  return ChipFuture(std::move(job));
+}
+
+CompilePool &CompilePool::shared() {
+  static CompilePool pool;
+  return pool;
+}
+} // namespace hdlc
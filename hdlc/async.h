@@ -0,0 +1,83 @@
+#pragma once
+
+#include "chip.h"
+
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace hdlc {
+
+// Thrown by ChipFuture::get for a compile that was canceled, rejected
+// because the queue of its pool was full or dropped when the pool was
+// destroyed.
+struct CompileCanceled : std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+struct CompileJob;
+struct CompileQueue;
+
+// Result of an asynchronous compile. Also an awaitable for C++20
+// coroutines, co_await returns the chip or throws like get. The awaiting
+// coroutine is resumed on the compile thread, or on the thread canceling
+// the compile.
+class ChipFuture {
+  std::shared_ptr<CompileJob> job;
+
+  // Registers a callback run once the compile finishes, returns false
+  // without registering it if the compile already finished.
+  bool on_finish(std::function<void()> callback);
+
+public:
+  explicit ChipFuture(std::shared_ptr<CompileJob> job);
+
+  bool ready() const;
+  void wait() const;
+  // Waits for the compile and returns the chip or rethrows the exception
+  // of create_chip or CompileCanceled.
+  std::shared_ptr<Chip> get() const;
+  // Removes the compile from the queue unless a thread already started
+  // it, a compile cannot be interrupted. Returns true if it was removed.
+  bool cancel();
+
+  bool await_ready() const { return ready(); }
+  template <typename Handle> bool await_suspend(Handle handle) {
+    return on_finish([handle]() mutable { handle.resume(); });
+  }
+  std::shared_ptr<Chip> await_resume() const { return get(); }
+};
+
+// Threads compiling chips in the order of their priority, higher first,
+// and of submission among equal priorities.
+class CompilePool {
+  std::shared_ptr<CompileQueue> queue;
+  std::vector<std::thread> threads;
+
+public:
+  // 0 threads means one per core. Compiles submitted while max_queued
+  // others wait are rejected.
+  explicit CompilePool(size_t threads = 0, size_t max_queued = 1024);
+  // Cancels the waiting compiles and waits for the running ones.
+  ~CompilePool();
+  CompilePool(const CompilePool &) = delete;
+  CompilePool &operator=(const CompilePool &) = delete;
+
+  // Queues create_chip(code, chip_name, options), never blocks.
+  ChipFuture submit(std::string code, std::string chip_name,
+                    CompileOptions options = {}, int priority = 0);
+
+  // Pool of create_chip_async with the default arguments.
+  static CompilePool &shared();
+};
+
+inline ChipFuture create_chip_async(std::string code, std::string chip_name,
+                                    CompileOptions options = {},
+                                    int priority = 0) {
+  return CompilePool::shared().submit(std::move(code), std::move(chip_name),
+                                      std::move(options), priority);
+}
+} // namespace hdlc
@@ -1,35 +1,131 @@
 #include "chip.h"
+#include "hdlc/aig/aig.h"
 #include "hdlc/ast/ast.h"
+#include "hdlc/ast/builtins.h"
 #include "hdlc/ast/parser.h"
+#include "hdlc/ast/transforms.h"
 #include "hdlc/jit/codegen.h"
 #include "hdlc/jit/module.h"
+#include "hdlc/jit/stats.h"
+#include "hdlc/jit/trace.h"
 
+#include <atomic>
+#include <cstring>
+#include <stdexcept>
 #include <fstream>
-#include <llvm/IR/LLVMContext.h>
-#include <llvm/Support/TargetSelect.h>
-
-#include <mutex>
 
 namespace hdlc {
 
 struct ChipImpl : Chip {
-  std::unique_ptr<jit::Module> module;
-  std::vector<int8_t> reg_buf;
+  // Declared first so that it outlives the code writing to its ring.
+  std::unique_ptr<jit::TraceWriter> trace;
+  // Shared between forks.
+  std::shared_ptr<jit::Module> module;
+  // Copied on the next run while it may be shared with snapshots or forks.
+  std::shared_ptr<std::vector<int8_t>> reg_buf;
+  bool reg_buf_shared = false;
+  CompileStats stats;
+  std::vector<jit::ChipInstance> instances;
+  std::vector<size_t> banks;
+  size_t inputs_width = 0;
+  size_t outputs_width = 0;
+  bool profile_cycles;
+
+  ChipImpl(const std::string &code, const std::string &chip_name,
+           const CompileOptions &options)
+      : module(nullptr), reg_buf(std::make_shared<std::vector<int8_t>>()),
+        profile_cycles(options.profile_cycles) {
+    jit::PhaseTimer parse_timer(&stats, "parse");
+    auto pkg = ast::read_package(code, "gates");
+    if (options.prefer_builtins) {
+      for (size_t i = 0; i < pkg->chips.size(); ++i) {
+        auto name = pkg->chips[i]->ident;
+        ast::replace_with_builtin(*pkg, name);
+      }
+    }
+    stats.chips = pkg->chips.size();
+    parse_timer.finish({{"chips", stats.chips}});
+
+    jit::PhaseTimer casts_timer(&stats, "insert_casts");
+    ast::insert_casts(pkg);
+    casts_timer.finish();
+
+    if (options.optimize_aig) {
+      jit::PhaseTimer aig_timer(&stats, "aig");
+      auto aig = aig::from_package(pkg, chip_name);
+      auto ands = aig.and_count();
+      auto depth = aig.depth();
+      aig::optimize(aig);
+      auto cells = aig::find_cells(aig);
+      aig::replace_chip(pkg, chip_name, aig, cells);
+      aig_timer.finish({{"ands", ands},
+                        {"depth", depth},
+                        {"optimized_ands", aig.and_count()},
+                        {"optimized_depth", aig.depth()},
+                        {"cells", cells.size()}});
+    }
 
-  ChipImpl(const std::string &code, const std::string &chip_name)
-      : module(nullptr), reg_buf(0) {
-    static std::once_flag llvm_initialized;
+    stats.gates = ast::count_gates(pkg, chip_name);
+    stats.registers = ast::count_register_bits(pkg, chip_name);
 
-    std::call_once(llvm_initialized, []() {
-      llvm::InitializeNativeTarget();
-      llvm::InitializeNativeTargetAsmPrinter();
-    });
+    jit::ModuleOptions module_options;
+    module_options.opt_level = options.opt_level;
+    module_options.hot_threshold = options.hot_threshold;
 
-    auto pkg = ast::parse_package(code, "gates");
+    module_options.stats = &stats;
+
+    jit::PhaseTimer codegen_timer(&stats, "codegen");
+    jit::CodegenOptions codegen_options;
+    codegen_options.profile = options.profile || options.profile_cycles;
+    codegen_options.profile_cycles = options.profile_cycles;
+    codegen_options.align_registers = options.align_registers;
+    codegen_options.double_buffer = options.double_buffer_registers;
+    if (options.lut_max_inputs > jit::max_lut_inputs) {
+      throw std::invalid_argument("lut_max_inputs must be at most " +
+                                  std::to_string(jit::max_lut_inputs));
+    }
+    codegen_options.lut_max_inputs = options.lut_max_inputs;
+    codegen_options.fixed_inputs = options.fixed_inputs;
+    codegen_options.unroll_max_width = options.unroll_max_width;
+    codegen_options.ssa_slices = options.ssa_slices;
+    auto &testbench = options.testbench;
+    if ((!testbench.checker_chip.empty() || testbench.checker) &&
+        testbench.stimulus_chip.empty() && !testbench.stimulus) {
+      throw std::invalid_argument("testbench checker needs a stimulus");
+    }
+    codegen_options.cosim.stimulus_chip = testbench.stimulus_chip;
+    codegen_options.cosim.checker_chip = testbench.checker_chip;
+    codegen_options.cosim.stimulus = testbench.stimulus;
+    codegen_options.cosim.checker = testbench.checker;
+    codegen_options.cosim.context = testbench.context;
+    codegen_options.cosim.report = report_mismatch;
+    if (!options.trace_path.empty()) {
+      trace = std::make_unique<jit::TraceWriter>(options.trace_path);
+      codegen_options.trace = trace->get_ring();
+    }
+    auto ir = jit::generate_ir(pkg, chip_name, codegen_options);
+    inputs_width = ir->inputs_width;
+    outputs_width = ir->outputs_width;
+    if (codegen_options.profile) {
+      instances = std::move(ir->instances);
+      banks = ir->banks;
+    }
+    if (trace) {
+      trace->start(std::move(ir->trace_signals));
+    }
+    stats.ir_instructions = ir->module->getInstructionCount();
+    codegen_timer.finish({{"gates", stats.gates},
+                          {"registers", stats.registers},
+                          {"ir_instructions", stats.ir_instructions},
+                          {"lookup_tables", ir->lookup_tables},
+                          {"specializations", ir->specializations}});
 
-    auto ctx = std::make_unique<llvm::LLVMContext>();
+    module = jit::compile_ir(std::move(ir), module_options);
 
-    module = jit::transform_pkg_to_module(std::move(ctx), pkg, chip_name);
+    if (!options.chrome_trace_path.empty()) {
+      std::ofstream trace(options.chrome_trace_path);
+      stats.write_chrome_trace(trace);
+    }
 
     auto requested_chip_iter =
         std::find_if(pkg->chips.begin(), pkg->chips.end(),
@@ -41,16 +137,142 @@ struct ChipImpl : Chip {
 
     auto requested_chip = *requested_chip_iter;
 
-    reg_buf.resize(module->buffer_size());
+    reg_buf->resize(module->buffer_size());
+  }
+
+  // Forks and snapshots only read a shared buffer while they hold a
+  // reference, and only this chip can add one. Seeing the last reference
+  // makes the buffer ours once we synchronize with the release of the
+  // others, which the relaxed load of use_count does not do by itself.
+  void own_reg_buf() {
+    if (reg_buf_shared) {
+      if (reg_buf.use_count() > 1) {
+        reg_buf = std::make_shared<std::vector<int8_t>>(*reg_buf);
+      } else {
+        std::atomic_thread_fence(std::memory_order_acquire);
+      }
+      reg_buf_shared = false;
+    }
+  }
+
+  bool owns(const std::weak_ptr<const void> &owner) const {
+    return !owner.owner_before(module) && !module.owner_before(owner);
+  }
+
+  struct CosimReport {
+    ChipImpl *chip;
+    CosimResult *result;
+    size_t max_mismatches;
+  };
+
+  static int report_mismatch(void *context, uint64_t cycle,
+                             const int8_t *inputs, const int8_t *outputs) {
+    auto report = static_cast<CosimReport *>(context);
+    auto chip = report->chip;
+    report->result->mismatches.push_back(
+        {cycle,
+         {inputs, inputs + chip->inputs_width},
+         {outputs, outputs + chip->outputs_width}});
+    return report->result->mismatches.size() == report->max_mismatches;
+  }
+
+  CosimResult cosimulate(uint64_t cycles, size_t max_mismatches) override {
+    if (!module->has_testbench()) {
+      throw std::logic_error("chip was compiled without a testbench");
+    }
+    own_reg_buf();
+    CosimResult res;
+    CosimReport report{this, &res, max_mismatches};
+    res.cycles = module->cosimulate(reg_buf->data(), cycles, &report);
+    return res;
   }
 
   void run(int8_t *inputs, int8_t *outputs) override {
-    module->run(reg_buf.data(), inputs, outputs);
+    own_reg_buf();
+    module->run(reg_buf->data(), inputs, outputs);
   }
+
+  void run(ChipState &state, int8_t *inputs, int8_t *outputs) override {
+    if (!owns(state.owner) || state.buf.size() != module->buffer_size()) {
+      throw std::invalid_argument("state does not belong to the chip");
+    }
+    module->run(state.buf.data(), inputs, outputs);
+  }
+
+  ChipState make_state() override {
+    if (trace) {
+      throw std::logic_error("traced chips only run on their own state");
+    }
+    ChipState res;
+    res.buf.assign(module->buffer_size(), 0);
+    res.owner = module;
+    return res;
+  }
+
+  bool is_optimized() override { return module->is_optimized(); }
+
+  const CompileStats &compile_stats() override { return stats; }
+
+  // Sum of the counter over all register banks.
+  uint64_t read_counter(size_t offset) {
+    uint64_t res = 0;
+    for (auto bank : banks) {
+      uint64_t val;
+      std::memcpy(&val, reg_buf->data() + bank + offset, sizeof(val));
+      res += val;
+    }
+    return res;
+  }
+
+  std::vector<ProfileEntry> profile() override {
+    std::vector<ProfileEntry> res;
+    for (auto &inst : instances) {
+      uint64_t c = 0;
+      if (profile_cycles) {
+        c = read_counter(inst.offset + sizeof(uint64_t));
+      }
+      res.push_back({inst.path, inst.chip, read_counter(inst.offset), c, c});
+    }
+    for (size_t i = 1; i < instances.size(); ++i) {
+      res[instances[i].parent].self_cycles -= res[i].cycles;
+    }
+    return res;
+  }
+
+  Snapshot snapshot() override {
+    reg_buf_shared = true;
+    Snapshot res;
+    res.state = reg_buf;
+    res.owner = module;
+    return res;
+  }
+
+  void restore(const Snapshot &snapshot) override {
+    if (!owns(snapshot.owner) || snapshot.size() != reg_buf->size()) {
+      throw std::invalid_argument("snapshot does not match the chip");
+    }
+    reg_buf = snapshot.state;
+    reg_buf_shared = true;
+  }
+
+  std::shared_ptr<Chip> fork() override {
+    if (trace) {
+      throw std::logic_error("traced chips cannot be forked");
+    }
+    reg_buf_shared = true;
+    return std::make_shared<ChipImpl>(*this);
+  }
+
+  ChipImpl(const ChipImpl &other)
+      : module(other.module), reg_buf(other.reg_buf), reg_buf_shared(true),
+        stats(other.stats), instances(other.instances), banks(other.banks),
+        inputs_width(other.inputs_width), outputs_width(other.outputs_width),
+        profile_cycles(other.profile_cycles) {}
 };
 
 std::shared_ptr<Chip> create_chip(const std::string &code,
-                                  const std::string &chip_name) {
-  return std::make_shared<ChipImpl>(code, chip_name);
+                                  const std::string &chip_name,
+                                  const CompileOptions &options) {
+  return std::make_shared<ChipImpl>(code, chip_name, options);
 }
 } // namespace hdlc
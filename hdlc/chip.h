@@ -1,15 +1,182 @@
 #pragma once
 
+#include "compile_stats.h"
+#include "jit/opt_level.h"
+
+#include <map>
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace hdlc {
 
+using jit::OptLevel;
+
+// Stimulus and checker compiled into the same module as the chip, so that
+// Chip::cosimulate runs the whole drive, evaluate and check loop in
+// generated code. Inputs and outputs are packed one byte per bit, in the
+// order of the chip's ports.
+struct Testbench {
+  // Chip of the same package without inputs, whose outputs are the inputs
+  // of the simulated chip in every cycle.
+  std::string stimulus_chip;
+  // Chip of the same package taking the inputs followed by the outputs of
+  // the simulated chip and returning a single wire, 1 if they are correct.
+  std::string checker_chip;
+  // Host callbacks used instead of the chips when set. The checker returns
+  // non-zero when the outputs are correct. A checker without a stimulus is
+  // rejected by create_chip.
+  void (*stimulus)(void *context, uint64_t cycle, int8_t *inputs) = nullptr;
+  int (*checker)(void *context, uint64_t cycle, const int8_t *inputs,
+                 const int8_t *outputs) = nullptr;
+  void *context = nullptr;
+  // Cycles passed to the callbacks count from the start of cosimulate.
+};
+
+struct CompileOptions {
+  OptLevel opt_level = OptLevel::O0;
+  // Number of run calls after which a tiered chip is recompiled at O3.
+  size_t hot_threshold = 1000;
+  // When not empty, the compile phases are written to this file in the
+  // Chrome trace-event format.
+  std::string chrome_trace_path;
+  // Build with a counter of evaluations for every chip instance.
+  bool profile = false;
+  // Also measure cycles spent in every instance, implies profile.
+  bool profile_cycles = false;
+  // When not empty, value changes of the ports of the chip and of the
+  // registers of all instances are written to this file in the VCD format.
+  // The file is complete once the chip is destroyed. Signals are at most
+  // 65536 bits wide, create_chip throws std::invalid_argument otherwise.
+  std::string trace_path;
+  // Align registers in the state buffer so that wide registers are updated
+  // with vector moves.
+  bool align_registers = true;
+  // Keep the current and the next register state in separate buffers and
+  // swap them at the end of a cycle instead of copying every register.
+  bool double_buffer_registers = false;
+  // Flatten the chip into an and-inverter graph, reduce its size and depth
+  // and generate code for the result. Adders, exclusive ors and multiplexers
+  // found in the graph become word operations. Sub-chip instances are not
+  // kept, so profiles and traces only show the top-level chip. Builtins
+  // other than Nand and RAM cannot be flattened.
+  bool optimize_aig = false;
+  // Replace chips with the name and port widths of a builtin, e.g. And or
+  // Add16, by the builtin, which is evaluated on machine words.
+  bool prefer_builtins = false;
+  // Register-free sub-chips with at most this many input bits are
+  // enumerated at compile time and evaluated by one load from a table of
+  // all their results. Tables take 2^n entries, 0 disables them. At most
+  // 16, create_chip throws std::invalid_argument for larger values. Ignored
+  // when profiling.
+  size_t lut_max_inputs = 0;
+  // Inputs tied to constants, by port name, one byte per bit. The chip is
+  // compiled for these values, which are folded through all sub-chips, and
+  // run ignores the bytes passed for these ports.
+  std::map<std::string, std::vector<int8_t>> fixed_inputs;
+  // Slices of at most this many wires are copied wire by wire, which lets
+  // the optimizer keep them in registers. Wider ones, e.g. wide ports and
+  // registers, are copied with a memcpy, so that code size and compile
+  // time do not grow with their width.
+  size_t unroll_max_width = 16;
+  // Keep slices built within a chip, e.g. [a[0], b], in vector registers
+  // instead of stack arrays, so that wide data needs no stores and loads
+  // until it is passed to a sub-chip.
+  bool ssa_slices = false;
+  Testbench testbench;
+};
+
+struct ProfileEntry {
+  // Slash separated path of the instance, e.g. "Top/p1" where p1 is the
+  // first output of the sub-chip call.
+  std::string path;
+  std::string chip;
+  uint64_t evaluations;
+  // Cycles including sub-chips, zero unless profile_cycles was set.
+  uint64_t cycles;
+  uint64_t self_cycles;
+};
+
+struct Mismatch {
+  uint64_t cycle;
+  std::vector<int8_t> inputs;
+  std::vector<int8_t> outputs;
+};
+
+struct CosimResult {
+  uint64_t cycles;
+  std::vector<Mismatch> mismatches;
+};
+
+// Register state of a chip. Taking a snapshot is cheap, the state is shared
+// with the chip until the next run copies it.
+class Snapshot {
+  std::shared_ptr<std::vector<int8_t>> state;
+  // Compiled code of the chip the snapshot was taken from, shared by forks.
+  std::weak_ptr<const void> owner;
+
+  friend struct ChipImpl;
+
+public:
+  Snapshot() = default;
+  size_t size() const { return state ? state->size() : 0; }
+};
+
+// Register state of one instance of a chip, see Chip::make_state.
+class ChipState {
+  std::vector<int8_t> buf;
+  // Module the state belongs to, shared by forks.
+  std::weak_ptr<const void> owner;
+
+  friend struct ChipImpl;
+
+public:
+  ChipState() = default;
+  size_t size() const { return buf.size(); }
+};
+
+// Thread safety: the compiled code of a chip is immutable and shared with
+// its forks. run with a ChipState, make_state, is_optimized and
+// compile_stats may be called from any number of threads at once, as long
+// as every state is used by one thread at a time. The other members work
+// on the chip's own state and must not be called concurrently on the same
+// chip. create_chip may be called concurrently.
 struct Chip {
   virtual void run(int8_t *intputs, int8_t *outputs) = 0;
+  // Evaluates the chip on the given state instead of its own. Throws
+  // std::invalid_argument if the state was made by a chip with different
+  // code, forks share their states.
+  virtual void run(ChipState &state, int8_t *inputs, int8_t *outputs) = 0;
+  // Returns a state with all registers 0. Throws std::logic_error for
+  // traced chips, whose trace follows the chip's own state.
+  virtual ChipState make_state() = 0;
+  // Returns true once the chip runs fully optimized code.
+  virtual bool is_optimized() = 0;
+  virtual const CompileStats &compile_stats() = 0;
+  // Counters of all chip instances in preorder, empty unless the chip was
+  // compiled with profiling enabled.
+  virtual std::vector<ProfileEntry> profile() = 0;
+  // Register state, including the profiling counters.
+  virtual Snapshot snapshot() = 0;
+  // Throws std::invalid_argument if the snapshot was not taken from this
+  // chip or one sharing its compiled code, i.e. a fork. Chips compiled
+  // separately from the same design do not accept each other's snapshots.
+  virtual void restore(const Snapshot &snapshot) = 0;
+  // Returns a chip sharing the compiled code and, until either of them runs,
+  // the register state. Forks may run concurrently, the first run of each
+  // copies the shared state unless the other chips already dropped it.
+  // Traced chips cannot be forked, their trace file belongs to a single
+  // instance.
+  virtual std::shared_ptr<Chip> fork() = 0;
+  // Runs the testbench for the given number of cycles or until
+  // max_mismatches mismatches were found, 0 means no limit. Throws
+  // std::logic_error if the chip was compiled without a testbench.
+  virtual CosimResult cosimulate(uint64_t cycles,
+                                 size_t max_mismatches = 1) = 0;
   virtual ~Chip() = default;
 };
 
 std::shared_ptr<Chip> create_chip(const std::string &code,
-                                  const std::string &chip_name);
+                                  const std::string &chip_name,
+                                  const CompileOptions &options = {});
 } // namespace hdlc
@@ -0,0 +1,21 @@
+#include "compile_stats.h"
+
+namespace hdlc {
+void CompileStats::write_chrome_trace(std::ostream &out) const {
+  out << "{\"traceEvents\": [";
+  for (size_t i = 0; i < phases.size(); ++i) {
+    auto &p = phases[i];
+    out << (i ? ",\n  " : "\n  ");
+    out << "{\"name\": \"" << p.name << "\", \"cat\": \"compile\", "
+        << "\"ph\": \"X\", \"pid\": 1, \"tid\": 1, \"ts\": " << p.start_us
+        << ", \"dur\": " << p.wall_us << ", \"args\": {\"max_rss_kb\": "
+        << p.max_rss_kb << ", \"max_rss_growth_kb\": "
+        << p.max_rss_growth_kb;
+    for (auto &[name, value] : p.counters) {
+      out << ", \"" << name << "\": " << value;
+    }
+    out << "}}";
+  }
+  out << "\n]}\n";
+}
+} // namespace hdlc
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace hdlc {
+
+struct CompilePhase {
+  std::string name;
+  // Offset from the start of the compilation and duration, in microseconds.
+  double start_us;
+  double wall_us;
+  // Maximum resident set size of the process so far, read at the end of
+  // the phase. A phase below an earlier peak reports that peak again.
+  size_t max_rss_kb;
+  // Growth of that maximum during the phase, 0 if the phase stayed below
+  // an earlier peak.
+  size_t max_rss_growth_kb;
+  // Size metrics produced by the phase, e.g. ir_instructions for codegen.
+  std::vector<std::pair<std::string, size_t>> counters;
+};
+
+// Statistics of the synchronous part of create_chip. Background tier-up
+// compilation is not included.
+struct CompileStats {
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+
+  // Phases in execution order: parse, insert_casts, aig (optimize_aig
+  // only), codegen, optimize (O3 only) and materialize.
+  std::vector<CompilePhase> phases;
+
+  // Chips declared in the package, including builtin ones.
+  size_t chips = 0;
+  // Nand gates and register bits of the flattened requested chip, RAM
+  // contents are not counted as registers.
+  size_t gates = 0;
+  size_t registers = 0;
+  // LLVM instructions right after codegen and after optimization.
+  size_t ir_instructions = 0;
+  size_t optimized_ir_instructions = 0;
+  // Size of the machine code of the materialized text sections.
+  size_t code_bytes = 0;
+
+  // Writes the phases in the Chrome trace-event JSON format, viewable in
+  // chrome://tracing or Perfetto.
+  void write_chrome_trace(std::ostream &out) const;
+};
+} // namespace hdlc
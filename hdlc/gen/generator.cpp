@@ -0,0 +1,383 @@
+#include "generator.h"
+
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace hdlc::gen {
+
+namespace {
+const char *const k_gates = R"(chip Not(a) res {
+  res := Nand(a, a)
+  return res
+}
+
+chip And(a, b) res {
+  t := Nand(a, b)
+  res := Nand(t, t)
+  return res
+}
+
+chip Or(a, b) res {
+  na := Nand(a, a)
+  nb := Nand(b, b)
+  res := Nand(na, nb)
+  return res
+}
+
+chip Xor(a, b) res {
+  t := Nand(a, b)
+  x := Nand(a, t)
+  y := Nand(b, t)
+  res := Nand(x, y)
+  return res
+}
+
+chip Mux(a, b, sel) res {
+  ns := Nand(sel, sel)
+  x := Nand(a, ns)
+  y := Nand(b, sel)
+  res := Nand(x, y)
+  return res
+}
+
+chip FullAdder(a, b, c) sum, carry {
+  s := Xor(a, b)
+  sum := Xor(s, c)
+  c1 := And(a, b)
+  c2 := And(s, c)
+  carry := Or(c1, c2)
+  return sum, carry
+}
+
+)";
+
+std::string idx(const std::string &slice, size_t i) {
+  return slice + "[" + std::to_string(i) + "]";
+}
+
+std::string join(const std::vector<std::string> &values) {
+  std::string res = "[";
+  for (size_t i = 0; i < values.size(); ++i) {
+    res += (i ? ", " : "") + values[i];
+  }
+  return res + "]";
+}
+
+void expect_positive(size_t value, const char *what) {
+  if (value == 0) {
+    throw std::invalid_argument(std::string(what) + " must be positive");
+  }
+}
+
+size_t log2_ceil(size_t value) {
+  size_t res = 0;
+  while ((size_t(1) << res) < value) {
+    res++;
+  }
+  return res;
+}
+
+// Chains operands with gate into a single signal named result.
+void reduce(std::stringstream &ss, const std::string &gate,
+            const std::vector<std::string> &operands,
+            const std::string &result) {
+  if (operands.size() == 1) {
+    ss << "  " << result << " := And(" << operands[0] << ", " << operands[0]
+       << ")\n";
+    return;
+  }
+  std::string acc = operands[0];
+  for (size_t i = 1; i < operands.size(); ++i) {
+    auto name = i + 1 == operands.size()
+                    ? result
+                    : result + "_" + std::to_string(i);
+    ss << "  " << name << " := " << gate << "(" << acc << ", " << operands[i]
+       << ")\n";
+    acc = name;
+  }
+}
+
+// chip CLA<n>(a[n], b[n], cin) sum[n], cout
+void carry_lookahead_block(std::stringstream &ss, size_t n) {
+  ss << "chip CLA" << n << "(a[" << n << "], b[" << n << "], cin) sum[" << n
+     << "], cout {\n";
+  for (size_t i = 0; i < n; ++i) {
+    ss << "  p" << i << " := Xor(" << idx("a", i) << ", " << idx("b", i)
+       << ")\n";
+    ss << "  g" << i << " := And(" << idx("a", i) << ", " << idx("b", i)
+       << ")\n";
+  }
+
+  // c[i + 1] = g[i] | p[i] g[i - 1] | ... | p[i] ... p[0] cin
+  std::vector<std::string> carries{"cin"};
+  for (size_t i = 0; i < n; ++i) {
+    std::vector<std::string> terms;
+    for (size_t j = 0; j <= i + 1; ++j) {
+      std::vector<std::string> factors;
+      for (size_t k = j; k <= i; ++k) {
+        factors.push_back("p" + std::to_string(k));
+      }
+      factors.push_back(j == 0 ? "cin" : "g" + std::to_string(j - 1));
+      auto term = "t" + std::to_string(i) + "_" + std::to_string(j);
+      reduce(ss, "And", factors, term);
+      terms.push_back(term);
+    }
+    auto carry = "c" + std::to_string(i + 1);
+    reduce(ss, "Or", terms, carry);
+    carries.push_back(carry);
+  }
+
+  std::vector<std::string> sum;
+  for (size_t i = 0; i < n; ++i) {
+    ss << "  s" << i << " := Xor(p" << i << ", " << carries[i] << ")\n";
+    sum.push_back("s" + std::to_string(i));
+  }
+  ss << "  return " << join(sum) << ", " << carries[n] << "\n}\n\n";
+}
+} // namespace
+
+Design ripple_carry_adder(size_t width) {
+  expect_positive(width, "adder width");
+
+  std::stringstream ss;
+  ss << k_gates;
+  auto top = "RippleAdder" + std::to_string(width);
+  ss << "chip " << top << "(a[" << width << "], b[" << width << "], cin) sum["
+     << width << "], cout {\n";
+
+  std::vector<std::string> sum;
+  std::string carry = "cin";
+  for (size_t i = 0; i < width; ++i) {
+    auto s = "s" + std::to_string(i);
+    auto c = "c" + std::to_string(i);
+    ss << "  " << s << ", " << c << " := FullAdder(" << idx("a", i) << ", "
+       << idx("b", i) << ", " << carry << ")\n";
+    sum.push_back(s);
+    carry = c;
+  }
+  ss << "  return " << join(sum) << ", " << carry << "\n}\n";
+
+  return {ss.str(), top, 2 * width + 1, width + 1};
+}
+
+Design carry_lookahead_adder(size_t width) {
+  expect_positive(width, "adder width");
+  const size_t block = 4;
+
+  std::stringstream ss;
+  ss << k_gates;
+  carry_lookahead_block(ss, std::min(width, block));
+  if (width > block && width % block) {
+    carry_lookahead_block(ss, width % block);
+  }
+
+  auto top = "CLAAdder" + std::to_string(width);
+  ss << "chip " << top << "(a[" << width << "], b[" << width << "], cin) sum["
+     << width << "], cout {\n";
+
+  std::vector<std::string> sum;
+  std::string carry = "cin";
+  for (size_t begin = 0, k = 0; begin < width; begin += block, ++k) {
+    auto end = std::min(begin + block, width);
+    auto range = "[" + std::to_string(begin) + ":" + std::to_string(end) + "]";
+    auto s = "s" + std::to_string(k);
+    auto c = "c" + std::to_string(k);
+    ss << "  " << s << ", " << c << " := CLA" << end - begin << "(a" << range
+       << ", b" << range << ", " << carry << ")\n";
+    for (size_t i = 0; i < end - begin; ++i) {
+      sum.push_back(idx(s, i));
+    }
+    carry = c;
+  }
+  ss << "  return " << join(sum) << ", " << carry << "\n}\n";
+
+  return {ss.str(), top, 2 * width + 1, width + 1};
+}
+
+Design array_multiplier(size_t width) {
+  expect_positive(width, "multiplier width");
+
+  std::stringstream ss;
+  ss << k_gates;
+  auto top = "ArrayMul" + std::to_string(width);
+  ss << "chip " << top << "(a[" << width << "], b[" << width << "]) res["
+     << 2 * width << "] {\n";
+  ss << "  na := Not(a[0])\n";
+  ss << "  zero := And(a[0], na)\n";
+
+  // acc holds the running sum of the partial products of rows 0..i.
+  std::vector<std::string> acc;
+  for (size_t j = 0; j < width; ++j) {
+    auto p = "p0_" + std::to_string(j);
+    ss << "  " << p << " := And(" << idx("a", j) << ", b[0])\n";
+    acc.push_back(p);
+  }
+  acc.push_back("zero");
+
+  for (size_t i = 1; i < width; ++i) {
+    std::string carry = "zero";
+    for (size_t j = 0; j < width; ++j) {
+      auto suffix = std::to_string(i) + "_" + std::to_string(j);
+      ss << "  p" << suffix << " := And(" << idx("a", j) << ", "
+         << idx("b", i) << ")\n";
+      ss << "  s" << suffix << ", c" << suffix << " := FullAdder("
+         << acc[i + j] << ", p" << suffix << ", " << carry << ")\n";
+      acc[i + j] = "s" + suffix;
+      carry = "c" + suffix;
+    }
+    acc.push_back(carry);
+  }
+  acc.resize(2 * width);
+
+  ss << "  return " << join(acc) << "\n}\n";
+
+  return {ss.str(), top, 2 * width, 2 * width};
+}
+
+Design register_file(size_t entries, size_t width) {
+  expect_positive(entries, "register file entries");
+  expect_positive(width, "register file width");
+  auto addr_bits = std::max<size_t>(log2_ceil(entries), 1);
+
+  std::stringstream ss;
+  ss << k_gates;
+
+  auto reg = "Reg" + std::to_string(width);
+  ss << "chip " << reg << "(in[" << width << "], load) out[" << width
+     << "] {\n";
+  ss << "  r := Register(" << width << ")\n";
+  ss << "  cur := <- r\n";
+  std::vector<std::string> next;
+  for (size_t b = 0; b < width; ++b) {
+    next.push_back("Mux(" + idx("cur", b) + ", " + idx("in", b) + ", load)");
+  }
+  ss << "  r <- " << join(next) << "\n";
+  ss << "  return cur\n}\n\n";
+
+  auto top = "RegFile" + std::to_string(entries) + "x" + std::to_string(width);
+  ss << "chip " << top << "(in[" << width << "], load, addr[" << addr_bits
+     << "]) out[" << width << "] {\n";
+  for (size_t k = 0; k < addr_bits; ++k) {
+    ss << "  na" << k << " := Not(" << idx("addr", k) << ")\n";
+  }
+  for (size_t e = 0; e < entries; ++e) {
+    std::vector<std::string> literals;
+    for (size_t k = 0; k < addr_bits; ++k) {
+      literals.push_back(((e >> k) & 1) ? idx("addr", k)
+                                        : "na" + std::to_string(k));
+    }
+    auto sel = "sel" + std::to_string(e);
+    reduce(ss, "And", literals, sel);
+    ss << "  we" << e << " := And(" << sel << ", load)\n";
+    ss << "  q" << e << " := " << reg << "(in, we" << e << ")\n";
+  }
+
+  std::vector<std::string> out;
+  for (size_t b = 0; b < width; ++b) {
+    std::vector<std::string> terms;
+    for (size_t e = 0; e < entries; ++e) {
+      auto term = "t" + std::to_string(b) + "_" + std::to_string(e);
+      ss << "  " << term << " := And(sel" << e << ", "
+         << idx("q" + std::to_string(e), b) << ")\n";
+      terms.push_back(term);
+    }
+    auto o = "o" + std::to_string(b);
+    reduce(ss, "Or", terms, o);
+    out.push_back(o);
+  }
+  ss << "  return " << join(out) << "\n}\n";
+
+  return {ss.str(), top, width + 1 + addr_bits, width};
+}
+
+Design shift_register(size_t length) {
+  expect_positive(length, "shift register length");
+
+  std::stringstream ss;
+  ss << k_gates;
+  auto top = "ShiftReg" + std::to_string(length);
+  ss << "chip " << top << "(in) out[" << length << "] {\n";
+  ss << "  r := Register(" << length << ")\n";
+  ss << "  cur := <- r\n";
+  std::vector<std::string> next{"in"};
+  for (size_t i = 0; i + 1 < length; ++i) {
+    next.push_back(idx("cur", i));
+  }
+  ss << "  r <- " << join(next) << "\n";
+  ss << "  return cur\n}\n";
+
+  return {ss.str(), top, 1, length};
+}
+
+Design and_chain(size_t length) {
+  if (length < 2) {
+    throw std::invalid_argument("and chain length must be at least 2");
+  }
+
+  std::stringstream ss;
+  ss << k_gates;
+  auto top = "AndChain" + std::to_string(length);
+  ss << "chip " << top << "(a[" << length << "]) res {\n";
+  ss << "  t1 := And(a[0], a[1])\n";
+  for (size_t i = 2; i < length; ++i) {
+    ss << "  t" << i << " := And(t" << i - 1 << ", " << idx("a", i) << ")\n";
+  }
+  ss << "  return t" << length - 1 << "\n}\n";
+
+  return {ss.str(), top, length, 1};
+}
+
+Design nand_dag(const NandDagOptions &options) {
+  expect_positive(options.inputs, "dag inputs");
+  expect_positive(options.depth, "dag depth");
+  expect_positive(options.width, "dag width");
+  expect_positive(options.max_fanout, "dag fanout");
+
+  // std::mt19937_64 produces the same sequence on every platform, unlike
+  // the standard distributions, so only its raw output is used.
+  std::mt19937_64 rng(options.seed);
+
+  // Signals of all levels created so far, level 0 are the inputs.
+  std::vector<std::vector<std::string>> levels(1);
+  std::vector<std::vector<size_t>> fanout(1);
+  for (size_t i = 0; i < options.inputs; ++i) {
+    levels[0].push_back(idx("in", i));
+    fanout[0].push_back(0);
+  }
+
+  const size_t attempts = 8;
+  auto pick = [&](size_t first_level, size_t last_level) {
+    std::pair<size_t, size_t> res;
+    for (size_t attempt = 0; attempt < attempts; ++attempt) {
+      auto level = first_level + rng() % (last_level - first_level + 1);
+      res = {level, rng() % levels[level].size()};
+      if (fanout[res.first][res.second] < options.max_fanout) {
+        break;
+      }
+    }
+    fanout[res.first][res.second]++;
+    return levels[res.first][res.second];
+  };
+
+  std::stringstream ss;
+  ss << "chip NandDag(in[" << options.inputs << "]) out[" << options.width
+     << "] {\n";
+  for (size_t l = 1; l <= options.depth; ++l) {
+    std::vector<std::string> level;
+    for (size_t k = 0; k < options.width; ++k) {
+      auto a = pick(l - 1, l - 1);
+      auto b = pick(0, l - 1);
+      auto name = "g" + std::to_string(l) + "_" + std::to_string(k);
+      ss << "  " << name << " := Nand(" << a << ", " << b << ")\n";
+      level.push_back(name);
+    }
+    levels.push_back(level);
+    fanout.emplace_back(options.width, 0);
+  }
+  ss << "  return " << join(levels.back()) << "\n}\n";
+
+  return {ss.str(), "NandDag", options.inputs, options.width};
+}
+} // namespace hdlc::gen
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Generators of synthetic hdlc packages used for stress tests and scaling
+// benchmarks. Every generated package is self-contained: it declares the
+// gate library it uses followed by the design itself.
+namespace hdlc::gen {
+
+struct Design {
+  std::string code;
+  // Name of the top-level chip in code.
+  std::string top;
+  // Total number of input and output bits of the top-level chip.
+  size_t inputs;
+  size_t outputs;
+};
+
+// top(a[width], b[width], cin) sum[width], cout
+Design ripple_carry_adder(size_t width);
+
+// Same ports as ripple_carry_adder, built from 4-bit lookahead blocks.
+Design carry_lookahead_adder(size_t width);
+
+// top(a[width], b[width]) res[2 * width]
+Design array_multiplier(size_t width);
+
+// top(in[width], load, addr[log2(entries)]) out[width]. Every entry is a
+// Register(width), out is the entry selected by addr before the write.
+Design register_file(size_t entries, size_t width);
+
+// top(in) out[length], out[0] is the input delayed by one cycle.
+Design shift_register(size_t length);
+
+// top(a[length]) res, a chain of length - 1 And gates.
+Design and_chain(size_t length);
+
+struct NandDagOptions {
+  size_t inputs = 16;
+  // Number of gate levels, every gate takes one operand from the previous
+  // level so the longest path is exactly depth gates.
+  size_t depth = 16;
+  // Gates per level, the last level is the output of the chip.
+  size_t width = 16;
+  // Soft limit of readers per signal, exceeded only when no other
+  // candidate is available.
+  size_t max_fanout = 4;
+  uint64_t seed = 0;
+};
+
+// top(in[inputs]) out[width]
+Design nand_dag(const NandDagOptions &options);
+} // namespace hdlc::gen
@@ -0,0 +1,136 @@
+#include "generator.h"
+
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+namespace {
+const char *const k_usage =
+    R"(usage: hdlc_gen <family> [options]
+
+families:
+  ripple-adder   --width N
+  cla-adder      --width N
+  multiplier     --width N
+  register-file  --entries N --width N
+  shift-register --length N
+  and-chain      --length N
+  nand-dag       --inputs N --depth N --width N --fanout N --seed N
+
+options:
+  -o <file>      write the package to file instead of stdout
+  --top          print the name of the top-level chip to stderr
+)";
+
+struct Args {
+  std::string family;
+  std::string output;
+  bool print_top = false;
+  size_t width = 8;
+  size_t entries = 8;
+  size_t length = 8;
+  hdlc::gen::NandDagOptions dag;
+};
+
+Args parse_args(int argc, char **argv) {
+  if (argc < 2) {
+    throw std::invalid_argument("missing family");
+  }
+
+  Args args;
+  args.family = argv[1];
+  bool dag_width = false;
+
+  for (int i = 2; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--top") {
+      args.print_top = true;
+      continue;
+    }
+    if (i + 1 == argc) {
+      throw std::invalid_argument("missing value for " + arg);
+    }
+    std::string value = argv[++i];
+    if (arg == "-o") {
+      args.output = value;
+      continue;
+    }
+
+    auto number = std::stoull(value);
+    if (arg == "--width") {
+      args.width = number;
+      dag_width = true;
+    } else if (arg == "--entries") {
+      args.entries = number;
+    } else if (arg == "--length") {
+      args.length = number;
+    } else if (arg == "--inputs") {
+      args.dag.inputs = number;
+    } else if (arg == "--depth") {
+      args.dag.depth = number;
+    } else if (arg == "--fanout") {
+      args.dag.max_fanout = number;
+    } else if (arg == "--seed") {
+      args.dag.seed = number;
+    } else {
+      throw std::invalid_argument("unknown option " + arg);
+    }
+  }
+
+  if (dag_width) {
+    args.dag.width = args.width;
+  }
+  return args;
+}
+
+hdlc::gen::Design generate(const Args &args) {
+  if (args.family == "ripple-adder") {
+    return hdlc::gen::ripple_carry_adder(args.width);
+  }
+  if (args.family == "cla-adder") {
+    return hdlc::gen::carry_lookahead_adder(args.width);
+  }
+  if (args.family == "multiplier") {
+    return hdlc::gen::array_multiplier(args.width);
+  }
+  if (args.family == "register-file") {
+    return hdlc::gen::register_file(args.entries, args.width);
+  }
+  if (args.family == "shift-register") {
+    return hdlc::gen::shift_register(args.length);
+  }
+  if (args.family == "and-chain") {
+    return hdlc::gen::and_chain(args.length);
+  }
+  if (args.family == "nand-dag") {
+    return hdlc::gen::nand_dag(args.dag);
+  }
+  throw std::invalid_argument("unknown family " + args.family);
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  try {
+    auto args = parse_args(argc, argv);
+    auto design = generate(args);
+
+    if (args.output.empty()) {
+      std::cout << design.code;
+    } else {
+      std::ofstream out(args.output);
+      if (!out) {
+        throw std::runtime_error("cannot open " + args.output);
+      }
+      out << design.code;
+    }
+
+    if (args.print_top) {
+      std::cerr << design.top << std::endl;
+    }
+  } catch (std::exception &e) {
+    std::cerr << "hdlc_gen: " << e.what() << "\n\n" << k_usage;
+    return 1;
+  }
+  return 0;
+}
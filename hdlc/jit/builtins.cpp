@@ -0,0 +1,75 @@
+#include "builtins.h"
+
+#include <map>
+#include <stdexcept>
+
+namespace hdlc::jit {
+
+namespace {
+std::map<std::string, Lowering> &lowerings() {
+  using Values = llvm::ArrayRef<llvm::Value *>;
+  using B = llvm::IRBuilder<>;
+  static std::map<std::string, Lowering> res{
+      {"Nand",
+       [](B &b, Values in) -> std::vector<llvm::Value *> {
+         return {b.CreateNot(b.CreateAnd(in[0], in[1]))};
+       }},
+      {"Not",
+       [](B &b, Values in) -> std::vector<llvm::Value *> {
+         return {b.CreateNot(in[0])};
+       }},
+      {"And",
+       [](B &b, Values in) -> std::vector<llvm::Value *> {
+         return {b.CreateAnd(in[0], in[1])};
+       }},
+      {"Or",
+       [](B &b, Values in) -> std::vector<llvm::Value *> {
+         return {b.CreateOr(in[0], in[1])};
+       }},
+      {"Xor",
+       [](B &b, Values in) -> std::vector<llvm::Value *> {
+         return {b.CreateXor(in[0], in[1])};
+       }},
+      {"Mux",
+       [](B &b, Values in) -> std::vector<llvm::Value *> {
+         return {b.CreateOr(b.CreateAnd(in[0], b.CreateNot(in[2])),
+                            b.CreateAnd(in[1], in[2]))};
+       }},
+      {"Add16",
+       [](B &b, Values in) -> std::vector<llvm::Value *> {
+         return {b.CreateAdd(in[0], in[1])};
+       }},
+      {"Inc16",
+       [](B &b, Values in) -> std::vector<llvm::Value *> {
+         return {b.CreateAdd(in[0], llvm::ConstantInt::get(in[0]->getType(),
+                                                           1))};
+       }},
+      {"ALU",
+       [](B &b, Values in) -> std::vector<llvm::Value *> {
+         auto zero = llvm::ConstantInt::get(in[0]->getType(), 0);
+         auto x = b.CreateSelect(in[2], zero, in[0]);
+         x = b.CreateSelect(in[3], b.CreateNot(x), x);
+         auto y = b.CreateSelect(in[4], zero, in[1]);
+         y = b.CreateSelect(in[5], b.CreateNot(y), y);
+         auto out = b.CreateSelect(in[6], b.CreateAdd(x, y), b.CreateAnd(x, y));
+         out = b.CreateSelect(in[7], b.CreateNot(out), out);
+         return {out, b.CreateICmpEQ(out, zero), b.CreateICmpSLT(out, zero)};
+       }},
+  };
+  return res;
+}
+} // namespace
+
+void register_builtin(ast::Builtin builtin, Lowering lowering) {
+  lowerings()[builtin.name] = std::move(lowering);
+  ast::register_builtin(std::move(builtin));
+}
+
+const Lowering &find_lowering(const std::string &name) {
+  auto it = lowerings().find(name);
+  if (it == lowerings().end()) {
+    throw std::invalid_argument("builtin chip " + name + " has no lowering");
+  }
+  return it->second;
+}
+} // namespace hdlc::jit
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "hdlc/ast/builtins.h"
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/IR/IRBuilder.h>
+
+#include <functional>
+#include <vector>
+
+namespace hdlc::jit {
+
+// Computes the outputs of a builtin from its inputs. Every port is an
+// integer of the port's width, wire 0 in bit 0. Lowerings of bitwise
+// builtins are also called with a single wire of every port, or a word of
+// lanes in lane mode, and may only use bitwise operations. Lowerings may
+// not access memory, chip functions are declared to only access their
+// arguments.
+using Lowering = std::function<std::vector<llvm::Value *>(
+    llvm::IRBuilder<> &b, llvm::ArrayRef<llvm::Value *> inputs)>;
+
+// Adds the builtin to the registry of ast::find_builtin together with its
+// lowering. Not safe while chips are compiled.
+void register_builtin(ast::Builtin builtin, Lowering lowering);
+
+// Throws std::invalid_argument if the builtin has no lowering.
+const Lowering &find_lowering(const std::string &name);
+} // namespace hdlc::jit
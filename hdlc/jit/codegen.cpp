@@ -1,39 +1,100 @@
 #include "codegen.h"
+#include "builtins.h"
 
 #include "hdlc/ast/ast.h"
+#include "hdlc/ast/transforms.h"
 #include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/Constants.h>
 #include <llvm/IR/Function.h>
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Intrinsics.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Type.h>
 
+#include <algorithm>
+#include <cstddef>
+#include <limits>
 #include <memory>
 #include <stack>
+#include <stdexcept>
 #include <unordered_map>
 namespace hdlc::jit {
 
+// Assigns reg_buf offsets to registers and sub-chip regions. With align
+// set, both are aligned to the largest power of two not exceeding their
+// size, up to 16 bytes, so wide registers are copied with vector moves.
+struct RegisterLayout {
+  bool align;
+
+  static constexpr size_t max_alignment = 16;
+
+  static size_t alignment(size_t size) {
+    size_t res = 1;
+    while (res * 2 <= size && res < max_alignment) {
+      res *= 2;
+    }
+    return res;
+  }
+
+  size_t place(size_t &offset, size_t size, size_t alignment) const {
+    if (align && alignment > 1) {
+      offset = (offset + alignment - 1) / alignment * alignment;
+    }
+    auto res = offset;
+    offset += size;
+    return res;
+  }
+
+  // A RAM whose address has more values than it has words is followed by
+  // a word of zeros, which the addresses past its last word read.
+  static size_t ram_size(const ast::RamExpr &e) {
+    auto words = e.words;
+    if (e.address_width() >= 64 || words < (size_t(1) << e.address_width())) {
+      words++;
+    }
+    return words * e.width;
+  }
+};
+
+// Sizes and alignments of the reg_buf regions of chips by their symbols.
 struct RegMemCounter : ast::Visitor {
-  std::unordered_map<std::string, size_t> mem_per_chip;
+  std::vector<size_t> mem_per_chip;
+  std::vector<size_t> align_per_chip;
   size_t current_size = 0;
+  size_t current_align = 1;
+  size_t header_size;
+  RegisterLayout layout;
+
+  RegMemCounter(size_t header_size, RegisterLayout layout)
+      : header_size(header_size), layout(layout) {}
 
   void visit(ast::Package &pkg) override {
+    mem_per_chip.assign(pkg.symbols.size(), 0);
+    align_per_chip.assign(pkg.symbols.size(), 0);
     for (auto &c : pkg.chips) {
       c->visit(*this);
     }
   }
 
   void visit(ast::Chip &chip) override {
-    current_size = 0;
+    current_size = chip.builtin ? 0 : header_size;
+    current_align = 1;
     for (auto &s : chip.body) {
       s->visit(*this);
     }
-    mem_per_chip[chip.ident] = current_size;
+    mem_per_chip[chip.id] = current_size;
+    align_per_chip[chip.id] = current_align;
   }
 
   void visit(ast::AssignStmt &stmt) override { stmt.rhs->visit(*this); }
 
   void visit(ast::CallExpr &expr) override {
-    current_size += mem_per_chip[expr.chip_name];
+    auto align = std::max<size_t>(align_per_chip[expr.chip_id], 1);
+    layout.place(current_size, mem_per_chip[expr.chip_id], align);
+    current_align = std::max(current_align, align);
+    for (auto &a : expr.args) {
+      a->visit(*this);
+    }
   }
 
   void visit(ast::Value &) override {}
@@ -44,7 +105,12 @@ struct RegMemCounter : ast::Visitor {
     }
   }
 
-  void visit(ast::RegWrite &rw) override { rw.rhs->visit(*this); }
+  void visit(ast::RegWrite &rw) override {
+    rw.rhs->visit(*this);
+    if (rw.enable) {
+      rw.enable->visit(*this);
+    }
+  }
 
   void visit(ast::RegRead &) override {}
 
@@ -61,10 +127,155 @@ struct RegMemCounter : ast::Visitor {
   void visit(ast::TupleToWireCast &e) override { e.expr->visit(*this); }
 
   void visit(ast::CreateRegisterExpr &e) override {
-    if (auto t = std::dynamic_pointer_cast<ast::SliceType>(e.result_type())) {
-      current_size += t->size;
-    } else {
-      current_size++;
+    size_t width = 1;
+    if (auto t = ast::dyn_cast<ast::SliceType>(e.res_type)) {
+      width = t->size;
+    }
+    auto align = RegisterLayout::alignment(width);
+    layout.place(current_size, width, align);
+    current_align = std::max(current_align, align);
+  }
+
+  void visit(ast::RamExpr &e) override {
+    auto size = RegisterLayout::ram_size(e);
+    auto align = RegisterLayout::alignment(size);
+    layout.place(current_size, size, align);
+    current_align = std::max(current_align, align);
+    e.address->visit(*this);
+    e.data->visit(*this);
+    e.write->visit(*this);
+  }
+};
+
+// Finds the bits of every call result of a chip that its live output bits
+// or its register writes depend on. Every name is assigned once, before it
+// is used, so statements are visited in reverse. Arguments of a call are
+// live if any of its outputs is, or if the callee has a reg_buf region.
+struct LiveBitsVisitor : ast::Visitor {
+  using Bits = std::vector<bool>;
+  // Live bits of the values of the chip by their ids.
+  std::vector<Bits> live_names;
+  std::unordered_map<ast::CallExpr *, Bits> live_calls;
+  const std::vector<size_t> &mem_per_chip;
+  Bits live_outputs;
+  // Live bits of the visited expression.
+  Bits current;
+
+  LiveBitsVisitor(const std::vector<size_t> &mem_per_chip, Bits live_outputs)
+      : mem_per_chip(mem_per_chip), live_outputs(std::move(live_outputs)) {}
+
+  static size_t width(const std::shared_ptr<ast::Type> &type) {
+    if (auto st = ast::dyn_cast<ast::SliceType>(type)) {
+      return st->size;
+    }
+    if (auto tt = ast::dyn_cast<ast::TupleType>(type)) {
+      size_t res = 0;
+      for (auto &t : tt->element_types) {
+        res += width(t);
+      }
+      return res;
+    }
+    return 1;
+  }
+
+  static void merge(Bits &into, const Bits &bits) {
+    into.resize(std::max(into.size(), bits.size()));
+    for (size_t i = 0; i < bits.size(); ++i) {
+      into[i] = into[i] || bits[i];
+    }
+  }
+
+  void visit_expr(ast::Expr &expr, Bits bits) {
+    current = std::move(bits);
+    expr.visit(*this);
+  }
+
+  void visit(ast::Package &) override {}
+
+  void visit(ast::Chip &chip) override {
+    live_names.assign(chip.value_count, {});
+    for (auto s = chip.body.rbegin(); s != chip.body.rend(); ++s) {
+      (*s)->visit(*this);
+    }
+  }
+
+  void visit(ast::AssignStmt &stmt) override {
+    auto type = stmt.rhs->result_type();
+    Bits bits;
+    auto tuple = ast::dyn_cast<ast::TupleType>(type);
+    for (size_t i = 0; i < stmt.assignees.size(); ++i) {
+      auto field = live_names[stmt.assignees[i]->id];
+      field.resize(width(tuple ? tuple->element_types[i] : type));
+      bits.insert(bits.end(), field.begin(), field.end());
+    }
+    bits.resize(width(type));
+    visit_expr(*stmt.rhs, std::move(bits));
+  }
+
+  void visit(ast::CallExpr &expr) override {
+    auto &bits = live_calls[&expr];
+    merge(bits, current);
+    bits.resize(width(expr.result_type()));
+    bool live = std::find(bits.begin(), bits.end(), true) != bits.end() ||
+                mem_per_chip[expr.chip_id] != 0;
+    for (auto &a : expr.args) {
+      visit_expr(*a, Bits(width(a->result_type()), live));
+    }
+  }
+
+  void visit(ast::Value &val) override {
+    merge(live_names[val.id], current);
+  }
+
+  void visit(ast::RetStmt &stmt) override {
+    size_t offset = 0;
+    for (auto &e : stmt.results) {
+      auto w = width(e->result_type());
+      visit_expr(*e, Bits(live_outputs.begin() + offset,
+                          live_outputs.begin() + offset + w));
+      offset += w;
+    }
+  }
+
+  void visit(ast::RegWrite &rw) override {
+    visit_expr(*rw.rhs, Bits(width(rw.rhs->result_type()), true));
+    if (rw.enable) {
+      visit_expr(*rw.enable, {true});
+    }
+  }
+
+  void visit(ast::RegRead &) override {}
+
+  void visit(ast::SliceIdxExpr &e) override {
+    Bits bits(width(e.slice->result_type()));
+    std::copy(current.begin(), current.end(), bits.begin() + e.begin);
+    visit_expr(*e.slice, std::move(bits));
+  }
+
+  void visit(ast::SliceJoinExpr &e) override {
+    auto bits = current;
+    for (size_t i = 0; i < e.values.size(); ++i) {
+      visit_expr(*e.values[i], {bits[i]});
+    }
+  }
+
+  void visit(ast::SliceToWireCast &e) override {
+    Bits bits(width(e.expr->result_type()));
+    bits[0] = current[0];
+    visit_expr(*e.expr, std::move(bits));
+  }
+
+  void visit(ast::TupleToWireCast &e) override {
+    Bits bits(width(e.expr->result_type()));
+    bits[0] = current[0];
+    visit_expr(*e.expr, std::move(bits));
+  }
+
+  void visit(ast::CreateRegisterExpr &) override {}
+
+  void visit(ast::RamExpr &e) override {
+    for (auto port : {e.address, e.data, e.write}) {
+      visit_expr(*port, Bits(width(port->result_type()), true));
     }
   }
 };
@@ -73,15 +284,15 @@ struct TypeTransformVisitor : ast::TypeVisitor {
 private:
   std::stack<llvm::Type *> results_stack;
   llvm::LLVMContext *ctx;
+  llvm::Type *wire;
   bool array_as_ptr;
 
 public:
-  explicit TypeTransformVisitor(llvm::LLVMContext *ctx, bool array_as_ptr)
-      : ctx(ctx), array_as_ptr(array_as_ptr) {}
+  TypeTransformVisitor(llvm::LLVMContext *ctx, llvm::Type *wire,
+                       bool array_as_ptr)
+      : ctx(ctx), wire(wire), array_as_ptr(array_as_ptr) {}
 
-  void visit(ast::WireType &) override {
-    results_stack.push(llvm::Type::getInt8Ty(*ctx));
-  }
+  void visit(ast::WireType &) override { results_stack.push(wire); }
 
   void visit(ast::RegisterType &) override {
     results_stack.push(llvm::Type::getInt8Ty(*ctx));
@@ -122,40 +333,425 @@ struct CodegenVisitor : ast::Visitor {
   llvm::IRBuilder<> ir_builder;
   std::stack<llvm::Value *> results_stack;
   llvm::Function *current_function;
+  ast::Chip *current_chip;
 
   std::string entrypoint;
 
-  std::unordered_map<std::string, llvm::Value *> symbol_table;
-  std::unordered_map<std::string, ast::Chip *> chips;
-  std::unordered_map<std::string, size_t> mem_per_chip;
+  // Values of the current chip by their ids.
+  std::vector<llvm::Value *> symbol_table;
+  // Tables of chips by their symbols.
+  const ast::Symbols *symbols = nullptr;
+  std::vector<ast::Chip *> chips;
+  std::vector<llvm::Function *> functions;
+  std::vector<size_t> mem_per_chip;
+  std::vector<size_t> align_per_chip;
 
   std::unique_ptr<llvm::Module> module;
 
   llvm::BasicBlock *update_reg_block;
+  // Block the next register update goes to, update_reg_block or the block
+  // after a conditional update.
+  llvm::BasicBlock *update_reg_end;
+  // Blocks of update_regs with the updates of each enable wire.
+  std::unordered_map<llvm::Value *, llvm::BasicBlock *> update_groups;
 
   size_t reg_buf_offset = 0;
+  // Size of a register bank holding the requested chip and the testbench.
+  size_t regs_size = 0;
+  size_t stimulus_region = 0;
+  size_t checker_region = 0;
+
+  CodegenOptions options;
+  RegisterLayout layout;
+
+  // Offset and width of the registers of the current chip by their pointer
+  // into reg_buf.
+  std::unordered_map<llvm::Value *, std::pair<size_t, size_t>>
+      register_slots;
+
+  // Sub-chip calls and registers of every chip with their reg_buf offsets,
+  // used to find the profiling counters and registers of all instances.
+  struct SubChip {
+    std::string label;
+    uint32_t chip;
+    size_t offset;
+  };
+  std::vector<std::vector<SubChip>> sub_chips;
+  struct Reg {
+    std::string label;
+    size_t width;
+    size_t offset;
+  };
+  std::vector<std::vector<Reg>> registers;
+  std::string call_label;
+  size_t call_count = 0;
+
+  llvm::Value *profile_start = nullptr;
+
+  std::vector<TraceSignal> trace_signals;
+
+  // Chips evaluated by table lookups and the functions computing a row.
+  struct LookupTable {
+    ast::Chip *chip;
+    llvm::Function *eval;
+    llvm::GlobalVariable *table;
+    llvm::Type *row;
+  };
+  std::vector<LookupTable> lookup_tables;
+
+  // Bits known at compile time, nullptr where unknown, of slices by their
+  // pointer.
+  using KnownBits = std::vector<llvm::Constant *>;
+  std::unordered_map<llvm::Value *, KnownBits> known_slices;
+  // Known bits of every output of a chip function, or of the result struct
+  // of a call.
+  std::unordered_map<llvm::Value *, std::vector<KnownBits>> known_outputs;
+  // Clones of chip functions by the chip, the known bits of its inputs and
+  // the output bits used by the caller.
+  std::unordered_map<std::string, llvm::Function *> specializations;
+  // Output bits of the calls of the current chip function which are used.
+  std::unordered_map<ast::CallExpr *, LiveBitsVisitor::Bits> live_calls;
+  // Set while emitting a clone, whose sub-chips and registers are already
+  // recorded for the original.
+  bool specializing = false;
+
+  size_t profile_header_size() const {
+    if (!options.profile) {
+      return 0;
+    }
+    return options.profile_cycles ? 2 * sizeof(uint64_t) : sizeof(uint64_t);
+  }
+
+  llvm::Value *profile_slot(size_t idx) {
+    auto slot = ir_builder.CreateConstGEP1_32(ir_builder.getInt8Ty(),
+                                              current_function->getArg(1),
+                                              idx * sizeof(uint64_t));
+    return ir_builder.CreateBitCast(slot,
+                                    ir_builder.getInt64Ty()->getPointerTo());
+  }
+
+  void add_to_profile_slot(size_t idx, llvm::Value *val) {
+    auto slot = profile_slot(idx);
+    auto old = ir_builder.CreateAlignedLoad(ir_builder.getInt64Ty(), slot,
+                                            llvm::MaybeAlign(1));
+    ir_builder.CreateAlignedStore(ir_builder.CreateAdd(old, val), slot,
+                                  llvm::MaybeAlign(1));
+  }
+
+  llvm::Value *read_cycle_counter() {
+    auto f = llvm::Intrinsic::getDeclaration(
+        module.get(), llvm::Intrinsic::readcyclecounter);
+    return ir_builder.CreateCall(f);
+  }
+
+  void emit_profile_prologue() {
+    if (!options.profile) {
+      return;
+    }
+    add_to_profile_slot(0, ir_builder.getInt64(1));
+    if (options.profile_cycles) {
+      profile_start = read_cycle_counter();
+    }
+  }
+
+  void emit_profile_epilogue() {
+    if (!options.profile || !options.profile_cycles) {
+      return;
+    }
+    auto cycles = ir_builder.CreateSub(read_cycle_counter(), profile_start);
+    add_to_profile_slot(1, cycles);
+  }
+
+  void collect_instances(uint32_t chip, const std::string &path,
+                         size_t offset, size_t parent,
+                         std::vector<ChipInstance> &instances) {
+    auto idx = instances.size();
+    instances.push_back({path, symbols->name(chip), offset, parent});
+    for (auto &sub : sub_chips[chip]) {
+      collect_instances(sub.chip, path + "/" + sub.label, offset + sub.offset,
+                        idx, instances);
+    }
+  }
+
+  // Pointer to a field of the trace ring, whose address is baked into the
+  // code.
+  llvm::Value *trace_field(size_t offset, llvm::Type *type) {
+    auto ring = ir_builder.CreateIntToPtr(
+        ir_builder.getInt64(reinterpret_cast<uintptr_t>(options.trace)),
+        ir_builder.getInt8PtrTy());
+    auto field =
+        ir_builder.CreateConstGEP1_64(ir_builder.getInt8Ty(), ring, offset);
+    return ir_builder.CreateBitCast(field, type->getPointerTo());
+  }
 
-  void initialize_prebuilt_chips() { add_nand(); }
+  // Compares every traced bit with its shadow copy and pushes a TraceRecord
+  // for each one that changed. Unchanged bits cost two loads and a branch.
+  void emit_trace(llvm::Value *in_ptr, llvm::Value *out_ptr,
+                  llvm::Value *reg_buf) {
+    struct Source {
+      llvm::Value *base;
+      size_t offset;
+    };
+    std::vector<Source> sources;
+    auto add_signal = [&](std::string scope, std::string name, size_t width,
+                          llvm::Value *base, size_t offset) {
+      // Bits are numbered by the 16-bit TraceRecord::bit.
+      if (width > size_t(std::numeric_limits<uint16_t>::max()) + 1) {
+        throw std::invalid_argument("signal " + name + " of " + scope +
+                                    " is too wide to be traced");
+      }
+      trace_signals.push_back({std::move(scope), std::move(name), width});
+      sources.push_back({base, offset});
+    };
+
+    auto width_of = [](const std::shared_ptr<ast::Type> &type) -> size_t {
+      if (auto st = ast::dyn_cast<ast::SliceType>(type)) {
+        return st->size;
+      }
+      return 1;
+    };
+
+    auto chip = find_chip(entrypoint);
+    size_t offset = 0;
+    for (auto &input : chip->inputs) {
+      auto width = width_of(input->result_type());
+      add_signal(entrypoint, input->ident, width, in_ptr, offset);
+      offset += width;
+    }
+    offset = 0;
+    auto &outputs = chip->output_type->element_types;
+    for (size_t i = 0; i < outputs.size(); ++i) {
+      auto width = width_of(outputs[i]);
+      add_signal(entrypoint, "out" + std::to_string(i), width, out_ptr,
+                 offset);
+      offset += width;
+    }
 
-  void create_run_func() {
+    std::vector<ChipInstance> instances;
+    collect_instances(chip->id, entrypoint, 0, 0, instances);
+    for (auto &inst : instances) {
+      for (auto &reg : registers[symbols->find(inst.chip)]) {
+        add_signal(inst.path, reg.label, reg.width, reg_buf,
+                   inst.offset + reg.offset);
+      }
+    }
+
+    size_t total_bits = 0;
+    for (auto &signal : trace_signals) {
+      total_bits += signal.width;
+    }
+
+    auto i8 = ir_builder.getInt8Ty();
+    auto i64 = ir_builder.getInt64Ty();
+    auto func = ir_builder.GetInsertBlock()->getParent();
+    auto record_type = llvm::StructType::get(
+        *ctx, {i64, ir_builder.getInt32Ty(), ir_builder.getInt16Ty(), i8, i8});
+
+    auto head_slot = ir_builder.CreateAlloca(i64);
+
+    auto cycle_ptr = trace_field(offsetof(TraceRing, cycle), i64);
+    auto cycle = ir_builder.CreateLoad(i64, cycle_ptr);
+    ir_builder.CreateStore(ir_builder.CreateAdd(cycle, ir_builder.getInt64(1)),
+                           cycle_ptr);
+
+    auto head_ptr = trace_field(offsetof(TraceRing, head), i64);
+    auto head = ir_builder.CreateAlignedLoad(i64, head_ptr, llvm::Align(8));
+    auto tail = ir_builder.CreateAlignedLoad(
+        i64, trace_field(offsetof(TraceRing, tail), i64), llvm::Align(8));
+    tail->setAtomic(llvm::AtomicOrdering::Acquire);
+    auto mask =
+        ir_builder.CreateLoad(i64, trace_field(offsetof(TraceRing, mask), i64));
+    ir_builder.CreateStore(head, head_slot);
+
+    auto used = ir_builder.CreateSub(head, tail);
+    auto full = ir_builder.CreateICmpUGT(
+        ir_builder.CreateAdd(used, ir_builder.getInt64(total_bits)),
+        ir_builder.CreateAdd(mask, ir_builder.getInt64(1)));
+    auto wait_bb = llvm::BasicBlock::Create(*ctx, "trace_wait", func);
+    auto trace_bb = llvm::BasicBlock::Create(*ctx, "trace", func);
+    ir_builder.CreateCondBr(full, wait_bb, trace_bb);
+
+    ir_builder.SetInsertPoint(wait_bb);
+    auto wait_type = llvm::FunctionType::get(
+        ir_builder.getVoidTy(), {ir_builder.getInt8PtrTy()}, false);
+    auto wait = ir_builder.CreateLoad(
+        wait_type->getPointerTo(),
+        trace_field(offsetof(TraceRing, wait_for_space),
+                    wait_type->getPointerTo()));
+    ir_builder.CreateCall(wait_type, wait,
+                          {trace_field(0, ir_builder.getInt8Ty())});
+    ir_builder.CreateBr(trace_bb);
+
+    ir_builder.SetInsertPoint(trace_bb);
+    auto records = ir_builder.CreateLoad(
+        record_type->getPointerTo(),
+        trace_field(offsetof(TraceRing, records), record_type->getPointerTo()));
+    auto shadow = ir_builder.CreateLoad(
+        ir_builder.getInt8PtrTy(),
+        trace_field(offsetof(TraceRing, shadow), ir_builder.getInt8PtrTy()));
+
+    size_t shadow_idx = 0;
+    for (size_t s = 0; s < sources.size(); ++s) {
+      for (size_t bit = 0; bit < trace_signals[s].width; ++bit) {
+        auto cur = ir_builder.CreateLoad(
+            i8, ir_builder.CreateConstGEP1_64(i8, sources[s].base,
+                                              sources[s].offset + bit));
+        auto shadow_slot =
+            ir_builder.CreateConstGEP1_64(i8, shadow, shadow_idx);
+        auto old = ir_builder.CreateLoad(i8, shadow_slot);
+        shadow_idx++;
+
+        auto record_bb = llvm::BasicBlock::Create(*ctx, "trace_record", func);
+        auto next_bb = llvm::BasicBlock::Create(*ctx, "trace_next", func);
+        ir_builder.CreateCondBr(ir_builder.CreateICmpNE(cur, old), record_bb,
+                                next_bb);
+
+        ir_builder.SetInsertPoint(record_bb);
+        ir_builder.CreateStore(cur, shadow_slot);
+        auto h = ir_builder.CreateLoad(i64, head_slot);
+        auto record = ir_builder.CreateGEP(record_type, records,
+                                           ir_builder.CreateAnd(h, mask));
+        ir_builder.CreateStore(
+            cycle, ir_builder.CreateStructGEP(record_type, record, 0));
+        ir_builder.CreateStore(
+            ir_builder.getInt32(s),
+            ir_builder.CreateStructGEP(record_type, record, 1));
+        ir_builder.CreateStore(
+            ir_builder.getInt16(bit),
+            ir_builder.CreateStructGEP(record_type, record, 2));
+        ir_builder.CreateStore(
+            cur, ir_builder.CreateStructGEP(record_type, record, 3));
+        ir_builder.CreateStore(ir_builder.CreateAdd(h, ir_builder.getInt64(1)),
+                               head_slot);
+        ir_builder.CreateBr(next_bb);
+
+        ir_builder.SetInsertPoint(next_bb);
+      }
+    }
+
+    auto new_head = ir_builder.CreateLoad(i64, head_slot);
+    auto publish_bb = llvm::BasicBlock::Create(*ctx, "trace_publish", func);
+    auto done_bb = llvm::BasicBlock::Create(*ctx, "trace_done", func);
+    ir_builder.CreateCondBr(ir_builder.CreateICmpNE(new_head, head),
+                            publish_bb, done_bb);
+
+    ir_builder.SetInsertPoint(publish_bb);
+    auto store = ir_builder.CreateAlignedStore(new_head, head_ptr,
+                                               llvm::Align(8));
+    store->setAtomic(llvm::AtomicOrdering::Release);
+    ir_builder.CreateBr(done_bb);
+
+    ir_builder.SetInsertPoint(done_bb);
+  }
+
+  // Chip functions take the result struct, the reg_buf region, the region
+  // in the next bank when double buffered and then the inputs.
+  unsigned first_input_arg() const { return options.double_buffer ? 3 : 2; }
+
+  // Offsets of the register banks in reg_buf. When double buffered,
+  // reg_buf starts with the index of the current bank.
+  std::vector<size_t> bank_offsets() {
+    if (!options.double_buffer) {
+      return {0};
+    }
+    size_t header = RegisterLayout::max_alignment;
+    size_t bank = regs_size;
+    RegisterLayout{true}.place(bank, 0, RegisterLayout::max_alignment);
+    return {header, header + bank};
+  }
+
+  size_t buffer_size() {
+    auto banks = bank_offsets();
+    return banks.back() + regs_size;
+  }
+
+  static size_t port_width(const std::shared_ptr<ast::Type> &type) {
+    if (auto st = ast::dyn_cast<ast::SliceType>(type)) {
+      return st->size;
+    }
+    return 1;
+  }
+
+  static size_t ports_width(const std::vector<std::shared_ptr<ast::Type>> &t) {
+    size_t res = 0;
+    for (auto &type : t) {
+      res += port_width(type);
+    }
+    return res;
+  }
+
+  static size_t inputs_width(const ast::Chip &chip) {
+    std::vector<std::shared_ptr<ast::Type>> types;
+    for (auto &i : chip.inputs) {
+      types.push_back(i->result_type());
+    }
+    return ports_width(types);
+  }
+
+  static size_t outputs_width(const ast::Chip &chip) {
+    return ports_width(chip.output_type->element_types);
+  }
+
+  // Chip of the given name, null if the package has none. Chips are looked
+  // up by name only for the requested chip and the testbench.
+  ast::Chip *find_chip(const std::string &name) const {
+    auto id = symbols->find(name);
+    return id == ast::Symbols::none ? nullptr : chips[id];
+  }
+
+  // Places the regions of the requested chip and of the testbench chips in
+  // reg_buf.
+  void place_top_level_chips() {
+    regs_size = mem_per_chip[find_chip(entrypoint)->id];
+    auto &cosim = options.cosim;
+    for (auto name : {&cosim.stimulus_chip, &cosim.checker_chip}) {
+      if (name->empty()) {
+        continue;
+      }
+      auto chip = find_chip(*name);
+      if (!chip) {
+        throw std::invalid_argument("unknown testbench chip " + *name);
+      }
+      auto offset =
+          layout.place(regs_size, mem_per_chip[chip->id],
+                       std::max<size_t>(align_per_chip[chip->id], 1));
+      (name == &cosim.stimulus_chip ? stimulus_region : checker_region) =
+          offset;
+    }
+  }
+
+  // Creates name(reg_buf, in, out), which evaluates a chip once with its
+  // inputs and outputs packed one byte per bit. The region of the chip
+  // starts at the given offset of every register bank. Only the run
+  // function of the requested chip swaps banks and records the trace.
+  llvm::Function *create_port_func(const std::string &name,
+                                   const std::string &chip_name,
+                                   size_t region, bool is_run) {
     auto out = llvm::Type::getVoidTy(*ctx);
     auto buf_ty = llvm::Type::getInt8Ty(*ctx)->getPointerTo();
 
     auto sig = llvm::FunctionType::get(out, {buf_ty, buf_ty, buf_ty}, false);
 
-    auto func = llvm::Function::Create(sig, llvm::Function::ExternalLinkage,
-                                       "run", module.get());
+    auto func = llvm::Function::Create(
+        sig,
+        is_run ? llvm::Function::ExternalLinkage
+               : llvm::Function::PrivateLinkage,
+        name, module.get());
 
     auto bb = llvm::BasicBlock::Create(*ctx, "run_body", func);
 
     ir_builder.SetInsertPoint(bb);
 
-    auto f = module->getFunction(entrypoint);
-    auto chip = chips[entrypoint];
+    auto chip = find_chip(chip_name);
+    auto f = functions[chip->id];
 
     auto reg_buf = func->getArg(0);
-    auto in_ptr = func->getArg(1);
-    auto out_ptr = func->getArg(2);
+    auto wire = wire_type();
+    auto in_ptr =
+        ir_builder.CreateBitCast(func->getArg(1), wire->getPointerTo());
+    auto out_ptr =
+        ir_builder.CreateBitCast(func->getArg(2), wire->getPointerTo());
+    auto port_align = llvm::MaybeAlign(options.lanes ? 8 : 1);
 
     auto f_res_type = llvm::cast<llvm::PointerType>(f->getArg(0)->getType());
     auto f_res_struct_type =
@@ -166,47 +762,96 @@ struct CodegenVisitor : ast::Visitor {
     auto res = ir_builder.CreateAlloca(f_res_struct_type);
     args.push_back(res);
 
-    args.push_back(reg_buf);
+    // Registers after the run, the next bank when double buffered.
+    llvm::Value *regs = reg_buf;
+    llvm::Value *bank_flag = nullptr;
+    if (options.double_buffer) {
+      auto banks = bank_offsets();
+      bank_flag = ir_builder.CreateLoad(ir_builder.getInt8Ty(), reg_buf);
+      auto bank0 = ir_builder.CreateConstGEP1_64(ir_builder.getInt8Ty(),
+                                                 reg_buf, banks[0]);
+      auto bank1 = ir_builder.CreateConstGEP1_64(ir_builder.getInt8Ty(),
+                                                 reg_buf, banks[1]);
+      auto second = ir_builder.CreateICmpNE(bank_flag, ir_builder.getInt8(0));
+      args.push_back(ir_builder.CreateConstGEP1_64(
+          ir_builder.getInt8Ty(),
+          ir_builder.CreateSelect(second, bank1, bank0), region));
+      regs = ir_builder.CreateSelect(second, bank0, bank1);
+      args.push_back(
+          ir_builder.CreateConstGEP1_64(ir_builder.getInt8Ty(), regs, region));
+    } else {
+      args.push_back(ir_builder.CreateConstGEP1_64(ir_builder.getInt8Ty(),
+                                                   reg_buf, region));
+    }
 
     size_t offset = 0;
 
-    for (size_t arg_num = 0; arg_num < f->arg_size() - 2; arg_num++) {
-      auto type = chip->inputs[arg_num]->result_type();
-      if (auto st = std::dynamic_pointer_cast<ast::SliceType>(type)) {
-        auto arr = ir_builder.CreateAlloca(ir_builder.getInt8Ty(),
-                                           ir_builder.getInt32(st->size));
-
-        for (size_t i = 0; i < st->size; i++) {
-          auto slot =
-              ir_builder.CreateConstGEP1_32(ir_builder.getInt8Ty(), arr, i);
-
-          llvm::Value *val = ir_builder.CreateConstGEP1_32(
-              llvm::Type::getInt8Ty(*ctx), in_ptr, offset + i);
-
-          val = ir_builder.CreateLoad(llvm::Type::getInt8Ty(*ctx), val);
+    // Fixed inputs of the requested chip are constants.
+    if (is_run) {
+      check_fixed_inputs(*chip);
+    }
+    std::vector<KnownBits> known;
+    bool any_known = false;
+    auto fixed_bit = [&](size_t arg_num, size_t i) -> llvm::Constant * {
+      auto it = options.fixed_inputs.find(chip->inputs[arg_num]->ident);
+      if (!is_run || it == options.fixed_inputs.end()) {
+        return nullptr;
+      }
+      any_known = true;
+      return llvm::ConstantInt::get(wire, it->second[i]);
+    };
 
-          ir_builder.CreateStore(val, slot);
+    for (size_t arg_num = 0; arg_num < chip->inputs.size(); arg_num++) {
+      auto type = chip->inputs[arg_num]->result_type();
+      if (auto st = ast::dyn_cast<ast::SliceType>(type)) {
+        auto arr =
+            ir_builder.CreateAlloca(wire, ir_builder.getInt32(st->size));
+        KnownBits bits(st->size);
+
+        if (fixed_bit(arg_num, 0)) {
+          for (size_t i = 0; i < st->size; i++) {
+            bits[i] = fixed_bit(arg_num, i);
+            ir_builder.CreateStore(bits[i],
+                                   ir_builder.CreateConstGEP1_32(wire, arr, i));
+          }
+          known_slices[arr] = bits;
+        } else {
+          copy_wires(arr, ir_builder.CreateConstGEP1_32(wire, in_ptr, offset),
+                     st->size, llvm::MaybeAlign(), port_align);
         }
 
+        known.push_back(std::move(bits));
         args.push_back(arr);
 
         offset += st->size;
         continue;
       }
 
-      assert(std::dynamic_pointer_cast<ast::WireType>(type));
+      assert(ast::isa<ast::WireType>(type));
 
-      llvm::Value *val = ir_builder.CreateConstGEP1_32(
-          llvm::Type::getInt8Ty(*ctx), in_ptr, offset);
-
-      val = ir_builder.CreateLoad(llvm::Type::getInt8Ty(*ctx), val);
-      val = ir_builder.CreateIntCast(val, llvm::Type::getInt8Ty(*ctx), false);
+      llvm::Value *val = fixed_bit(arg_num, 0);
+      if (!val) {
+        val = ir_builder.CreateConstGEP1_32(wire, in_ptr, offset);
+        val = ir_builder.CreateAlignedLoad(wire, val, port_align);
+      }
 
+      known.push_back({llvm::dyn_cast<llvm::Constant>(val)});
       args.push_back(val);
       offset++;
     }
 
-    ir_builder.CreateCall(f, args);
+    LiveBitsVisitor::Bits live(outputs_width(*chip), true);
+    if (any_known) {
+      f = specialize(*chip, known, live, res);
+    }
+    if (!fold_call(*chip, res, live)) {
+      ir_builder.CreateCall(f, args);
+    }
+
+    if (bank_flag && is_run) {
+      ir_builder.CreateStore(
+          ir_builder.CreateXor(bank_flag, ir_builder.getInt8(1)), reg_buf);
+    }
 
     offset = 0;
 
@@ -217,157 +862,1026 @@ struct CodegenVisitor : ast::Visitor {
       llvm::Value *val =
           ir_builder.CreateStructGEP(f_res_struct_type, res, res_num);
 
-      if (auto st = std::dynamic_pointer_cast<ast::SliceType>(type)) {
+      if (auto st = ast::dyn_cast<ast::SliceType>(type)) {
+        copy_wires(ir_builder.CreateConstGEP1_32(wire, out_ptr, offset),
+                   ir_builder.CreateConstGEP2_32(
+                       f_res_struct_type->getElementType(res_num), val, 0, 0),
+                   st->size, port_align, llvm::MaybeAlign());
 
-        for (size_t i = 0; i < st->size; i++) {
-          auto slot = ir_builder.CreateConstGEP1_32(llvm::Type::getInt8Ty(*ctx),
-                                                    out_ptr, i + offset);
+        offset += st->size;
+        continue;
+      }
 
-          auto val_i = ir_builder.CreateConstGEP2_32(
-              f_res_struct_type->getElementType(res_num), val, 0, i);
+      assert(ast::isa<ast::WireType>(type));
 
-          val_i = ir_builder.CreateLoad(ir_builder.getInt8Ty(), val_i);
-          val_i = ir_builder.CreateIntCast(val_i, llvm::Type::getInt8Ty(*ctx),
-                                           false);
+      auto slot = ir_builder.CreateConstGEP1_32(wire, out_ptr, offset);
 
-          ir_builder.CreateStore(val_i, slot);
-        }
+      val = ir_builder.CreateLoad(wire, val);
 
-        offset += st->size;
-        continue;
+      ir_builder.CreateAlignedStore(val, slot, port_align);
+      offset++;
+    }
+
+    if (options.trace && is_run) {
+      emit_trace(func->getArg(1), func->getArg(2), regs);
+    }
+
+    ir_builder.CreateRetVoid();
+    return func;
+  }
+
+  // Creates cosim(reg_buf, cycles, report_ctx), which drives the requested
+  // chip with the stimulus and compares its outputs with the checker for
+  // the given number of cycles. Mismatches are passed to the report
+  // callback, which returns non-zero to stop. Returns the number of cycles
+  // run.
+  void create_cosim_func(llvm::Function *run) {
+    auto &cosim = options.cosim;
+    auto i8 = ir_builder.getInt8Ty();
+    auto i32 = ir_builder.getInt32Ty();
+    auto i64 = ir_builder.getInt64Ty();
+    auto ptr = ir_builder.getInt8PtrTy();
+
+    auto in_width = inputs_width(*find_chip(entrypoint));
+    auto out_width = outputs_width(*find_chip(entrypoint));
+
+    llvm::Function *stimulus = nullptr;
+    if (!cosim.stimulus_chip.empty()) {
+      auto chip = find_chip(cosim.stimulus_chip);
+      if (inputs_width(*chip) != 0 || outputs_width(*chip) != in_width) {
+        throw std::invalid_argument(
+            "stimulus chip must have no inputs and one output per input bit");
+      }
+      stimulus = create_port_func("stimulus", cosim.stimulus_chip,
+                                  stimulus_region, false);
+    }
+    llvm::Function *checker = nullptr;
+    if (!cosim.checker_chip.empty()) {
+      auto chip = find_chip(cosim.checker_chip);
+      if (inputs_width(*chip) != in_width + out_width ||
+          outputs_width(*chip) != 1) {
+        throw std::invalid_argument(
+            "checker chip must take the inputs and outputs and return a wire");
       }
+      checker = create_port_func("checker", cosim.checker_chip,
+                                 checker_region, false);
+    }
 
-      assert(std::dynamic_pointer_cast<ast::WireType>(type));
+    // Host functions and the callback context are baked into the code.
+    auto host_ptr = [&](auto addr, llvm::Type *type) {
+      return ir_builder.CreateIntToPtr(
+          ir_builder.getInt64(reinterpret_cast<uintptr_t>(addr)),
+          type->getPointerTo());
+    };
+    auto stimulus_type =
+        llvm::FunctionType::get(ir_builder.getVoidTy(), {ptr, i64, ptr}, false);
+    auto checker_type =
+        llvm::FunctionType::get(i32, {ptr, i64, ptr, ptr}, false);
+
+    auto sig = llvm::FunctionType::get(i64, {ptr, i64, ptr}, false);
+    auto func = llvm::Function::Create(sig, llvm::Function::ExternalLinkage,
+                                       "cosim", module.get());
+    auto reg_buf = func->getArg(0);
+    auto cycles = func->getArg(1);
+    auto report_ctx = func->getArg(2);
+
+    auto entry = llvm::BasicBlock::Create(*ctx, "entry", func);
+    auto header = llvm::BasicBlock::Create(*ctx, "header", func);
+    auto body = llvm::BasicBlock::Create(*ctx, "body", func);
+    auto latch = llvm::BasicBlock::Create(*ctx, "latch", func);
+    auto exit = llvm::BasicBlock::Create(*ctx, "exit", func);
+
+    ir_builder.SetInsertPoint(entry);
+    // The checker sees the inputs followed by the outputs.
+    auto ports = ir_builder.CreateAlloca(
+        i8, ir_builder.getInt32(std::max<size_t>(in_width + out_width, 1)));
+    auto in = ports;
+    auto out = ir_builder.CreateConstGEP1_64(i8, ports, in_width);
+    auto ok = ir_builder.CreateAlloca(i8);
+    ir_builder.CreateBr(header);
+
+    ir_builder.SetInsertPoint(header);
+    auto cycle = ir_builder.CreatePHI(i64, 2);
+    cycle->addIncoming(ir_builder.getInt64(0), entry);
+    ir_builder.CreateCondBr(ir_builder.CreateICmpULT(cycle, cycles), body,
+                            exit);
+
+    ir_builder.SetInsertPoint(body);
+    if (stimulus) {
+      ir_builder.CreateCall(stimulus, {reg_buf, in, in});
+    } else if (cosim.stimulus) {
+      ir_builder.CreateCall(stimulus_type,
+                            host_ptr(cosim.stimulus, stimulus_type),
+                            {host_ptr(cosim.context, i8), cycle, in});
+    }
+    ir_builder.CreateCall(run, {reg_buf, in, out});
+
+    llvm::Value *mismatch = nullptr;
+    if (checker) {
+      ir_builder.CreateCall(checker, {reg_buf, ports, ok});
+      mismatch = ir_builder.CreateICmpEQ(ir_builder.CreateLoad(i8, ok),
+                                         ir_builder.getInt8(0));
+    } else if (cosim.checker) {
+      auto res = ir_builder.CreateCall(
+          checker_type, host_ptr(cosim.checker, checker_type),
+          {host_ptr(cosim.context, i8), cycle, in, out});
+      mismatch = ir_builder.CreateICmpEQ(res, ir_builder.getInt32(0));
+    }
 
-      auto slot = ir_builder.CreateConstGEP1_32(llvm::Type::getInt8Ty(*ctx),
-                                                out_ptr, offset);
+    if (mismatch) {
+      auto report_bb = llvm::BasicBlock::Create(*ctx, "report", func);
+      auto stop_bb = llvm::BasicBlock::Create(*ctx, "stop", func);
+      ir_builder.CreateCondBr(mismatch, report_bb, latch);
+
+      ir_builder.SetInsertPoint(report_bb);
+      auto stop = ir_builder.CreateCall(
+          checker_type, host_ptr(cosim.report, checker_type),
+          {report_ctx, cycle, in, out});
+      ir_builder.CreateCondBr(
+          ir_builder.CreateICmpNE(stop, ir_builder.getInt32(0)), stop_bb,
+          latch);
+
+      ir_builder.SetInsertPoint(stop_bb);
+      ir_builder.CreateRet(
+          ir_builder.CreateAdd(cycle, ir_builder.getInt64(1)));
+    } else {
+      ir_builder.CreateBr(latch);
+    }
 
-      val = ir_builder.CreateLoad(llvm::Type::getInt8Ty(*ctx), val);
-      val = ir_builder.CreateIntCast(val, llvm::Type::getInt8Ty(*ctx), false);
+    ir_builder.SetInsertPoint(latch);
+    auto next = ir_builder.CreateAdd(cycle, ir_builder.getInt64(1));
+    cycle->addIncoming(next, latch);
+    ir_builder.CreateBr(header);
 
-      ir_builder.CreateStore(val, slot);
+    ir_builder.SetInsertPoint(exit);
+    ir_builder.CreateRet(cycle);
+  }
+
+  // Copies a slice wire by wire up to unroll_max_width wires, so that the
+  // copies of narrow slices become moves of values, and with a memcpy
+  // otherwise, so that the code does not grow with the width.
+  void copy_wires(llvm::Value *dst, llvm::Value *src, size_t width,
+                  llvm::MaybeAlign dst_align, llvm::MaybeAlign src_align) {
+    auto wire = wire_type();
+    if (width > options.unroll_max_width) {
+      auto wire_bytes = options.lanes ? options.lanes / 8 : 1;
+      ir_builder.CreateMemCpy(dst, dst_align, src, src_align,
+                              width * wire_bytes);
+      return;
     }
+    for (size_t i = 0; i < width; ++i) {
+      auto val = ir_builder.CreateAlignedLoad(
+          wire, ir_builder.CreateConstGEP1_32(wire, src, i), src_align);
+      ir_builder.CreateAlignedStore(
+          val, ir_builder.CreateConstGEP1_32(wire, dst, i), dst_align);
+    }
+  }
 
-    ir_builder.CreateRetVoid();
+  bool ssa_slices() const { return options.ssa_slices && !options.lanes; }
+
+  // Pointer to a slice, which is stored to the stack if it is a vector.
+  llvm::Value *slice_ptr(llvm::Value *val) {
+    auto type = llvm::dyn_cast<llvm::FixedVectorType>(val->getType());
+    if (!ssa_slices() || !type) {
+      return val;
+    }
+    auto ptr = ir_builder.CreateAlloca(
+        type->getElementType(), ir_builder.getInt32(type->getNumElements()));
+    ir_builder.CreateAlignedStore(
+        val, ir_builder.CreateBitCast(ptr, type->getPointerTo()),
+        llvm::MaybeAlign(1));
+    auto known = known_slices.find(val);
+    if (known != known_slices.end()) {
+      auto bits = known->second;
+      known_slices[ptr] = std::move(bits);
+    }
+    return ptr;
   }
 
-  void add_nand() {
-    auto out =
-        llvm::StructType::create({llvm::Type::getInt8Ty(*ctx)}, "NandResult");
+  // A byte per wire, or a word with one bit per lane in lane mode.
+  llvm::Type *wire_type() {
+    if (!options.lanes) {
+      return ir_builder.getInt8Ty();
+    }
+    if (options.lanes == 64) {
+      return ir_builder.getInt64Ty();
+    }
+    return llvm::FixedVectorType::get(ir_builder.getInt64Ty(),
+                                      options.lanes / 64);
+  }
+
+  llvm::Function *declare_chip(ast::Chip &chip) {
+    llvm::SmallVector<llvm::Type *> args;
 
-    auto sig = llvm::FunctionType::get(
-        llvm::Type::getVoidTy(*ctx),
-        {out->getPointerTo(), llvm::Type::getInt8Ty(*ctx)->getPointerTo(),
-         llvm::Type::getInt8Ty(*ctx), llvm::Type::getInt8Ty(*ctx)},
-        false);
+    auto out = get_llvm_type(chip.output_type);
+    args.push_back(out->getPointerTo());
+    args.push_back(ir_builder.getInt8Ty()->getPointerTo());
+    if (options.double_buffer) {
+      args.push_back(ir_builder.getInt8Ty()->getPointerTo());
+    }
+
+    for (auto &i : chip.inputs) {
+      args.push_back(get_llvm_type(i->type, true));
+    }
+
+    auto sig =
+        llvm::FunctionType::get(llvm::Type::getVoidTy(*ctx), args, false);
 
     auto func = llvm::Function::Create(sig, llvm::Function::PrivateLinkage,
-                                       "Nand", module.get());
+                                       chip.ident, module.get());
+    add_effects(func, chip);
+    functions[chip.id] = func;
+    return func;
+  }
 
-    auto bb = llvm::BasicBlock::Create(*ctx, "chip_body", func);
+  // Chip functions only write their result struct and registers and read
+  // their inputs, all through their arguments, and always return. The
+  // result struct is a fresh alloca of the caller, inputs are never
+  // written and the regions of different instances and banks are disjoint,
+  // so no argument aliases another. Reading the cycle counter or a lookup
+  // table, also in a callee, is the only access to other memory.
+  void add_effects(llvm::Function *func, ast::Chip &chip) {
+    func->addFnAttr(llvm::Attribute::NoUnwind);
+    func->addFnAttr(llvm::Attribute::WillReturn);
+    func->addFnAttr(llvm::Attribute::NoFree);
+    func->addFnAttr(llvm::Attribute::NoSync);
+    if (!options.profile_cycles) {
+      func->addFnAttr(llvm::Attribute::ArgMemOnly);
+    }
+    for (unsigned i = 0; i < first_input_arg(); ++i) {
+      func->addParamAttr(i, llvm::Attribute::NoAlias);
+      func->addParamAttr(i, llvm::Attribute::NoCapture);
+    }
+    func->addParamAttr(0, llvm::Attribute::NonNull);
+    for (size_t i = 0; i < chip.inputs.size(); ++i) {
+      if (ast::isa<ast::SliceType>(chip.inputs[i]->type)) {
+        auto arg = first_input_arg() + i;
+        func->addParamAttr(arg, llvm::Attribute::NoAlias);
+        func->addParamAttr(arg, llvm::Attribute::NoCapture);
+        func->addParamAttr(arg, llvm::Attribute::ReadOnly);
+      }
+    }
+
+    // Calls of register-free chips are worth inlining, so that calls with
+    // the same inputs are merged and the results stay in registers.
+    if (chip.builtin) {
+      func->addFnAttr(llvm::Attribute::AlwaysInline);
+    } else if (mem_per_chip[chip.id] == 0) {
+      func->addFnAttr(llvm::Attribute::InlineHint);
+    }
+  }
+
+  // Chips of the builtin registry. The lowering works on ports packed into
+  // integers. In lane mode, bitwise builtins are lowered once per wire on
+  // words of lanes and the others once per lane in a loop.
+  void add_builtin(ast::Chip &chip) {
+    auto &lower = find_lowering(chip.ident);
+    auto func = declare_chip(chip);
+    auto entry = llvm::BasicBlock::Create(*ctx, "chip_body", func);
+    ir_builder.SetInsertPoint(entry);
+
+    auto res_ptr = func->getArg(0);
+    auto out = llvm::cast<llvm::PointerType>(res_ptr->getType())
+                   ->getElementType();
+    auto &output_types = chip.output_type->element_types;
+    auto width = [](const std::shared_ptr<ast::Type> &type) -> size_t {
+      if (auto st = ast::dyn_cast<ast::SliceType>(type)) {
+        return st->size;
+      }
+      return 1;
+    };
+    auto input = [&](size_t i, size_t bit) -> llvm::Value * {
+      auto arg = func->getArg(first_input_arg() + i);
+      if (width(chip.inputs[i]->type) == 1) {
+        return arg;
+      }
+      return ir_builder.CreateLoad(
+          wire_type(),
+          ir_builder.CreateConstGEP1_32(wire_type(), arg, bit));
+    };
+    auto output = [&](size_t i, size_t bit) -> llvm::Value * {
+      auto field = ir_builder.CreateStructGEP(out, res_ptr, i);
+      if (width(output_types[i]) == 1) {
+        return field;
+      }
+      return ir_builder.CreateConstGEP2_32(out->getStructElementType(i),
+                                           field, 0, bit);
+    };
+
+    // Packs the bits returned for every wire of a port, and back.
+    auto pack = [&](size_t bits, auto get_bit) -> llvm::Value * {
+      if (bits == 1) {
+        return get_bit(0);
+      }
+      auto type = ir_builder.getIntNTy(bits);
+      llvm::Value *res = llvm::ConstantInt::get(type, 0);
+      for (size_t j = 0; j < bits; ++j) {
+        res = ir_builder.CreateOr(
+            res, ir_builder.CreateShl(ir_builder.CreateZExt(get_bit(j), type),
+                                      j));
+      }
+      return res;
+    };
+    auto unpack = [&](llvm::Value *word, size_t bits, size_t j) {
+      if (bits == 1) {
+        return word;
+      }
+      return ir_builder.CreateTrunc(ir_builder.CreateLShr(word, j),
+                                    ir_builder.getInt1Ty());
+    };
+
+    if (!options.lanes) {
+      llvm::SmallVector<llvm::Value *> args;
+      for (size_t i = 0; i < chip.inputs.size(); ++i) {
+        args.push_back(pack(width(chip.inputs[i]->type), [&](size_t j) {
+          return ir_builder.CreateTrunc(input(i, j), ir_builder.getInt1Ty());
+        }));
+      }
+      auto res = lower(ir_builder, args);
+      for (size_t i = 0; i < output_types.size(); ++i) {
+        auto bits = width(output_types[i]);
+        for (size_t j = 0; j < bits; ++j) {
+          ir_builder.CreateStore(
+              ir_builder.CreateZExt(unpack(res[i], bits, j), wire_type()),
+              output(i, j));
+        }
+      }
+      ir_builder.CreateRetVoid();
+      return;
+    }
+
+    if (ast::find_builtin(chip.ident)->bitwise) {
+      size_t bits = 1;
+      for (auto &i : chip.inputs) {
+        bits = std::max(bits, width(i->type));
+      }
+      for (size_t j = 0; j < bits; ++j) {
+        llvm::SmallVector<llvm::Value *> args;
+        for (size_t i = 0; i < chip.inputs.size(); ++i) {
+          args.push_back(input(i, j));
+        }
+        auto res = lower(ir_builder, args);
+        for (size_t i = 0; i < output_types.size(); ++i) {
+          if (j < width(output_types[i])) {
+            ir_builder.CreateStore(res[i], output(i, j));
+          }
+        }
+      }
+      ir_builder.CreateRetVoid();
+      return;
+    }
+
+    for (size_t i = 0; i < output_types.size(); ++i) {
+      for (size_t j = 0; j < width(output_types[i]); ++j) {
+        ir_builder.CreateStore(llvm::Constant::getNullValue(wire_type()),
+                               output(i, j));
+      }
+    }
+    auto loop = llvm::BasicBlock::Create(*ctx, "lane", func);
+    auto exit = llvm::BasicBlock::Create(*ctx, "exit", func);
+    ir_builder.CreateBr(loop);
+    ir_builder.SetInsertPoint(loop);
+    auto lane = ir_builder.CreatePHI(ir_builder.getInt64Ty(), 2);
+    lane->addIncoming(ir_builder.getInt64(0), entry);
+    auto word_idx = ir_builder.CreateLShr(lane, 6);
+    auto shift = ir_builder.CreateAnd(lane, 63);
+    auto lane_word = [&](llvm::Value *wire) {
+      if (options.lanes == 64) {
+        return wire;
+      }
+      return ir_builder.CreateExtractElement(wire, word_idx);
+    };
+
+    llvm::SmallVector<llvm::Value *> args;
+    for (size_t i = 0; i < chip.inputs.size(); ++i) {
+      args.push_back(pack(width(chip.inputs[i]->type), [&](size_t j) {
+        return ir_builder.CreateTrunc(
+            ir_builder.CreateLShr(lane_word(input(i, j)), shift),
+            ir_builder.getInt1Ty());
+      }));
+    }
+    auto res = lower(ir_builder, args);
+    for (size_t i = 0; i < output_types.size(); ++i) {
+      auto bits = width(output_types[i]);
+      for (size_t j = 0; j < bits; ++j) {
+        auto bit = ir_builder.CreateShl(
+            ir_builder.CreateZExt(unpack(res[i], bits, j),
+                                  ir_builder.getInt64Ty()),
+            shift);
+        auto slot = output(i, j);
+        llvm::Value *wire = ir_builder.CreateLoad(wire_type(), slot);
+        if (options.lanes == 64) {
+          wire = ir_builder.CreateOr(wire, bit);
+        } else {
+          wire = ir_builder.CreateInsertElement(
+              wire, ir_builder.CreateOr(lane_word(wire), bit), word_idx);
+        }
+        ir_builder.CreateStore(wire, slot);
+      }
+    }
+    auto next = ir_builder.CreateAdd(lane, ir_builder.getInt64(1));
+    lane->addIncoming(next, ir_builder.GetInsertBlock());
+    ir_builder.CreateCondBr(
+        ir_builder.CreateICmpULT(next, ir_builder.getInt64(options.lanes)),
+        loop, exit);
+    ir_builder.SetInsertPoint(exit);
+    ir_builder.CreateRetVoid();
+  }
 
+  // Cells of aig::replace_chip: $Xor(a, b), $Mux(s, t, e) and
+  // $Add<n>(a[n], b[n], cin) with outputs sum[n] and carry[n], the carry out
+  // of every bit. An adder is a single add of n + 1 bit integers, or a
+  // bitwise ripple-carry chain in lane mode.
+  void add_primitive(ast::Chip &chip) {
+    auto func = declare_chip(chip);
+    auto bb = llvm::BasicBlock::Create(*ctx, "chip_body", func);
     ir_builder.SetInsertPoint(bb);
 
     auto res_ptr = func->getArg(0);
-    auto nand = ir_builder.CreateNot(
-        ir_builder.CreateAnd(func->getArg(2), func->getArg(3)));
+    auto out = llvm::cast<llvm::PointerType>(res_ptr->getType())
+                   ->getElementType();
+    auto arg = [&](unsigned i) { return func->getArg(first_input_arg() + i); };
+
+    if (chip.ident == "$Xor") {
+      ir_builder.CreateStore(ir_builder.CreateXor(arg(0), arg(1)),
+                             ir_builder.CreateStructGEP(out, res_ptr, 0));
+    } else if (chip.ident == "$Mux") {
+      llvm::Value *res;
+      if (options.lanes) {
+        res = ir_builder.CreateOr(
+            ir_builder.CreateAnd(arg(0), arg(1)),
+            ir_builder.CreateAnd(ir_builder.CreateNot(arg(0)), arg(2)));
+      } else {
+        res = ir_builder.CreateSelect(ir_builder.CreateIsNotNull(arg(0)),
+                                      arg(1), arg(2));
+      }
+      ir_builder.CreateStore(res, ir_builder.CreateStructGEP(out, res_ptr, 0));
+    } else {
+      auto width = std::static_pointer_cast<ast::SliceType>(
+                       chip.inputs[0]->type)
+                       ->size;
+      auto slot = [&](unsigned output, size_t bit) {
+        auto array = ir_builder.CreateStructGEP(out, res_ptr, output);
+        return ir_builder.CreateConstGEP2_32(
+            out->getStructElementType(output), array, 0, bit);
+      };
+      auto load = [&](unsigned input, size_t bit) {
+        return ir_builder.CreateLoad(
+            wire_type(),
+            ir_builder.CreateConstGEP1_32(wire_type(), arg(input), bit));
+      };
+
+      if (options.lanes) {
+        llvm::Value *carry = arg(2);
+        for (size_t i = 0; i < width; ++i) {
+          auto a = load(0, i);
+          auto b = load(1, i);
+          auto x = ir_builder.CreateXor(a, b);
+          ir_builder.CreateStore(ir_builder.CreateXor(x, carry), slot(0, i));
+          carry = ir_builder.CreateOr(ir_builder.CreateAnd(a, b),
+                                      ir_builder.CreateAnd(x, carry));
+          ir_builder.CreateStore(carry, slot(1, i));
+        }
+      } else {
+        auto word = ir_builder.getIntNTy(width + 1);
+        auto pack = [&](unsigned input) {
+          llvm::Value *res = llvm::ConstantInt::get(word, 0);
+          for (size_t i = 0; i < width; ++i) {
+            auto bit = ir_builder.CreateZExt(load(input, i), word);
+            res = ir_builder.CreateOr(res, ir_builder.CreateShl(bit, i));
+          }
+          return res;
+        };
+        auto a = pack(0);
+        auto b = pack(1);
+        auto sum = ir_builder.CreateAdd(
+            ir_builder.CreateAdd(a, b), ir_builder.CreateZExt(arg(2), word));
+        // Bit i + 1 of a ^ b ^ sum is the carry into it.
+        auto carries = ir_builder.CreateXor(ir_builder.CreateXor(a, b), sum);
+        auto bit = [&](llvm::Value *x, size_t i) {
+          return ir_builder.CreateTrunc(ir_builder.CreateLShr(x, i),
+                                        wire_type());
+        };
+        auto one = llvm::ConstantInt::get(wire_type(), 1);
+        for (size_t i = 0; i < width; ++i) {
+          ir_builder.CreateStore(ir_builder.CreateAnd(bit(sum, i), one),
+                                 slot(0, i));
+          ir_builder.CreateStore(
+              ir_builder.CreateAnd(bit(carries, i + 1), one), slot(1, i));
+        }
+      }
+    }
+    ir_builder.CreateRetVoid();
+  }
+
+  bool use_lookup_table(ast::Chip &chip) {
+    return options.lut_max_inputs && !options.lanes && !options.profile &&
+           !chip.builtin && mem_per_chip[chip.id] == 0 &&
+           inputs_width(chip) <=
+               std::min(options.lut_max_inputs, max_lut_inputs) &&
+           outputs_width(chip) <= 64;
+  }
 
-    auto res_slot = ir_builder.CreateStructGEP(out, res_ptr, 0);
+  // Pointer to bit j of output i in the result struct of a chip function.
+  llvm::Value *output_bit(ast::Chip &chip, llvm::Value *res_ptr, size_t i,
+                          size_t j) {
+    auto out = llvm::cast<llvm::PointerType>(res_ptr->getType())
+                   ->getElementType();
+    auto field = ir_builder.CreateStructGEP(out, res_ptr, i);
+    if (!ast::isa<ast::SliceType>(chip.output_type->element_types[i])) {
+      return field;
+    }
+    return ir_builder.CreateConstGEP2_32(out->getStructElementType(i), field,
+                                         0, j);
+  }
+
+  // Replaces the chip function by a load from a table indexed by the input
+  // bits, bit 0 of the first input lowest, holding the output bits packed
+  // the same way. The original function is kept to fill the table.
+  void add_lookup_table(ast::Chip &chip, llvm::Function *eval) {
+    eval->setName(chip.ident + ".eval");
+    auto in_bits = inputs_width(chip);
+    auto out_bits = outputs_width(chip);
+    auto row = ir_builder.getIntNTy(
+        std::max<unsigned>(llvm::PowerOf2Ceil(out_bits), 8));
+    auto table_type = llvm::ArrayType::get(row, uint64_t(1) << in_bits);
+    auto table = new llvm::GlobalVariable(
+        *module, table_type, false, llvm::GlobalValue::PrivateLinkage,
+        llvm::Constant::getNullValue(table_type), chip.ident + ".lut");
+    lookup_tables.push_back({&chip, eval, table, row});
+
+    auto func = declare_chip(chip);
+    func->removeFnAttr(llvm::Attribute::ArgMemOnly);
+    func->removeFnAttr(llvm::Attribute::InlineHint);
+    func->addFnAttr(llvm::Attribute::AlwaysInline);
+    auto bb = llvm::BasicBlock::Create(*ctx, "chip_body", func);
+    ir_builder.SetInsertPoint(bb);
+
+    auto i64 = ir_builder.getInt64Ty();
+    llvm::Value *index = ir_builder.getInt64(0);
+    size_t bit = 0;
+    for (size_t i = 0; i < chip.inputs.size(); ++i) {
+      auto arg = func->getArg(first_input_arg() + i);
+      auto is_slice = ast::isa<ast::SliceType>(chip.inputs[i]->type);
+      for (size_t j = 0; j < port_width(chip.inputs[i]->type); ++j) {
+        llvm::Value *val = arg;
+        if (is_slice) {
+          val = ir_builder.CreateLoad(
+              wire_type(), ir_builder.CreateConstGEP1_32(wire_type(), arg, j));
+        }
+        val = ir_builder.CreateAnd(ir_builder.CreateZExt(val, i64), 1);
+        index = ir_builder.CreateOr(index, ir_builder.CreateShl(val, bit++));
+      }
+    }
+
+    auto slot = ir_builder.CreateInBoundsGEP(
+        table_type, table, {ir_builder.getInt64(0), index});
+    auto packed = ir_builder.CreateLoad(row, slot);
+    bit = 0;
+    auto &outputs = chip.output_type->element_types;
+    for (size_t i = 0; i < outputs.size(); ++i) {
+      for (size_t j = 0; j < port_width(outputs[i]); ++j) {
+        auto val = ir_builder.CreateAnd(
+            ir_builder.CreateTrunc(ir_builder.CreateLShr(packed, bit++),
+                                   wire_type()),
+            1);
+        ir_builder.CreateStore(val, output_bit(chip, func->getArg(0), i, j));
+      }
+    }
+    ir_builder.CreateRetVoid();
+  }
 
-    ir_builder.CreateStore(nand, res_slot);
+  // Creates init(), which fills the lookup tables by evaluating the
+  // original function for every row. Tables are filled in package order,
+  // so the tables of the sub-chips are ready before their callers'.
+  void create_init_func() {
+    auto func = llvm::Function::Create(
+        llvm::FunctionType::get(ir_builder.getVoidTy(), false),
+        llvm::Function::ExternalLinkage, "init", module.get());
+    auto entry = llvm::BasicBlock::Create(*ctx, "entry", func);
+    ir_builder.SetInsertPoint(entry);
+    // Register-free chips do not access their regions.
+    auto buf = ir_builder.CreateAlloca(ir_builder.getInt8Ty());
+
+    struct Slots {
+      llvm::Value *res;
+      std::vector<llvm::Value *> slices;
+    };
+    std::vector<Slots> slots;
+    for (auto &lut : lookup_tables) {
+      Slots s;
+      auto res_type = lut.eval->getArg(0)->getType();
+      s.res = ir_builder.CreateAlloca(
+          llvm::cast<llvm::PointerType>(res_type)->getElementType());
+      for (auto &input : lut.chip->inputs) {
+        auto width = port_width(input->type);
+        s.slices.push_back(
+            ast::isa<ast::SliceType>(input->type)
+                ? ir_builder.CreateAlloca(wire_type(),
+                                          ir_builder.getInt32(width))
+                : nullptr);
+      }
+      slots.push_back(std::move(s));
+    }
 
+    auto i64 = ir_builder.getInt64Ty();
+    for (size_t t = 0; t < lookup_tables.size(); ++t) {
+      auto &lut = lookup_tables[t];
+      auto &chip = *lut.chip;
+      auto prev = ir_builder.GetInsertBlock();
+      auto loop = llvm::BasicBlock::Create(*ctx, chip.ident + ".rows", func);
+      auto exit = llvm::BasicBlock::Create(*ctx, chip.ident + ".done", func);
+      ir_builder.CreateBr(loop);
+      ir_builder.SetInsertPoint(loop);
+      auto index = ir_builder.CreatePHI(i64, 2);
+      index->addIncoming(ir_builder.getInt64(0), prev);
+
+      llvm::SmallVector<llvm::Value *> args{slots[t].res, buf};
+      if (options.double_buffer) {
+        args.push_back(buf);
+      }
+      size_t bit = 0;
+      for (size_t i = 0; i < chip.inputs.size(); ++i) {
+        auto slice = slots[t].slices[i];
+        for (size_t j = 0; j < port_width(chip.inputs[i]->type); ++j) {
+          auto val = ir_builder.CreateAnd(
+              ir_builder.CreateTrunc(ir_builder.CreateLShr(index, bit++),
+                                     wire_type()),
+              1);
+          if (!slice) {
+            args.push_back(val);
+            break;
+          }
+          ir_builder.CreateStore(
+              val, ir_builder.CreateConstGEP1_32(wire_type(), slice, j));
+        }
+        if (slice) {
+          args.push_back(slice);
+        }
+      }
+      ir_builder.CreateCall(lut.eval, args);
+
+      llvm::Value *packed = llvm::ConstantInt::get(lut.row, 0);
+      bit = 0;
+      auto &outputs = chip.output_type->element_types;
+      for (size_t i = 0; i < outputs.size(); ++i) {
+        for (size_t j = 0; j < port_width(outputs[i]); ++j) {
+          llvm::Value *val = ir_builder.CreateLoad(
+              wire_type(), output_bit(chip, slots[t].res, i, j));
+          val = ir_builder.CreateAnd(ir_builder.CreateZExt(val, lut.row), 1);
+          packed =
+              ir_builder.CreateOr(packed, ir_builder.CreateShl(val, bit++));
+        }
+      }
+      auto slot = ir_builder.CreateInBoundsGEP(
+          lut.table->getValueType(), lut.table,
+          {ir_builder.getInt64(0), index});
+      ir_builder.CreateStore(packed, slot);
+
+      auto next = ir_builder.CreateAdd(index, ir_builder.getInt64(1));
+      index->addIncoming(next, loop);
+      auto rows = lut.table->getValueType()->getArrayNumElements();
+      ir_builder.CreateCondBr(
+          ir_builder.CreateICmpULT(next, ir_builder.getInt64(rows)), loop,
+          exit);
+      ir_builder.SetInsertPoint(exit);
+    }
     ir_builder.CreateRetVoid();
   }
 
-  CodegenVisitor(llvm::LLVMContext *ctx, std::string entrypoint)
-      : ctx(ctx), ir_builder(*ctx), entrypoint(entrypoint) {
+  void check_fixed_inputs(ast::Chip &chip) {
+    if (!options.fixed_inputs.empty() && options.lanes) {
+      throw std::invalid_argument(
+          "fixed inputs are not supported in lane mode");
+    }
+    for (auto &[name, values] : options.fixed_inputs) {
+      auto input = std::find_if(chip.inputs.begin(), chip.inputs.end(),
+                                [&](auto &i) { return i->ident == name; });
+      if (input == chip.inputs.end()) {
+        throw std::invalid_argument("unknown input " + name);
+      }
+      auto width = port_width((*input)->type);
+      if (values.size() != width) {
+        throw std::invalid_argument("input " + name + " has " +
+                                    std::to_string(width) + " bits");
+      }
+      for (auto v : values) {
+        if (v != 0 && v != 1) {
+          throw std::invalid_argument("bits of input " + name +
+                                      " must be 0 or 1");
+        }
+      }
+    }
+  }
+
+  // Known bits of a wire or of a slice.
+  KnownBits known_bits(llvm::Value *val, size_t width) {
+    if (!val->getType()->isPointerTy() && !val->getType()->isVectorTy()) {
+      return {llvm::dyn_cast<llvm::Constant>(val)};
+    }
+    auto it = known_slices.find(val);
+    return it == known_slices.end() ? KnownBits(width) : it->second;
+  }
+
+  static bool any_known(const KnownBits &bits) {
+    return std::any_of(bits.begin(), bits.end(), [](auto b) { return b; });
+  }
+
+  // Returns the function of the chip cloned with the known bits of its
+  // inputs folded in and only computing the live output bits, and records
+  // the known outputs for the result struct of the call. The clone has the
+  // signature and the register layout of the original and ignores the
+  // known arguments. The original is returned if nothing is known and all
+  // outputs are live.
+  llvm::Function *specialize(ast::Chip &chip,
+                             const std::vector<KnownBits> &inputs,
+                             const LiveBitsVisitor::Bits &live,
+                             llvm::Value *res) {
+    auto name = chip.ident;
+    if (std::any_of(inputs.begin(), inputs.end(), any_known)) {
+      for (auto &bits : inputs) {
+        name += '.';
+        for (auto b : bits) {
+          name += !b ? 'x' : b->isNullValue() ? '0' : '1';
+        }
+      }
+    }
+    if (std::find(live.begin(), live.end(), false) != live.end()) {
+      name += ".o";
+      for (auto b : live) {
+        name += b ? '1' : '0';
+      }
+    }
+    if (chip.builtin || name == chip.ident) {
+      return functions[chip.id];
+    }
+    auto &func = specializations[name];
+    if (!func) {
+      func = emit_clone(chip, inputs, live, name);
+    }
+    auto outputs = known_outputs.find(func);
+    if (outputs != known_outputs.end()) {
+      auto bits = outputs->second;
+      known_outputs[res] = std::move(bits);
+    }
+    return func;
+  }
+
+  // Emits a clone in the middle of another chip function, whose state is
+  // kept aside meanwhile.
+  llvm::Function *emit_clone(ast::Chip &chip,
+                             const std::vector<KnownBits> &inputs,
+                             const LiveBitsVisitor::Bits &live,
+                             const std::string &name) {
+    auto ip = ir_builder.saveIP();
+    auto saved = std::make_tuple(
+        current_function, current_chip, std::move(symbol_table),
+        std::move(register_slots), std::move(live_calls), update_reg_block,
+        update_reg_end, std::move(update_groups), reg_buf_offset, call_count,
+        profile_start, specializing);
+    specializing = true;
+
+    // Struct types are not uniqued, the clone takes the original's.
+    auto func = llvm::Function::Create(
+        functions[chip.id]->getFunctionType(),
+        llvm::Function::PrivateLinkage, name, module.get());
+    add_effects(func, chip);
+    emit_chip_body(chip, func, inputs, live);
+
+    std::tie(current_function, current_chip, symbol_table, register_slots,
+             live_calls, update_reg_block, update_reg_end, update_groups,
+             reg_buf_offset, call_count, profile_start, specializing) =
+        std::move(saved);
+    ir_builder.restoreIP(ip);
+    return func;
+  }
+
+  // Stores the known outputs of a call of a register-free chip instead of
+  // calling it if all of its live outputs are known. Returns true if the
+  // call was folded.
+  bool fold_call(ast::Chip &chip, llvm::Value *res,
+                 const LiveBitsVisitor::Bits &live) {
+    if (mem_per_chip[chip.id] != 0) {
+      return false;
+    }
+    auto outputs = known_outputs.find(res);
+    std::vector<KnownBits> bits;
+    if (outputs != known_outputs.end()) {
+      bits = outputs->second;
+    }
+    size_t bit = 0;
+    for (size_t i = 0; i < chip.output_type->element_types.size(); ++i) {
+      bits.resize(i + 1);
+      bits[i].resize(port_width(chip.output_type->element_types[i]));
+      for (auto b : bits[i]) {
+        if (live[bit++] && !b) {
+          return false;
+        }
+      }
+    }
+    // Slices of the result may still be read, e.g. by a register write.
+    for (size_t i = 0; i < bits.size(); ++i) {
+      for (size_t j = 0; j < bits[i].size(); ++j) {
+        if (bits[i][j]) {
+          ir_builder.CreateStore(bits[i][j], output_bit(chip, res, i, j));
+        }
+      }
+    }
+    return true;
+  }
+
+  // Evaluates a builtin for every value of its unknown input bits, if there
+  // are few enough of them. Output bits equal in all evaluations are
+  // known.
+  std::vector<KnownBits> fold_builtin(ast::Chip &chip,
+                                      const std::vector<KnownBits> &inputs) {
+    static constexpr size_t max_unknown_bits = 6;
+    size_t unknown = 0;
+    for (auto &bits : inputs) {
+      unknown += std::count(bits.begin(), bits.end(), nullptr);
+    }
+    if (unknown > max_unknown_bits) {
+      return {};
+    }
+
+    // Lowerings of constants fold to constants, anything else is dropped
+    // with the scratch block.
+    auto &lower = find_lowering(chip.ident);
+    std::unique_ptr<llvm::BasicBlock> scratch(llvm::BasicBlock::Create(*ctx));
+    llvm::IRBuilder<> folder(scratch.get());
+    std::vector<KnownBits> res;
+    for (uint64_t row = 0; row < (uint64_t(1) << unknown); ++row) {
+      size_t next_unknown = 0;
+      llvm::SmallVector<llvm::Value *> args;
+      for (auto &bits : inputs) {
+        llvm::APInt word(bits.size(), 0);
+        for (size_t j = 0; j < bits.size(); ++j) {
+          if (bits[j] ? !bits[j]->isNullValue()
+                      : (row >> next_unknown++) & 1) {
+            word.setBit(j);
+          }
+        }
+        args.push_back(folder.getInt(word));
+      }
+      auto outputs = lower(folder, args);
+      res.resize(outputs.size());
+      for (size_t i = 0; i < outputs.size(); ++i) {
+        auto word = llvm::dyn_cast<llvm::ConstantInt>(outputs[i]);
+        if (!word) {
+          return {};
+        }
+        auto width = word->getBitWidth();
+        res[i].resize(width);
+        for (unsigned j = 0; j < width; ++j) {
+          auto bit = llvm::ConstantInt::get(wire_type(), word->getValue()[j]);
+          if (row == 0) {
+            res[i][j] = bit;
+          } else if (res[i][j] != bit) {
+            res[i][j] = nullptr;
+          }
+        }
+      }
+    }
+    return res;
+  }
+
+  CodegenVisitor(llvm::LLVMContext *ctx, std::string entrypoint,
+                 const CodegenOptions &options)
+      : ctx(ctx), ir_builder(*ctx), entrypoint(entrypoint), options(options),
+        layout{options.align_registers} {
     module = std::make_unique<llvm::Module>("mod", *ctx);
-    initialize_prebuilt_chips();
   }
 
   llvm::Type *get_llvm_type(std::shared_ptr<ast::Type> t,
                             bool array_as_ptr = false) {
-    TypeTransformVisitor v(ctx, array_as_ptr);
+    TypeTransformVisitor v(ctx, wire_type(), array_as_ptr);
     t->visit(v);
     return v.get_type();
   }
 
   void visit(ast::Package &pkg) override {
-    RegMemCounter c;
+    RegMemCounter c(profile_header_size(), layout);
     c.visit(pkg);
     mem_per_chip = std::move(c.mem_per_chip);
+    align_per_chip = std::move(c.align_per_chip);
     reg_buf_offset = 0;
 
+    symbols = &pkg.symbols;
+    chips.assign(symbols->size(), nullptr);
+    functions.assign(symbols->size(), nullptr);
+    sub_chips.assign(symbols->size(), {});
+    registers.assign(symbols->size(), {});
+
+    // Chips with registers cannot be evaluated lane-wise and are left out.
+    auto has_registers = [this](uint32_t chip) {
+      return options.lanes && mem_per_chip[chip] > profile_header_size();
+    };
+    auto top = symbols->find(entrypoint);
+    if (top == ast::Symbols::none) {
+      throw std::invalid_argument("unknown chip " + entrypoint);
+    }
+    if (has_registers(top)) {
+      throw std::invalid_argument("registers are not supported in lane mode");
+    }
+
     for (auto &c : pkg.chips) {
-      c->visit(*this);
+      if (!has_registers(c->id)) {
+        c->visit(*this);
+      }
+    }
+    place_top_level_chips();
+    auto run = create_port_func("run", entrypoint, 0, true);
+    if (options.cosim.enabled()) {
+      create_cosim_func(run);
+    }
+    if (!lookup_tables.empty()) {
+      create_init_func();
     }
-    create_run_func();
   }
 
   void visit(ast::Chip &chip) override {
-    reg_buf_offset = 0;
-    if (chip.ident == "Nand") {
+    chips[chip.id] = &chip;
+    if (chip.builtin) {
+      if (chip.ident[0] == '$') {
+        add_primitive(chip);
+      } else {
+        add_builtin(chip);
+      }
       return;
     }
 
-    chips[chip.ident] = &chip;
+    auto func = declare_chip(chip);
+    emit_chip_body(chip, func);
 
-    llvm::SmallVector<llvm::Type *> args;
-    llvm::SmallVector<llvm::Type *> outputs;
-
-    auto out = get_llvm_type(chip.output_type);
-    args.push_back(out->getPointerTo());
-    args.push_back(ir_builder.getInt8Ty()->getPointerTo());
-
-    for (auto &i : chip.inputs) {
-      args.push_back(get_llvm_type(i->type, true));
+    if (use_lookup_table(chip)) {
+      add_lookup_table(chip, func);
     }
+  }
 
-    auto sig =
-        llvm::FunctionType::get(llvm::Type::getVoidTy(*ctx), args, false);
-
-    auto func = llvm::Function::Create(sig, llvm::Function::PrivateLinkage,
-                                       chip.ident, module.get());
-
+  // Emits the statements of the chip into its function, or into a clone
+  // with the given known input bits and live output bits.
+  void emit_chip_body(ast::Chip &chip, llvm::Function *func,
+                      const std::vector<KnownBits> &known = {},
+                      LiveBitsVisitor::Bits live = {}) {
+    current_chip = &chip;
     current_function = func;
+    reg_buf_offset = profile_header_size();
+    call_count = 0;
+
+    if (live.empty()) {
+      live.assign(outputs_width(chip), true);
+    }
+    LiveBitsVisitor live_bits(mem_per_chip, std::move(live));
+    chip.visit(live_bits);
+    live_calls = std::move(live_bits.live_calls);
 
     auto bb = llvm::BasicBlock::Create(*ctx, "chip_body", func);
 
     update_reg_block = llvm::BasicBlock::Create(*ctx, "update_regs", func);
+    update_reg_end = update_reg_block;
+    update_groups.clear();
 
     ir_builder.SetInsertPoint(bb);
 
-    symbol_table.clear();
+    symbol_table.assign(chip.value_count, nullptr);
+    register_slots.clear();
 
     for (size_t i = 0; i < chip.inputs.size(); i++) {
-      llvm::Value *arg = func->getArg(i + 2);
+      llvm::Value *arg = func->getArg(i + first_input_arg());
       arg->setName(chip.inputs[i]->ident);
-      symbol_table[chip.inputs[i]->ident] = arg;
+      symbol_table[chip.inputs[i]->id] = arg;
+      if (known.empty() || !any_known(known[i])) {
+        continue;
+      }
+      if (arg->getType()->isPointerTy()) {
+        known_slices[arg] = known[i];
+      } else {
+        symbol_table[chip.inputs[i]->id] = known[i][0];
+      }
     }
 
+    emit_profile_prologue();
+
     for (auto &s : chip.body) {
       s->visit(*this);
     }
   }
 
   void visit(ast::AssignStmt &stmt) override {
+    if (ast::isa<ast::CallExpr>(stmt.rhs) ||
+        ast::isa<ast::CreateRegisterExpr>(stmt.rhs)) {
+      call_label = stmt.assignees[0]->ident;
+    }
     stmt.rhs->visit(*this);
 
     auto res = results_stack.top();
     results_stack.pop();
 
-    if (std::dynamic_pointer_cast<ast::RegisterType>(stmt.rhs->result_type())) {
-      symbol_table[stmt.assignees[0]->ident] = res;
-      return;
-    }
-
-    if (std::dynamic_pointer_cast<ast::WireType>(stmt.rhs->result_type())) {
-      symbol_table[stmt.assignees[0]->ident] = res;
-      return;
-    }
-
-    if (std::dynamic_pointer_cast<ast::SliceType>(stmt.rhs->result_type())) {
-      symbol_table[stmt.assignees[0]->ident] = res;
+    // Registers, wires and slices bind a single value.
+    auto rhs_type = stmt.rhs->result_type();
+    auto tuple_type = ast::dyn_cast<ast::TupleType>(rhs_type);
+    if (!tuple_type) {
+      symbol_table[stmt.assignees[0]->id] = res;
       return;
     }
 
@@ -375,8 +1889,7 @@ struct CodegenVisitor : ast::Visitor {
     auto struct_type =
         llvm::cast<llvm::StructType>(struct_ptr_type->getElementType());
 
-    auto tuple_type =
-        std::static_pointer_cast<ast::TupleType>(stmt.rhs->result_type());
+    auto known = known_outputs.find(res);
 
     for (unsigned i = 0; i < stmt.assignees.size(); i++) {
       auto type = tuple_type->element_types[i];
@@ -386,57 +1899,131 @@ struct CodegenVisitor : ast::Visitor {
 
       llvm::Value *val{nullptr};
 
-      if (auto st = std::dynamic_pointer_cast<ast::SliceType>(type)) {
+      if (ast::isa<ast::SliceType>(type)) {
         val = ir_builder.CreateConstGEP2_32(struct_type->getElementType(i),
-                                            val_ptr, 0, i);
+                                            val_ptr, 0, 0);
+        if (known != known_outputs.end() && any_known(known->second[i])) {
+          known_slices[val] = known->second[i];
+        }
+      } else if (known != known_outputs.end() && known->second[i][0]) {
+        symbol_table[stmt.assignees[i]->id] = known->second[i][0];
+        continue;
       } else {
         val = ir_builder.CreateLoad(struct_type->getElementType(i), val_ptr);
       }
 
       val->setName(stmt.assignees[i]->ident);
-      symbol_table[stmt.assignees[i]->ident] = val;
+      symbol_table[stmt.assignees[i]->id] = val;
     }
   }
 
   void visit(ast::CallExpr &expr) override {
-    auto callee = module->getFunction(expr.chip_name);
+    auto callee = functions[expr.chip_id];
+    auto &chip = *chips[expr.chip_id];
     llvm::SmallVector<llvm::Value *> params;
 
     auto res_type = llvm::cast<llvm::PointerType>(callee->getArg(0)->getType());
     auto res_struct = llvm::cast<llvm::StructType>(res_type->getElementType());
 
     auto res = ir_builder.CreateAlloca(res_struct);
-    auto reg_buf = ir_builder.CreateConstGEP1_32(
-        ir_builder.getInt8Ty(), current_function->getArg(1), reg_buf_offset);
-
-    reg_buf_offset += mem_per_chip[expr.chip_name];
+    auto offset =
+        layout.place(reg_buf_offset, mem_per_chip[expr.chip_id],
+                     std::max<size_t>(align_per_chip[expr.chip_id], 1));
+
+    if (!chip.builtin && !specializing) {
+      auto label = call_label.empty()
+                       ? expr.chip_name + "#" + std::to_string(call_count)
+                       : call_label;
+      sub_chips[current_chip->id].push_back({label, expr.chip_id, offset});
+    }
+    call_label.clear();
+    call_count++;
 
     params.push_back(res);
-    params.push_back(reg_buf);
+    params.push_back(ir_builder.CreateConstGEP1_32(
+        ir_builder.getInt8Ty(), current_function->getArg(1), offset));
+    if (options.double_buffer) {
+      params.push_back(ir_builder.CreateConstGEP1_32(
+          ir_builder.getInt8Ty(), current_function->getArg(2), offset));
+    }
 
-    for (auto &a : expr.args) {
-      a->visit(*this);
-      params.push_back(results_stack.top());
+    std::vector<KnownBits> known;
+    bool inputs_known = false;
+    for (size_t i = 0; i < expr.args.size(); ++i) {
+      expr.args[i]->visit(*this);
+      params.push_back(slice_ptr(results_stack.top()));
       results_stack.pop();
+      known.push_back(
+          known_bits(params.back(), port_width(chip.inputs[i]->type)));
+      inputs_known |= any_known(known.back());
     }
 
-    ir_builder.CreateCall(callee, params);
+    // Calls of register-free chips whose outputs are unused or whose live
+    // outputs are all known are left out. Calls with known input bits or
+    // unused outputs call a clone, except of chips evaluated by a table,
+    // whose calls cost a load.
+    auto live = live_calls.at(&expr);
+    if (mem_per_chip[expr.chip_id] == 0 &&
+        std::find(live.begin(), live.end(), true) == live.end()) {
+      results_stack.push(res);
+      return;
+    }
+    if (chip.builtin) {
+      if (inputs_known && !options.lanes && chip.ident[0] != '$') {
+        auto outputs = fold_builtin(chip, known);
+        if (!outputs.empty()) {
+          known_outputs[res] = std::move(outputs);
+        }
+      }
+    } else {
+      auto spec_live = live;
+      if (use_lookup_table(chip)) {
+        spec_live.assign(live.size(), true);
+      }
+      callee = specialize(chip, known, spec_live, res);
+    }
+    if (!fold_call(chip, res, live)) {
+      ir_builder.CreateCall(callee, params);
+      if (!callee->onlyAccessesArgMemory()) {
+        current_function->removeFnAttr(llvm::Attribute::ArgMemOnly);
+      }
+    }
     results_stack.push(res);
   }
 
   void visit(ast::Value &val) override {
-    results_stack.push(symbol_table[val.ident]);
+    results_stack.push(symbol_table[val.id]);
   }
 
   void store(llvm::Value *slot_ptr, llvm::Value *val,
-             std::shared_ptr<ast::Type> type) {
-    if (auto t = std::dynamic_pointer_cast<ast::SliceType>(type)) {
+             const std::shared_ptr<ast::Type> &type) {
+    if (auto t = ast::dyn_cast<ast::SliceType>(type)) {
+      if (val->getType()->isVectorTy()) {
+        ir_builder.CreateAlignedStore(
+            val,
+            ir_builder.CreateBitCast(slot_ptr,
+                                     val->getType()->getPointerTo()),
+            llvm::MaybeAlign(1));
+        return;
+      }
+      if (!known_slices.count(val)) {
+        auto p = llvm::cast<llvm::PointerType>(slot_ptr->getType());
+        copy_wires(ir_builder.CreateConstGEP2_32(p->getElementType(),
+                                                 slot_ptr, 0, 0),
+                   val, t->size, llvm::MaybeAlign(), llvm::MaybeAlign());
+        return;
+      }
       for (size_t i = 0; i < t->size; ++i) {
         auto pointee_type = get_llvm_type(t->element_type);
         auto p = llvm::cast<llvm::PointerType>(slot_ptr->getType());
         auto res_slot =
             ir_builder.CreateConstGEP2_32(p->getElementType(), slot_ptr, 0, i);
 
+        auto known = known_slices.find(val);
+        if (known != known_slices.end() && known->second[i]) {
+          ir_builder.CreateStore(known->second[i], res_slot);
+          continue;
+        }
         auto p2 = llvm::cast<llvm::PointerType>(val->getType());
         auto val_slot =
             ir_builder.CreateConstGEP1_32(p2->getElementType(), val, i);
@@ -456,26 +2043,54 @@ struct CodegenVisitor : ast::Visitor {
     auto res_struct_type =
         llvm::cast<llvm::StructType>(res_type->getElementType());
 
+    std::vector<KnownBits> known;
+    bool outputs_known = false;
     for (unsigned i = 0; i < stmt.results.size(); i++) {
       auto slot = ir_builder.CreateStructGEP(res_struct_type, res_ptr, i);
       stmt.results[i]->visit(*this);
       auto val = results_stack.top();
       results_stack.pop();
 
-      store(slot, val, stmt.results[i]->result_type());
+      auto type = stmt.results[i]->result_type();
+      store(slot, val, type);
+      known.push_back(known_bits(val, port_width(type)));
+      outputs_known |= any_known(known.back());
+    }
+    if (outputs_known) {
+      known_outputs[current_function] = std::move(known);
     }
     ir_builder.CreateBr(update_reg_block);
-    ir_builder.SetInsertPoint(update_reg_block);
+    ir_builder.SetInsertPoint(update_reg_end);
+    emit_profile_epilogue();
     ir_builder.CreateRetVoid();
   }
 
   void visit(ast::SliceJoinExpr &expr) override {
+    if (ssa_slices()) {
+      llvm::Value *vec = llvm::PoisonValue::get(
+          llvm::FixedVectorType::get(wire_type(), expr.values.size()));
+      KnownBits known;
+      for (size_t i = 0; i < expr.values.size(); ++i) {
+        expr.values[i]->visit(*this);
+        auto val = results_stack.top();
+        results_stack.pop();
+        vec = ir_builder.CreateInsertElement(vec, val, i);
+        known.push_back(llvm::dyn_cast<llvm::Constant>(val));
+      }
+      if (any_known(known)) {
+        known_slices[vec] = std::move(known);
+      }
+      results_stack.push(vec);
+      return;
+    }
+
     auto res_type =
         llvm::cast<llvm::PointerType>(get_llvm_type(expr.result_type(), true));
 
     llvm::Value *slice = ir_builder.CreateAlloca(
         res_type->getElementType(), ir_builder.getInt64(expr.values.size()));
 
+    KnownBits known;
     for (size_t i = 0; i < expr.values.size(); ++i) {
       auto slot =
           ir_builder.CreateConstGEP1_32(res_type->getElementType(), slice, i);
@@ -483,6 +2098,10 @@ struct CodegenVisitor : ast::Visitor {
       auto val = results_stack.top();
       results_stack.pop();
       ir_builder.CreateStore(val, slot);
+      known.push_back(llvm::dyn_cast<llvm::Constant>(val));
+    }
+    if (any_known(known)) {
+      known_slices[slice] = std::move(known);
     }
 
     results_stack.push(slice);
@@ -493,13 +2112,30 @@ struct CodegenVisitor : ast::Visitor {
     auto slice = results_stack.top();
     results_stack.pop();
 
-    auto ptr_type = llvm::cast<llvm::PointerType>(
-        get_llvm_type(expr.slice->result_type(), true));
-
-    auto begin_ptr = ir_builder.CreateConstGEP1_32(ptr_type->getElementType(),
-                                                   slice, expr.begin);
+    // A vector or a pointer to the first element.
+    llvm::Value *res;
+    if (slice->getType()->isVectorTy()) {
+      llvm::SmallVector<int> mask;
+      for (auto i = expr.begin; i < expr.end; ++i) {
+        mask.push_back(int(i));
+      }
+      res = ir_builder.CreateShuffleVector(slice, mask);
+    } else {
+      auto ptr_type = llvm::cast<llvm::PointerType>(
+          get_llvm_type(expr.slice->result_type(), true));
+      res = ir_builder.CreateConstGEP1_32(ptr_type->getElementType(), slice,
+                                          expr.begin);
+    }
+    auto known = known_slices.find(slice);
+    if (known != known_slices.end()) {
+      KnownBits bits(known->second.begin() + expr.begin,
+                     known->second.begin() + expr.end);
+      if (any_known(bits)) {
+        known_slices[res] = std::move(bits);
+      }
+    }
 
-    results_stack.push(begin_ptr);
+    results_stack.push(res);
   }
 
   void visit(ast::SliceToWireCast &e) override {
@@ -507,6 +2143,15 @@ struct CodegenVisitor : ast::Visitor {
     auto slice = results_stack.top();
     results_stack.pop();
 
+    auto known = known_slices.find(slice);
+    if (known != known_slices.end() && known->second[0]) {
+      results_stack.push(known->second[0]);
+      return;
+    }
+    if (slice->getType()->isVectorTy()) {
+      results_stack.push(ir_builder.CreateExtractElement(slice, uint64_t(0)));
+      return;
+    }
     results_stack.push(
         ir_builder.CreateLoad(get_llvm_type(e.result_type()), slice));
   }
@@ -515,6 +2160,12 @@ struct CodegenVisitor : ast::Visitor {
     auto struct_ptr = results_stack.top();
     results_stack.pop();
 
+    auto known = known_outputs.find(struct_ptr);
+    if (known != known_outputs.end() && known->second[0][0]) {
+      results_stack.push(known->second[0][0]);
+      return;
+    }
+
     auto ptr_type = llvm::cast<llvm::PointerType>(struct_ptr->getType());
 
     auto element_ptr =
@@ -525,16 +2176,71 @@ struct CodegenVisitor : ast::Visitor {
   }
 
   void visit(ast::CreateRegisterExpr &e) override {
+    size_t width = 1;
+    if (auto t = ast::dyn_cast<ast::SliceType>(e.res_type)) {
+      width = t->size;
+    }
+    auto offset = layout.place(reg_buf_offset, width,
+                               RegisterLayout::alignment(width));
     auto buf = ir_builder.CreateConstGEP1_32(
-        ir_builder.getInt8Ty(), current_function->getArg(1), reg_buf_offset);
-    if (auto t = std::dynamic_pointer_cast<ast::SliceType>(e.result_type())) {
-      reg_buf_offset += t->size;
-    } else {
-      reg_buf_offset++;
+        ir_builder.getInt8Ty(), current_function->getArg(1), offset);
+    register_slots[buf] = {offset, width};
+
+    auto &chip_registers = registers[current_chip->id];
+    auto label = call_label.empty()
+                     ? "reg#" + std::to_string(chip_registers.size())
+                     : call_label;
+    if (!specializing) {
+      chip_registers.push_back({label, width, offset});
     }
+    call_label.clear();
     results_stack.push(buf);
   }
 
+  // Block of update_regs with the updates enabled by a wire or a
+  // condition. Updates with the same enable share the block, so that a
+  // disabled group costs a single branch.
+  llvm::BasicBlock *update_group(llvm::Value *enable) {
+    auto &group = update_groups[enable];
+    if (group) {
+      return group;
+    }
+    auto ip = ir_builder.saveIP();
+    group = llvm::BasicBlock::Create(*ctx, "update_enabled", current_function);
+    auto done = llvm::BasicBlock::Create(*ctx, "update_done", current_function);
+    ir_builder.SetInsertPoint(update_reg_end);
+    auto cond = enable;
+    if (!enable->getType()->isIntegerTy(1)) {
+      cond = ir_builder.CreateICmpNE(
+          enable, llvm::Constant::getNullValue(enable->getType()));
+    }
+    ir_builder.CreateCondBr(cond, group, done);
+    ir_builder.SetInsertPoint(group);
+    ir_builder.CreateBr(done);
+    update_reg_end = done;
+    ir_builder.restoreIP(ip);
+    return group;
+  }
+
+  // Moves the insertion point to where an update with the enable goes,
+  // null if always enabled. Returns false if it is never enabled.
+  bool set_update_point(llvm::Value *enable) {
+    auto constant = llvm::dyn_cast_or_null<llvm::ConstantInt>(enable);
+    if (constant && constant->isZero()) {
+      return false;
+    }
+    if (!enable || constant) {
+      ir_builder.SetInsertPoint(update_reg_end);
+    } else {
+      ir_builder.SetInsertPoint(update_group(enable)->getTerminator());
+    }
+    return true;
+  }
+
+  // Registers are written at the end of the chip function, after all
+  // reads, grouped by their enables. With double buffering reads go to the
+  // current bank and writes to the next one, so they are written right
+  // away instead, and a disabled register is copied to the next bank.
   void visit(ast::RegWrite &rw) override {
     rw.reg->visit(*this);
     auto reg = results_stack.top();
@@ -542,20 +2248,55 @@ struct CodegenVisitor : ast::Visitor {
     rw.rhs->visit(*this);
     auto val = results_stack.top();
     results_stack.pop();
+    llvm::Value *enable = nullptr;
+    if (rw.enable) {
+      rw.enable->visit(*this);
+      enable = results_stack.top();
+      results_stack.pop();
+    }
 
-    auto ip = ir_builder.saveIP();
-    ir_builder.SetInsertPoint(update_reg_block);
+    auto [offset, width] = register_slots[reg];
+    auto is_slice = ast::isa<ast::SliceType>(rw.reg->type);
+    auto is_vector = val->getType()->isVectorTy();
+    if (is_slice && !is_vector && !options.double_buffer) {
+      // The value may point to a register written earlier in update_regs.
+      auto tmp = ir_builder.CreateAlloca(ir_builder.getInt8Ty(),
+                                         ir_builder.getInt32(width));
+      ir_builder.CreateMemCpy(tmp, llvm::MaybeAlign(1), val,
+                              llvm::MaybeAlign(1), width);
+      val = tmp;
+    }
 
-    if (auto st =
-            std::dynamic_pointer_cast<ast::SliceType>(rw.reg->result_type())) {
-      for (size_t i = 0; i < st->size; ++i) {
-        auto slot =
-            ir_builder.CreateConstGEP1_32(ir_builder.getInt8Ty(), reg, i);
-        auto val_slot =
-            ir_builder.CreateConstGEP1_32(ir_builder.getInt8Ty(), val, i);
-        auto val_i = ir_builder.CreateLoad(ir_builder.getInt8Ty(), val_slot);
-        ir_builder.CreateStore(val_i, slot);
+    auto ip = ir_builder.saveIP();
+    if (options.double_buffer) {
+      auto cur = reg;
+      reg = ir_builder.CreateConstGEP1_32(
+          ir_builder.getInt8Ty(), current_function->getArg(2), offset);
+      if (enable) {
+        auto en = ir_builder.CreateICmpNE(
+            enable, llvm::Constant::getNullValue(enable->getType()));
+        if (is_vector) {
+          cur = ir_builder.CreateAlignedLoad(
+              val->getType(),
+              ir_builder.CreateBitCast(cur, val->getType()->getPointerTo()),
+              llvm::MaybeAlign(1));
+        } else if (!is_slice) {
+          cur = ir_builder.CreateLoad(val->getType(), cur);
+        }
+        val = ir_builder.CreateSelect(en, val, cur);
       }
+    } else if (!set_update_point(enable)) {
+      return;
+    }
+
+    auto align = llvm::MaybeAlign(
+        options.align_registers ? RegisterLayout::alignment(width) : 1);
+    if (is_vector) {
+      ir_builder.CreateAlignedStore(
+          val, ir_builder.CreateBitCast(reg, val->getType()->getPointerTo()),
+          align);
+    } else if (is_slice) {
+      ir_builder.CreateMemCpy(reg, align, val, llvm::MaybeAlign(1), width);
     } else {
       ir_builder.CreateStore(val, reg);
     }
@@ -563,11 +2304,103 @@ struct CodegenVisitor : ast::Visitor {
     ir_builder.restoreIP(ip);
   }
 
+  // Packs the wires of a port, one byte each, into an integer.
+  llvm::Value *pack_wires(llvm::Value *val, size_t width) {
+    auto i64 = ir_builder.getInt64Ty();
+    if (width == 1) {
+      return ir_builder.CreateZExt(val, i64);
+    }
+    auto bytes = llvm::FixedVectorType::get(ir_builder.getInt8Ty(), width);
+    if (!val->getType()->isVectorTy()) {
+      val = ir_builder.CreateAlignedLoad(
+          bytes, ir_builder.CreateBitCast(val, bytes->getPointerTo()),
+          llvm::MaybeAlign(1));
+    }
+    auto bits = ir_builder.CreateTrunc(
+        val, llvm::FixedVectorType::get(ir_builder.getInt1Ty(), width));
+    return ir_builder.CreateZExtOrTrunc(
+        ir_builder.CreateBitCast(bits, ir_builder.getIntNTy(width)), i64);
+  }
+
+  // The word at the address is read in place, like a register, and the
+  // write is an update enabled by the write wire. With double buffering it
+  // is stored to both banks, so that they never differ and a cycle does
+  // not copy the whole memory to the next bank.
+  void visit(ast::RamExpr &e) override {
+    auto size = RegisterLayout::ram_size(e);
+    auto offset = layout.place(reg_buf_offset, size,
+                               RegisterLayout::alignment(size));
+
+    std::vector<llvm::Value *> ports;
+    for (auto &port : {e.address, e.data, e.write}) {
+      port->visit(*this);
+      ports.push_back(results_stack.top());
+      results_stack.pop();
+    }
+
+    auto i8 = ir_builder.getInt8Ty();
+    auto address = pack_wires(ports[0], e.address_width());
+    auto write = ports[2];
+    if (size > e.words * e.width) {
+      auto last = ir_builder.getInt64(e.words);
+      auto in_range = ir_builder.CreateICmpULT(address, last);
+      address = ir_builder.CreateSelect(in_range, address, last);
+      write = ir_builder.CreateAnd(
+          ir_builder.CreateICmpNE(write,
+                                  llvm::Constant::getNullValue(i8)),
+          in_range);
+    }
+    auto word_offset = ir_builder.CreateAdd(
+        ir_builder.CreateMul(address, ir_builder.getInt64(e.width)),
+        ir_builder.getInt64(offset));
+    auto word = [&](unsigned arg) {
+      return ir_builder.CreateGEP(i8, current_function->getArg(arg),
+                                  word_offset);
+    };
+
+    auto res = word(1);
+    if (e.width == 1) {
+      results_stack.push(ir_builder.CreateLoad(i8, res));
+    } else {
+      results_stack.push(res);
+    }
+
+    // The data may point to a register or word written earlier in
+    // update_regs.
+    auto data = ports[1];
+    if (e.width > 1) {
+      auto tmp = ir_builder.CreateAlloca(i8, ir_builder.getInt32(e.width));
+      if (data->getType()->isVectorTy()) {
+        auto ptr_type = data->getType()->getPointerTo();
+        ir_builder.CreateAlignedStore(
+            data, ir_builder.CreateBitCast(tmp, ptr_type), llvm::MaybeAlign(1));
+      } else {
+        ir_builder.CreateMemCpy(tmp, llvm::MaybeAlign(1), data,
+                                llvm::MaybeAlign(1), e.width);
+      }
+      data = tmp;
+    }
+
+    auto ip = ir_builder.saveIP();
+    if (!set_update_point(write)) {
+      return;
+    }
+    for (unsigned arg = 1; arg < first_input_arg(); ++arg) {
+      if (e.width == 1) {
+        ir_builder.CreateStore(data, word(arg));
+      } else {
+        ir_builder.CreateMemCpy(word(arg), llvm::MaybeAlign(1), data,
+                                llvm::MaybeAlign(1), e.width);
+      }
+    }
+    ir_builder.restoreIP(ip);
+  }
+
   void visit(ast::RegRead &rr) override {
     rr.reg->visit(*this);
     auto val_ptr = results_stack.top();
     results_stack.pop();
-    if (std::dynamic_pointer_cast<ast::SliceType>(rr.result_type())) {
+    if (ast::isa<ast::SliceType>(rr.reg->type)) {
       results_stack.push(val_ptr);
     } else {
       results_stack.push(
@@ -576,15 +2409,41 @@ struct CodegenVisitor : ast::Visitor {
   }
 };
 
-std::unique_ptr<Module>
-transform_pkg_to_module(std::unique_ptr<llvm::LLVMContext> ctx,
-                        std::shared_ptr<ast::Package> pkg,
-                        std::string entrypoint) {
+IRModule::IRModule(std::unique_ptr<llvm::LLVMContext> ctx,
+                   std::unique_ptr<llvm::Module> module, size_t buf_size)
+    : ctx(std::move(ctx)), module(std::move(module)), buf_size(buf_size) {}
+
+IRModule::~IRModule() = default;
 
-  CodegenVisitor v(ctx.get(), entrypoint);
+std::unique_ptr<IRModule> generate_ir(std::shared_ptr<ast::Package> pkg,
+                                      std::string entrypoint,
+                                      const CodegenOptions &options) {
+  auto ctx = std::make_unique<llvm::LLVMContext>();
+
+  ast::number_symbols(*pkg);
+  CodegenVisitor v(ctx.get(), entrypoint, options);
   v.visit(*pkg);
-  auto size = v.mem_per_chip[entrypoint];
+  auto size = v.buffer_size();
 
-  return std::make_unique<Module>(std::move(v.module), std::move(ctx), size);
+  auto res = std::make_unique<IRModule>(std::move(ctx), std::move(v.module),
+                                        size);
+  if (options.profile || options.trace) {
+    v.collect_instances(v.find_chip(entrypoint)->id, entrypoint, 0, 0,
+                        res->instances);
+  }
+  res->trace_signals = std::move(v.trace_signals);
+  res->lookup_tables = v.lookup_tables.size();
+  res->specializations = v.specializations.size();
+  res->banks = v.bank_offsets();
+  res->inputs_width = v.inputs_width(*v.find_chip(entrypoint));
+  res->outputs_width = v.outputs_width(*v.find_chip(entrypoint));
+  return res;
 }
-} // namespace hdlc::jit
+
+std::unique_ptr<Module> compile_ir(std::unique_ptr<IRModule> ir,
+                                   const ModuleOptions &options) {
+  return std::make_unique<Module>(std::move(ir->module), std::move(ir->ctx),
+                                  ir->buf_size, options);
+}
+
+} // namespace hdlc::jit
\ No newline at end of file
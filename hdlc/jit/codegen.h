@@ -2,13 +2,122 @@
 
 #include "hdlc/ast/ast.h"
 #include "module.h"
+#include "trace.h"
 #include <llvm/IR/LLVMContext.h>
 
+#include <map>
 #include <memory>
+#include <string>
+#include <vector>
 
 namespace hdlc::jit {
-std::unique_ptr<Module>
-transform_pkg_to_module(std::unique_ptr<llvm::LLVMContext> ctx,
-                        std::shared_ptr<ast::Package> pkg,
-                        std::string entrypoint);
-}
+using StimulusFunc = void (*)(void *context, uint64_t cycle, int8_t *inputs);
+// Returns non-zero when the outputs are correct.
+using CheckerFunc = int (*)(void *context, uint64_t cycle, const int8_t *inputs,
+                            const int8_t *outputs);
+
+// Testbench driven by the generated cosim function. Chips are taken from
+// the package and called directly, host callbacks are called through their
+// addresses baked into the code.
+struct CosimOptions {
+  std::string stimulus_chip;
+  std::string checker_chip;
+  StimulusFunc stimulus = nullptr;
+  CheckerFunc checker = nullptr;
+  void *context = nullptr;
+  // Called on every mismatch with the report_ctx argument of cosim,
+  // returns non-zero to stop.
+  CheckerFunc report = nullptr;
+
+  bool enabled() const { return !stimulus_chip.empty() || stimulus; }
+};
+
+// Largest lookup table, 2^16 entries of up to 8 bytes.
+constexpr size_t max_lut_inputs = 16;
+
+struct CodegenOptions {
+  // Count evaluations of every chip instance. The counter is an unaligned
+  // uint64_t at the start of the reg_buf region of the instance.
+  bool profile = false;
+  // Also accumulate cycles spent in every instance, including its
+  // sub-chips, using llvm.readcyclecounter (rdtsc on x86).
+  bool profile_cycles = false;
+  // Record value changes of the ports of the requested chip and of the
+  // registers of all instances into this ring after every run.
+  TraceRing *trace = nullptr;
+  // Align registers and sub-chip regions for vector loads and stores.
+  bool align_registers = true;
+  // Keep two banks of registers and write the next state directly into the
+  // inactive one. The update at the end of a cycle becomes a bank swap.
+  bool double_buffer = false;
+  CosimOptions cosim;
+  // When non-zero, a wire is a word of this many bits, 64 or a multiple of
+  // 64, and every bit evaluates an independent input vector. Ports of the
+  // run function are then arrays of such words. Chips with registers cannot
+  // be compiled in lane mode.
+  size_t lanes = 0;
+  // Register-free chips with at most this many input bits and at most 64
+  // output bits are evaluated by a single load from a table of all their
+  // results, which the init function of the module fills. 0 disables the
+  // tables, which are also not used in lane mode or when profiling. Values
+  // above max_lut_inputs are treated as max_lut_inputs.
+  size_t lut_max_inputs = 0;
+  // Values of inputs of the requested chip, one byte per bit, which run
+  // treats as constants instead of reading them. Calls whose inputs are
+  // partly known this way call clones of the callee with the known bits
+  // folded in, calls of register-free chips whose outputs become known are
+  // left out. Not supported in lane mode.
+  std::map<std::string, std::vector<int8_t>> fixed_inputs;
+  // Slices of at most this many wires are copied wire by wire, wider ones
+  // with a memcpy.
+  size_t unroll_max_width = 16;
+  // Keep the slices built by joins, and slices of them, in vectors instead
+  // of stack arrays. Inputs, call results and registers are still indexed
+  // in memory. Ignored in lane mode.
+  bool ssa_slices = false;
+};
+
+// Chip instance of the flattened design.
+struct ChipInstance {
+  // Slash separated call path from the requested chip, e.g. "Top/p1".
+  std::string path;
+  std::string chip;
+  // Position of the instance's region in reg_buf.
+  size_t offset;
+  // Index of the calling instance, the requested chip is its own parent.
+  size_t parent;
+};
+
+// LLVM IR of a package together with the context owning it.
+struct IRModule {
+  std::unique_ptr<llvm::LLVMContext> ctx;
+  std::unique_ptr<llvm::Module> module;
+  size_t buf_size;
+  // Filled only when profiling or tracing is enabled, in preorder.
+  std::vector<ChipInstance> instances;
+  // Number of input and output bits of the requested chip.
+  size_t inputs_width = 0;
+  size_t outputs_width = 0;
+  // Offsets of the register banks in reg_buf, instance offsets are relative
+  // to these. There are two banks when double buffered.
+  std::vector<size_t> banks;
+  // Traced signals in the order of their ids in TraceRecord.
+  std::vector<TraceSignal> trace_signals;
+  // Number of chips evaluated by table lookups.
+  size_t lookup_tables = 0;
+  // Number of chip functions cloned for known input bits or for the output
+  // bits used at their call sites.
+  size_t specializations = 0;
+
+  IRModule(std::unique_ptr<llvm::LLVMContext> ctx,
+           std::unique_ptr<llvm::Module> module, size_t buf_size);
+  ~IRModule();
+};
+
+std::unique_ptr<IRModule> generate_ir(std::shared_ptr<ast::Package> pkg,
+                                      std::string entrypoint,
+                                      const CodegenOptions &options = {});
+
+std::unique_ptr<Module> compile_ir(std::unique_ptr<IRModule> ir,
+                                   const ModuleOptions &options = {});
+} // namespace hdlc::jit
\ No newline at end of file
@@ -1,26 +1,272 @@
 #include "module.h"
+#include "stats.h"
+
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/ObjectTransformLayer.h>
+#include <llvm/Object/ObjectFile.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <mutex>
 
 namespace hdlc::jit {
 
-Module::Module(std::unique_ptr<llvm::Module> module,
-               std::unique_ptr<llvm::LLVMContext> ctx, size_t buf_size)
-    : buf_size(buf_size) {
+namespace {
+#if LLVM_VERSION_MAJOR >= 14
+using LLVMOptLevel = llvm::OptimizationLevel;
+#else
+using LLVMOptLevel = llvm::PassBuilder::OptimizationLevel;
+#endif
+
+llvm::Expected<std::unique_ptr<llvm::orc::LLJIT>>
+create_jit(llvm::CodeGenOpt::Level level) {
+  static std::once_flag llvm_initialized;
+
+  std::call_once(llvm_initialized, []() {
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+  });
+
+  auto jtmb = llvm::orc::JITTargetMachineBuilder::detectHost();
+  if (!jtmb) {
+    return jtmb.takeError();
+  }
+  jtmb->setCodeGenOptLevel(level);
 
   llvm::orc::LLJITBuilder jit_builder;
-  jit = ExitOnErr(jit_builder.create());
+  jit_builder.setJITTargetMachineBuilder(std::move(*jtmb));
+  auto jit = jit_builder.create();
+  if (!jit) {
+    return jit.takeError();
+  }
+
+  // Wide slice copies may become calls of the C library.
+  auto allowed = [](const llvm::orc::SymbolStringPtr &name) {
+    auto str = *name;
+    str.consume_front("_");
+    return str == "memcpy" || str == "memmove" || str == "memset";
+  };
+  auto generator = llvm::orc::DynamicLibrarySearchGenerator::
+      GetForCurrentProcess((*jit)->getDataLayout().getGlobalPrefix(), allowed);
+  if (!generator) {
+    return generator.takeError();
+  }
+  (*jit)->getMainJITDylib().addGenerator(std::move(*generator));
+  return std::move(*jit);
+}
+
+void optimize_module(llvm::Module &module, const llvm::DataLayout &dl) {
+  module.setDataLayout(dl);
+
+  llvm::LoopAnalysisManager lam;
+  llvm::FunctionAnalysisManager fam;
+  llvm::CGSCCAnalysisManager cgam;
+  llvm::ModuleAnalysisManager mam;
+
+  llvm::PassBuilder pb;
+  pb.registerModuleAnalyses(mam);
+  pb.registerCGSCCAnalyses(cgam);
+  pb.registerFunctionAnalyses(fam);
+  pb.registerLoopAnalyses(lam);
+  pb.crossRegisterProxies(lam, fam, cgam, mam);
+
+  auto mpm = pb.buildPerModuleDefaultPipeline(LLVMOptLevel::O3);
+  mpm.run(module, mam);
+}
+} // namespace
+
+Module::Module(std::unique_ptr<llvm::Module> module,
+               std::unique_ptr<llvm::LLVMContext> ctx, size_t buf_size,
+               const ModuleOptions &options)
+    : buf_size(buf_size), hot_threshold(options.hot_threshold),
+      optimized(false) {
+
+  if (options.opt_level == OptLevel::O3) {
+    jit = ExitOnErr(create_jit(llvm::CodeGenOpt::Aggressive));
+
+    PhaseTimer timer(options.stats, "optimize");
+    optimize_module(*module, jit->getDataLayout());
+    optimized = true;
+
+    auto instructions = module->getInstructionCount();
+    if (options.stats) {
+      options.stats->optimized_ir_instructions = instructions;
+    }
+    timer.finish({{"ir_instructions", instructions}});
+  } else {
+    jit = ExitOnErr(create_jit(llvm::CodeGenOpt::None));
+  }
+
+  if (options.opt_level == OptLevel::Tiered) {
+    tiered = true;
+    llvm::raw_svector_ostream os(bitcode);
+    llvm::WriteBitcodeToFile(*module, os);
+  }
+
+  size_t code_bytes = 0;
+  if (options.stats) {
+    jit->getObjTransformLayer().setTransform(
+        [&code_bytes](std::unique_ptr<llvm::MemoryBuffer> buf)
+            -> llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>> {
+          auto obj = llvm::object::ObjectFile::createObjectFile(
+              buf->getMemBufferRef());
+          if (!obj) {
+            return obj.takeError();
+          }
+          for (auto &section : (*obj)->sections()) {
+            if (section.isText()) {
+              code_bytes += section.getSize();
+            }
+          }
+          return {std::move(buf)};
+        });
+  }
+
+  PhaseTimer timer(options.stats, "materialize");
 
+  bool has_cosim = module->getFunction("cosim");
+  has_init = module->getFunction("init");
   llvm::orc::ThreadSafeModule m(std::move(module), std::move(ctx));
   ExitOnErr(jit->addIRModule(std::move(m)));
+  ExitOnErr(initialize(*jit));
 
   auto f = ExitOnErr(jit->lookup("run"));
 
-  run_func = (decltype(run_func))f.getAddress();
+  run_func = (RunFunc)f.getAddress();
+  if (has_cosim) {
+    cosim_func = (CosimFunc)ExitOnErr(jit->lookup("cosim")).getAddress();
+  }
+
+  if (options.stats) {
+    jit->getObjTransformLayer().setTransform({});
+    options.stats->code_bytes = code_bytes;
+  }
+  timer.finish({{"code_bytes", code_bytes}});
+
+  if (options.opt_level == OptLevel::Tiered && hot_threshold == 0) {
+    tier_up();
+  }
+}
+
+Module::~Module() {
+  canceled.store(true, std::memory_order_relaxed);
+  if (tier_up_thread.joinable()) {
+    tier_up_thread.join();
+  }
+}
+
+void Module::tier_up() {
+  tier_up_thread = std::thread([this]() {
+    if (auto err = compile_optimized()) {
+      // The module keeps running the unoptimized code.
+      llvm::consumeError(std::move(err));
+    }
+    // SmallVector has no shrink_to_fit, swapping frees the buffer.
+    llvm::SmallVector<char, 0>().swap(bitcode);
+  });
+}
+
+llvm::Error Module::compile_optimized() {
+  auto ctx = std::make_unique<llvm::LLVMContext>();
+  llvm::MemoryBufferRef buf(llvm::StringRef(bitcode.data(), bitcode.size()),
+                            "tier_up");
+  auto module = llvm::parseBitcodeFile(buf, *ctx);
+  if (!module) {
+    return module.takeError();
+  }
+  if (canceled.load(std::memory_order_relaxed)) {
+    return llvm::Error::success();
+  }
+
+  auto optimized_code = create_jit(llvm::CodeGenOpt::Aggressive);
+  if (!optimized_code) {
+    return optimized_code.takeError();
+  }
+  optimized_jit = std::move(*optimized_code);
+  optimize_module(**module, optimized_jit->getDataLayout());
+  if (canceled.load(std::memory_order_relaxed)) {
+    return llvm::Error::success();
+  }
+
+  llvm::orc::ThreadSafeModule m(std::move(*module), std::move(ctx));
+  if (auto err = optimized_jit->addIRModule(std::move(m))) {
+    return err;
+  }
+  // Looking up a symbol materializes it, which runs the code generator.
+  auto f = optimized_jit->lookup("run");
+  if (!f) {
+    return f.takeError();
+  }
+  CosimFunc cosim = nullptr;
+  if (cosim_func.load(std::memory_order_relaxed)) {
+    auto sym = optimized_jit->lookup("cosim");
+    if (!sym) {
+      return sym.takeError();
+    }
+    cosim = (CosimFunc)sym->getAddress();
+  }
+  if (canceled.load(std::memory_order_relaxed)) {
+    return llvm::Error::success();
+  }
+  if (auto err = initialize(*optimized_jit)) {
+    return err;
+  }
+
+  // Both tiers are generated from the same IR, so reg_buf layout is
+  // identical and the swap may happen between any two runs.
+  run_func.store((RunFunc)f->getAddress(), std::memory_order_release);
+  if (cosim) {
+    cosim_func.store(cosim, std::memory_order_release);
+  }
+  optimized.store(true, std::memory_order_release);
+  return llvm::Error::success();
+}
+
+llvm::Error Module::initialize(llvm::orc::LLJIT &code) {
+  if (has_init) {
+    auto init = code.lookup("init");
+    if (!init) {
+      return init.takeError();
+    }
+    reinterpret_cast<void (*)()>(init->getAddress())();
+  }
+  return llvm::Error::success();
+}
+
+void Module::count_runs(size_t runs) {
+  if (!tiered) {
+    return;
+  }
+  auto before = run_count.fetch_add(runs, std::memory_order_relaxed);
+  if (before < hot_threshold && before + runs >= hot_threshold) {
+    tier_up();
+  }
 }
 
 void Module::run(int8_t *reg_buf, int8_t *inputs, int8_t *outputs) {
-  run_func(reg_buf, inputs, outputs);
+  count_runs(1);
+  run_func.load(std::memory_order_acquire)(reg_buf, inputs, outputs);
+}
+
+uint64_t Module::cosimulate(int8_t *reg_buf, uint64_t cycles,
+                            void *report_ctx) {
+  count_runs(cycles);
+  return cosim_func.load(std::memory_order_acquire)(reg_buf, cycles,
+                                                    report_ctx);
+}
+
+bool Module::has_testbench() {
+  return cosim_func.load(std::memory_order_relaxed);
 }
 
 size_t Module::buffer_size() { return buf_size; }
 
-} // namespace hdlc::jit
\ No newline at end of file
+bool Module::is_optimized() {
+  return optimized.load(std::memory_order_acquire);
+}
+
+} // namespace hdlc::jit
@@ -1,20 +1,77 @@
 #pragma once
+#include "hdlc/compile_stats.h"
+#include "opt_level.h"
+
+#include <llvm/ADT/SmallVector.h>
 #include <llvm/ExecutionEngine/Orc/LLJIT.h>
 #include <llvm/IR/Module.h>
 
+#include <atomic>
+#include <thread>
+
 namespace hdlc::jit {
+
+struct ModuleOptions {
+  OptLevel opt_level = OptLevel::O0;
+  size_t hot_threshold = 1000;
+  // Receives optimize and materialize phases when set.
+  CompileStats *stats = nullptr;
+};
+
 class Module {
-  void (*run_func)(int8_t *, int8_t *, int8_t *);
+  using RunFunc = void (*)(int8_t *, int8_t *, int8_t *);
+  using CosimFunc = uint64_t (*)(int8_t *, uint64_t, void *);
+
+  std::atomic<RunFunc> run_func;
+  // Null unless the module was generated with a testbench.
+  std::atomic<CosimFunc> cosim_func{nullptr};
   std::unique_ptr<llvm::orc::LLJIT> jit;
   llvm::ExitOnError ExitOnErr;
   size_t buf_size;
 
+  // Tier-up state. The bitcode of the unoptimized module is kept until the
+  // optimized code is swapped in; the optimized jit replaces nothing, it
+  // only provides a new run_func, so code of the first tier stays alive.
+  // Only the tier-up thread touches the bitcode after construction. The
+  // destructor sets canceled and the thread stops after its current step.
+  // Errors leave the module on the first tier.
+  bool tiered = false;
+  llvm::SmallVector<char, 0> bitcode;
+  size_t hot_threshold;
+  // Shared by all forks of a chip, which may run on different threads.
+  std::atomic<size_t> run_count{0};
+  std::thread tier_up_thread;
+  std::unique_ptr<llvm::orc::LLJIT> optimized_jit;
+  std::atomic<bool> optimized;
+  std::atomic<bool> canceled{false};
+
+  // Whether the module has an init function filling its lookup tables,
+  // which every tier runs once before its first run.
+  bool has_init = false;
+  llvm::Error initialize(llvm::orc::LLJIT &code);
+
+  void tier_up();
+  llvm::Error compile_optimized();
+  void count_runs(size_t runs);
+
 public:
   Module(std::unique_ptr<llvm::Module> module,
-         std::unique_ptr<llvm::LLVMContext> ctx, size_t size);
+         std::unique_ptr<llvm::LLVMContext> ctx, size_t size,
+         const ModuleOptions &options = {});
+
+  ~Module();
 
   void run(int8_t *reg_buf, int8_t *inputs, int8_t *outputs);
 
+  // Runs the testbench for the given number of cycles, returns the number
+  // of cycles run before the report callback asked to stop.
+  uint64_t cosimulate(int8_t *reg_buf, uint64_t cycles, void *report_ctx);
+
+  bool has_testbench();
+
   size_t buffer_size();
+
+  // Returns true once run_func points to O3 code.
+  bool is_optimized();
 };
 } // namespace hdlc::jit
@@ -0,0 +1,14 @@
+#pragma once
+
+namespace hdlc::jit {
+
+enum class OptLevel {
+  // Cheap unoptimized build, best for short interactive sessions.
+  O0,
+  // Fully optimized build, best for long batch runs.
+  O3,
+  // Start running the O0 build immediately and switch to an O3 build
+  // compiled in the background once the chip has run hot_threshold times.
+  Tiered,
+};
+} // namespace hdlc::jit
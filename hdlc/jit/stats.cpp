@@ -0,0 +1,33 @@
+#include "stats.h"
+
+#include <sys/resource.h>
+
+namespace hdlc::jit {
+namespace {
+size_t max_rss_kb() {
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  return size_t(usage.ru_maxrss);
+}
+} // namespace
+
+PhaseTimer::PhaseTimer(CompileStats *stats, std::string name)
+    : stats(stats), name(std::move(name)),
+      begin(std::chrono::steady_clock::now()),
+      begin_max_rss_kb(stats ? max_rss_kb() : 0) {}
+
+void PhaseTimer::finish(
+    std::vector<std::pair<std::string, size_t>> counters) {
+  if (!stats) {
+    return;
+  }
+  using us = std::chrono::duration<double, std::micro>;
+  auto end = std::chrono::steady_clock::now();
+
+  auto max_rss = max_rss_kb();
+
+  stats->phases.push_back({name, us(begin - stats->start).count(),
+                           us(end - begin).count(), max_rss,
+                           max_rss - begin_max_rss_kb, std::move(counters)});
+}
+} // namespace hdlc::jit
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "hdlc/compile_stats.h"
+
+namespace hdlc::jit {
+// Measures a single compilation phase and appends it to stats on finish.
+// All methods are no-ops when stats is null.
+class PhaseTimer {
+  CompileStats *stats;
+  std::string name;
+  std::chrono::steady_clock::time_point begin;
+  size_t begin_max_rss_kb;
+
+public:
+  PhaseTimer(CompileStats *stats, std::string name);
+
+  void finish(std::vector<std::pair<std::string, size_t>> counters = {});
+};
+} // namespace hdlc::jit
@@ -0,0 +1,160 @@
+#include "trace.h"
+
+#include <chrono>
+#include <stdexcept>
+
+namespace hdlc::jit {
+
+namespace {
+void wait_for_space(TraceRing *ring) {
+  auto capacity = ring->mask + 1;
+  auto head = ring->head.load(std::memory_order_relaxed);
+  while (capacity - (head - ring->tail.load(std::memory_order_acquire)) <
+         ring->max_records_per_cycle) {
+    std::this_thread::yield();
+  }
+}
+
+std::string vcd_id(size_t idx) {
+  std::string res;
+  do {
+    res.push_back(char('!' + idx % 94));
+    idx /= 94;
+  } while (idx);
+  return res;
+}
+
+std::vector<std::string> split_scope(const std::string &scope) {
+  std::vector<std::string> res;
+  size_t begin = 0;
+  while (true) {
+    auto end = scope.find('/', begin);
+    res.push_back(scope.substr(begin, end - begin));
+    if (end == std::string::npos) {
+      return res;
+    }
+    begin = end + 1;
+  }
+}
+} // namespace
+
+TraceWriter::TraceWriter(const std::string &path) : out(path) {
+  if (!out) {
+    throw std::runtime_error("cannot open " + path);
+  }
+}
+
+TraceWriter::~TraceWriter() {
+  if (thread.joinable()) {
+    stopping = true;
+    thread.join();
+  }
+}
+
+void TraceWriter::start(std::vector<TraceSignal> traced_signals) {
+  signals = std::move(traced_signals);
+
+  size_t bits = 0;
+  for (size_t i = 0; i < signals.size(); ++i) {
+    ids.push_back(vcd_id(i));
+    values.emplace_back(signals[i].width, 'x');
+    bits += signals[i].width;
+  }
+  dirty.resize(signals.size());
+
+  size_t capacity = 1 << 16;
+  while (capacity < 2 * bits) {
+    capacity *= 2;
+  }
+  records.resize(capacity);
+  shadow.resize(bits, 2);
+
+  ring.mask = capacity - 1;
+  ring.records = records.data();
+  ring.shadow = shadow.data();
+  ring.max_records_per_cycle = bits;
+  ring.wait_for_space = wait_for_space;
+
+  write_header();
+  thread = std::thread([this]() {
+    while (!stopping) {
+      if (ring.head.load(std::memory_order_acquire) ==
+          ring.tail.load(std::memory_order_relaxed)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        continue;
+      }
+      drain();
+    }
+    drain();
+    write_cycle();
+    out.flush();
+  });
+}
+
+void TraceWriter::write_header() {
+  out << "$timescale 1ns $end\n";
+
+  std::vector<std::string> scope;
+  for (size_t i = 0; i < signals.size(); ++i) {
+    auto path = split_scope(signals[i].scope);
+    size_t common = 0;
+    while (common < scope.size() && common < path.size() &&
+           scope[common] == path[common]) {
+      common++;
+    }
+    for (size_t j = common; j < scope.size(); ++j) {
+      out << "$upscope $end\n";
+    }
+    for (size_t j = common; j < path.size(); ++j) {
+      out << "$scope module " << path[j] << " $end\n";
+    }
+    scope = std::move(path);
+
+    out << "$var wire " << signals[i].width << " " << ids[i] << " "
+        << signals[i].name;
+    if (signals[i].width > 1) {
+      out << " [" << signals[i].width - 1 << ":0]";
+    }
+    out << " $end\n";
+  }
+  for (size_t j = 0; j < scope.size(); ++j) {
+    out << "$upscope $end\n";
+  }
+  out << "$enddefinitions $end\n";
+}
+
+void TraceWriter::drain() {
+  auto head = ring.head.load(std::memory_order_acquire);
+  auto tail = ring.tail.load(std::memory_order_relaxed);
+  for (; tail != head; ++tail) {
+    auto &r = records[tail & ring.mask];
+    if (r.cycle != current_cycle) {
+      write_cycle();
+      current_cycle = r.cycle;
+    }
+    values[r.signal][r.bit] = char('0' + r.value);
+    if (!dirty[r.signal]) {
+      dirty[r.signal] = true;
+      dirty_signals.push_back(r.signal);
+    }
+  }
+  ring.tail.store(tail, std::memory_order_release);
+}
+
+void TraceWriter::write_cycle() {
+  if (dirty_signals.empty()) {
+    return;
+  }
+  out << "#" << current_cycle << "\n";
+  for (auto s : dirty_signals) {
+    auto &v = values[s];
+    if (v.size() == 1) {
+      out << v << ids[s] << "\n";
+    } else {
+      out << "b" << std::string(v.rbegin(), v.rend()) << " " << ids[s] << "\n";
+    }
+    dirty[s] = false;
+  }
+  dirty_signals.clear();
+}
+} // namespace hdlc::jit
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace hdlc::jit {
+// A single changed bit of a traced signal.
+struct TraceRecord {
+  uint64_t cycle;
+  uint32_t signal;
+  uint16_t bit;
+  uint8_t value;
+  uint8_t pad;
+};
+static_assert(sizeof(TraceRecord) == 16);
+
+// Single producer single consumer ring of value changes. The producer is the
+// generated run function, which accesses the fields by their offsets, and
+// the consumer is the thread of a TraceWriter.
+struct TraceRing {
+  // Written by the producer only, published with release ordering.
+  std::atomic<uint64_t> head{0};
+  uint64_t cycle = 0;
+  uint64_t mask = 0;
+  TraceRecord *records = nullptr;
+  // Last recorded value of every traced bit. Starts out as 2 so that the
+  // first cycle records the initial values.
+  int8_t *shadow = nullptr;
+  // Called by the producer when one more cycle may not fit into the ring.
+  void (*wait_for_space)(TraceRing *) = nullptr;
+  uint64_t max_records_per_cycle = 0;
+  // Written by the consumer only.
+  alignas(64) std::atomic<uint64_t> tail{0};
+};
+
+struct TraceSignal {
+  // Slash separated instance path, e.g. "Top/p1".
+  std::string scope;
+  std::string name;
+  size_t width;
+};
+
+// Drains a TraceRing into a VCD file on a background thread.
+class TraceWriter {
+  TraceRing ring;
+  std::vector<TraceRecord> records;
+  std::vector<int8_t> shadow;
+
+  std::vector<TraceSignal> signals;
+  std::vector<std::string> ids;
+  // Current value of every signal, least significant bit first.
+  std::vector<std::string> values;
+  std::vector<bool> dirty;
+  std::vector<uint32_t> dirty_signals;
+  uint64_t current_cycle = 0;
+
+  std::ofstream out;
+  std::thread thread;
+  std::atomic<bool> stopping{false};
+
+  void write_header();
+  void drain();
+  void write_cycle();
+
+public:
+  explicit TraceWriter(const std::string &path);
+  ~TraceWriter();
+
+  // The ring has to be baked into the generated code before the signals
+  // are known, it is only written to after start.
+  TraceRing *get_ring() { return &ring; }
+
+  void start(std::vector<TraceSignal> traced_signals);
+};
+} // namespace hdlc::jit
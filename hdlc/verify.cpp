@@ -0,0 +1,283 @@
+#include "verify.h"
+#include "hdlc/ast/builtins.h"
+#include "hdlc/ast/parser.h"
+#include "hdlc/jit/codegen.h"
+#include "hdlc/jit/module.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+namespace hdlc {
+
+namespace {
+// Chip compiled in lane mode, every run evaluates lanes input vectors.
+struct LaneChip {
+  std::unique_ptr<jit::Module> module;
+  size_t inputs;
+  size_t outputs;
+
+  // With builtin, the chip is replaced by the builtin of the same name.
+  LaneChip(const std::string &code, const std::string &chip, size_t lanes,
+           bool builtin = false) {
+    auto pkg = ast::parse_package(code, "gates");
+    if (std::none_of(pkg->chips.begin(), pkg->chips.end(),
+                     [&chip](auto &c) { return c->ident == chip; })) {
+      throw std::invalid_argument("unknown chip " + chip);
+    }
+    if (builtin && !ast::replace_with_builtin(*pkg, chip)) {
+      throw std::invalid_argument("no builtin with the ports of chip " + chip);
+    }
+
+    jit::CodegenOptions codegen_options;
+    codegen_options.lanes = lanes;
+    auto ir = jit::generate_ir(pkg, chip, codegen_options);
+    inputs = ir->inputs_width;
+    outputs = ir->outputs_width;
+
+    jit::ModuleOptions module_options;
+    module_options.opt_level = jit::OptLevel::O3;
+    module = jit::compile_ir(std::move(ir), module_options);
+  }
+
+  void run(std::vector<uint64_t> &in, std::vector<uint64_t> &out) {
+    module->run(nullptr, reinterpret_cast<int8_t *>(in.data()),
+                reinterpret_cast<int8_t *>(out.data()));
+  }
+};
+
+// Row indices of the exhaustive enumeration must fit in 64 bits.
+size_t max_exhaustive_inputs(const VerifyOptions &options) {
+  return std::min<size_t>(options.max_exhaustive_inputs, 63);
+}
+
+size_t log2_lanes(size_t lanes) {
+  size_t res = 6;
+  while ((size_t(64) << (res - 6)) < lanes) {
+    res++;
+  }
+  if (lanes < 64 || (size_t(64) << (res - 6)) != lanes) {
+    throw std::invalid_argument("lanes must be a power of two of at least 64");
+  }
+  return res;
+}
+
+// Inputs of block k of the exhaustive enumeration: lane j of word w
+// evaluates row k * lanes + w * 64 + j.
+void fill_exhaustive(std::vector<uint64_t> &in, size_t inputs, size_t words,
+                     size_t log_lanes, uint64_t k) {
+  static const uint64_t patterns[6] = {
+      0xAAAAAAAAAAAAAAAA, 0xCCCCCCCCCCCCCCCC, 0xF0F0F0F0F0F0F0F0,
+      0xFF00FF00FF00FF00, 0xFFFF0000FFFF0000, 0xFFFFFFFF00000000};
+
+  for (size_t i = 0; i < inputs; ++i) {
+    for (size_t w = 0; w < words; ++w) {
+      uint64_t bit;
+      if (i < 6) {
+        in[i * words + w] = patterns[i];
+        continue;
+      }
+      if (i < log_lanes) {
+        bit = (w >> (i - 6)) & 1;
+      } else {
+        bit = (k >> (i - log_lanes)) & 1;
+      }
+      in[i * words + w] = bit ? ~uint64_t(0) : 0;
+    }
+  }
+}
+
+uint64_t splitmix64(uint64_t &state) {
+  uint64_t z = (state += 0x9E3779B97F4A7C15);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+  return z ^ (z >> 31);
+}
+
+void fill_random(std::vector<uint64_t> &in, uint64_t seed, uint64_t k) {
+  uint64_t state = seed ^ (k * 0xD1B54A32D192ED03);
+  for (auto &word : in) {
+    word = splitmix64(state);
+  }
+}
+
+// Calls body(k) for blocks [0, blocks) on the requested number of threads
+// until it returns false. Blocks are started in order, so every block before
+// the one returning false has run. The first exception thrown by body is
+// rethrown on the calling thread.
+template <typename Body>
+uint64_t for_each_block(uint64_t blocks, const VerifyOptions &options,
+                        Body body) {
+  size_t threads = options.threads;
+  if (!threads) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  threads = std::min<uint64_t>(threads, blocks);
+
+  std::atomic<uint64_t> next{0};
+  std::atomic<uint64_t> done{0};
+  std::atomic<bool> stop{false};
+  std::mutex error_mutex;
+  std::exception_ptr error;
+  auto worker = [&]() {
+    while (!stop.load(std::memory_order_relaxed)) {
+      auto k = next.fetch_add(1, std::memory_order_relaxed);
+      if (k >= blocks) {
+        return;
+      }
+      try {
+        if (!body(k)) {
+          stop = true;
+        }
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!error) {
+          error = std::current_exception();
+        }
+        stop = true;
+        return;
+      }
+      done.fetch_add(1, std::memory_order_relaxed);
+    }
+  };
+
+  std::vector<std::thread> pool;
+  for (size_t t = 1; t < threads; ++t) {
+    pool.emplace_back(worker);
+  }
+  worker();
+  for (auto &t : pool) {
+    t.join();
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  return done;
+}
+} // namespace
+
+TruthTable truth_table(const std::string &code, const std::string &chip,
+                       const VerifyOptions &options) {
+  auto log_lanes = log2_lanes(options.lanes);
+  LaneChip lane_chip(code, chip, options.lanes);
+  if (lane_chip.inputs > max_exhaustive_inputs(options)) {
+    throw std::invalid_argument("chip " + chip +
+                                " has too many inputs for a truth table");
+  }
+
+  TruthTable res{lane_chip.inputs, lane_chip.outputs, {}};
+  auto words = options.lanes / 64;
+  auto column_words = std::max<uint64_t>(res.rows() / 64, 1);
+  res.columns.assign(res.outputs, std::vector<uint64_t>(column_words));
+  auto blocks = std::max<uint64_t>(res.rows() >> log_lanes, 1);
+
+  for_each_block(blocks, options, [&](uint64_t k) {
+    std::vector<uint64_t> in(res.inputs * words);
+    std::vector<uint64_t> out(res.outputs * words);
+    fill_exhaustive(in, res.inputs, words, log_lanes, k);
+    lane_chip.run(in, out);
+
+    for (size_t o = 0; o < res.outputs; ++o) {
+      for (size_t w = 0; w < words && k * words + w < column_words; ++w) {
+        res.columns[o][k * words + w] = out[o * words + w];
+      }
+    }
+    return true;
+  });
+  return res;
+}
+
+namespace {
+EquivalenceResult compare(LaneChip &a, LaneChip &b,
+                          const VerifyOptions &options) {
+  auto log_lanes = log2_lanes(options.lanes);
+
+  EquivalenceResult res{true, a.inputs <= max_exhaustive_inputs(options), 0,
+                        {}};
+  auto words = options.lanes / 64;
+  uint64_t vectors = res.exhaustive ? uint64_t(1) << a.inputs
+                                    : std::max<uint64_t>(
+                                          options.random_vectors, 1);
+  auto blocks = std::max<uint64_t>(
+      (vectors + options.lanes - 1) >> log_lanes, 1);
+
+  // Index of the reported counterexample. Blocks finish in any order, the
+  // lowest index is kept so that the result does not depend on the threads.
+  uint64_t first = std::numeric_limits<uint64_t>::max();
+  std::mutex mutex;
+  auto done = for_each_block(blocks, options, [&](uint64_t k) {
+    std::vector<uint64_t> in(a.inputs * words);
+    std::vector<uint64_t> out_a(a.outputs * words);
+    std::vector<uint64_t> out_b(a.outputs * words);
+    if (res.exhaustive) {
+      fill_exhaustive(in, a.inputs, words, log_lanes, k);
+    } else {
+      fill_random(in, options.seed, k);
+    }
+    a.run(in, out_a);
+    b.run(in, out_b);
+
+    for (size_t w = 0; w < words; ++w) {
+      uint64_t diff = 0;
+      for (size_t o = 0; o < a.outputs; ++o) {
+        diff |= out_a[o * words + w] ^ out_b[o * words + w];
+      }
+      if (!diff) {
+        continue;
+      }
+      size_t lane = __builtin_ctzll(diff);
+      uint64_t index = (k << log_lanes) + w * 64 + lane;
+      std::lock_guard<std::mutex> lock(mutex);
+      if (index < first) {
+        first = index;
+        res.equivalent = false;
+        res.counterexample.clear();
+        for (size_t i = 0; i < a.inputs; ++i) {
+          res.counterexample.push_back((in[i * words + w] >> lane) & 1);
+        }
+      }
+      return false;
+    }
+    return true;
+  });
+
+  res.vectors = std::min(vectors, done * options.lanes);
+  return res;
+}
+} // namespace
+
+EquivalenceResult verify_equivalent(const std::string &code_a,
+                                    const std::string &chip_a,
+                                    const std::string &code_b,
+                                    const std::string &chip_b,
+                                    const VerifyOptions &options) {
+  log2_lanes(options.lanes);
+  LaneChip a(code_a, chip_a, options.lanes);
+  LaneChip b(code_b, chip_b, options.lanes);
+  if (a.inputs != b.inputs || a.outputs != b.outputs) {
+    throw std::invalid_argument("chips " + chip_a + " and " + chip_b +
+                                " have different port widths");
+  }
+  return compare(a, b, options);
+}
+
+EquivalenceResult verify_equivalent(const std::string &code,
+                                    const std::string &chip_a,
+                                    const std::string &chip_b,
+                                    const VerifyOptions &options) {
+  return verify_equivalent(code, chip_a, code, chip_b, options);
+}
+
+EquivalenceResult verify_builtin(const std::string &code,
+                                 const std::string &chip,
+                                 const VerifyOptions &options) {
+  log2_lanes(options.lanes);
+  LaneChip a(code, chip, options.lanes);
+  LaneChip b(code, chip, options.lanes, true);
+  return compare(a, b, options);
+}
+} // namespace hdlc
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace hdlc {
+
+struct VerifyOptions {
+  // Input vectors evaluated by a single call, 64 or a multiple of 64.
+  size_t lanes = 512;
+  // Zero means one thread per hardware thread.
+  size_t threads = 0;
+  // Chips with more input bits are checked with random vectors. Values above
+  // 63 are treated as 63.
+  size_t max_exhaustive_inputs = 24;
+  uint64_t random_vectors = uint64_t(1) << 20;
+  uint64_t seed = 0;
+};
+
+// Outputs of a chip for every input vector. Input bit i of row r is bit i
+// of r, inputs and outputs are numbered in the order of the chip's ports.
+struct TruthTable {
+  size_t inputs;
+  size_t outputs;
+  // One bitset over the rows per output.
+  std::vector<std::vector<uint64_t>> columns;
+
+  uint64_t rows() const { return uint64_t(1) << inputs; }
+  bool get(uint64_t row, size_t output) const {
+    return (columns[output][row / 64] >> (row % 64)) & 1;
+  }
+};
+
+struct EquivalenceResult {
+  bool equivalent;
+  // False when only random vectors were checked.
+  bool exhaustive;
+  uint64_t vectors;
+  // Inputs on which the chips differ, one byte per bit.
+  std::vector<int8_t> counterexample;
+};
+
+// Evaluates a register-free chip on all inputs. Throws std::invalid_argument
+// for chips with registers or more than max_exhaustive_inputs inputs.
+TruthTable truth_table(const std::string &code, const std::string &chip,
+                       const VerifyOptions &options = {});
+
+// Checks that two register-free chips with the same port widths compute the
+// same function, exhaustively for small chips and by random sampling for
+// larger ones.
+EquivalenceResult verify_equivalent(const std::string &code_a,
+                                    const std::string &chip_a,
+                                    const std::string &code_b,
+                                    const std::string &chip_b,
+                                    const VerifyOptions &options = {});
+
+EquivalenceResult verify_equivalent(const std::string &code,
+                                    const std::string &chip_a,
+                                    const std::string &chip_b,
+                                    const VerifyOptions &options = {});
+
+// Checks a chip against the builtin of the same name, e.g. an HDL And
+// against the native And. Throws std::invalid_argument if the builtin has
+// different port widths.
+EquivalenceResult verify_builtin(const std::string &code,
+                                 const std::string &chip,
+                                 const VerifyOptions &options = {});
+} // namespace hdlc
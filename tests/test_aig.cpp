@@ -0,0 +1,179 @@
+#include "hdlc/aig/aig.h"
+#include "hdlc/ast/parser.h"
+#include "hdlc/ast/transforms.h"
+#include "hdlc/chip.h"
+#include "hdlc/gen/generator.h"
+#include "hdlc/jit/codegen.h"
+#include "test_designs.h"
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <random>
+#include <sstream>
+
+using namespace hdlc;
+
+namespace {
+// Runs both chips on the same random inputs for a number of cycles.
+void compare_chips(Chip &a, Chip &b, size_t inputs, size_t outputs,
+                   size_t cycles) {
+  std::mt19937_64 rng(cycles);
+  std::vector<int8_t> in(inputs);
+  std::vector<int8_t> out_a(outputs);
+  std::vector<int8_t> out_b(outputs);
+  for (size_t cycle = 0; cycle < cycles; ++cycle) {
+    for (auto &bit : in) {
+      bit = rng() & 1;
+    }
+    a.run(in.data(), out_a.data());
+    b.run(in.data(), out_b.data());
+    ASSERT_EQ(out_a, out_b) << "cycle " << cycle;
+  }
+}
+
+void check_optimized(const gen::Design &design, size_t cycles) {
+  CompileOptions options;
+  options.opt_level = OptLevel::O0;
+  auto reference = create_chip(design.code, design.top, options);
+  options.optimize_aig = true;
+  auto optimized = create_chip(design.code, design.top, options);
+  EXPECT_LE(optimized->compile_stats().gates,
+            reference->compile_stats().gates);
+  compare_chips(*reference, *optimized, design.inputs, design.outputs, cycles);
+}
+} // namespace
+
+TEST(Aig, StructuralHashing) {
+  aig::Aig g;
+  auto a = g.create_input("a");
+  auto b = g.create_input("b");
+  auto ab = g.create_and(a, b);
+  EXPECT_EQ(g.create_and(b, a), ab);
+  EXPECT_EQ(g.create_and(a, a), a);
+  EXPECT_EQ(g.create_and(a, aig::negate(a)), aig::lit_false);
+  EXPECT_EQ(g.create_and(aig::lit_true, b), b);
+  EXPECT_EQ(g.and_count(), 1);
+  EXPECT_EQ(g.node(ab).level, 1);
+}
+
+TEST(Aig, FromPackage) {
+  auto pkg = ast::parse_package(g_code, "gates");
+  auto g = aig::from_package(pkg, "And");
+  EXPECT_EQ(g.and_count(), 1);
+
+  std::ostringstream aag;
+  aig::write_aiger(aag, g, false);
+  EXPECT_EQ(aag.str(), "aag 3 2 0 1 1\n2\n4\n6\n6 4 2\n"
+                       "i0 a\ni1 b\no0 res\nc\nhdlc\n");
+
+  std::ostringstream aig;
+  aig::write_aiger(aig, g);
+  EXPECT_EQ(aig.str(), std::string("aig 3 2 0 1 1\n6\n\x02\x02"
+                                   "i0 a\ni1 b\no0 res\nc\nhdlc\n"));
+
+  g = aig::from_package(pkg, "PrevSlice8");
+  EXPECT_EQ(g.inputs.size(), 8);
+  EXPECT_EQ(g.latches.size(), 8);
+  EXPECT_EQ(g.and_count(), 0);
+  EXPECT_EQ(g.latch_names[5], "PrevSlice8/p2/r[1]");
+  EXPECT_EQ(g.latches[5].next, g.inputs[5] * 2);
+
+  EXPECT_THROW(aig::from_package(pkg, "Missing"), std::invalid_argument);
+}
+
+TEST(Aig, Optimize) {
+  auto design = gen::and_chain(64);
+  auto g = aig::from_package(ast::parse_package(design.code, "gates"),
+                             design.top);
+  EXPECT_EQ(g.and_count(), 63);
+  EXPECT_EQ(g.depth(), 63);
+  aig::optimize(g);
+  EXPECT_EQ(g.and_count(), 63);
+  EXPECT_EQ(g.depth(), 6);
+
+  aig::Aig redundant;
+  auto a = redundant.create_input();
+  auto b = redundant.create_input();
+  auto ab = redundant.create_and(a, b);
+  redundant.outputs.push_back(redundant.create_and(ab, aig::negate(a)));
+  redundant.outputs.push_back(
+      redundant.create_and(aig::negate(ab), a)); // a & !b
+  redundant = aig::rewrite(redundant);
+  EXPECT_EQ(redundant.outputs[0], aig::lit_false);
+  EXPECT_EQ(redundant.and_count(), 1);
+}
+
+TEST(Aig, Cells) {
+  auto design = gen::ripple_carry_adder(8);
+  auto pkg = ast::parse_package(design.code, "gates");
+  ast::insert_casts(pkg);
+  auto g = aig::from_package(pkg, design.top);
+  aig::optimize(g);
+  auto cells = aig::find_cells(g);
+  auto is_add = [](auto &c) { return c.kind == aig::CellKind::Add; };
+  ASSERT_EQ(std::count_if(cells.begin(), cells.end(), is_add), 1);
+  auto &add = *std::find_if(cells.begin(), cells.end(), is_add);
+  EXPECT_EQ(add.outputs.size(), 16);
+  EXPECT_EQ(add.inputs.back(), aig::make_lit(g.inputs[16]));
+
+  // Lane mode evaluates the adder bitwise.
+  aig::replace_chip(pkg, design.top, g, cells);
+  jit::CodegenOptions codegen_options;
+  codegen_options.lanes = 64;
+  auto module =
+      jit::compile_ir(jit::generate_ir(pkg, design.top, codegen_options));
+  std::mt19937_64 rng(8);
+  std::vector<uint64_t> in(17);
+  std::vector<uint64_t> out(9);
+  for (auto &lanes : in) {
+    lanes = rng();
+  }
+  module->run(nullptr, reinterpret_cast<int8_t *>(in.data()),
+              reinterpret_cast<int8_t *>(out.data()));
+  for (size_t lane = 0; lane < 64; ++lane) {
+    auto bits = [lane](const uint64_t *words, size_t n) {
+      uint64_t res = 0;
+      for (size_t i = 0; i < n; ++i) {
+        res |= ((words[i] >> lane) & 1) << i;
+      }
+      return res;
+    };
+    EXPECT_EQ(bits(out.data(), 9),
+              bits(in.data(), 8) + bits(in.data() + 8, 8) +
+                  bits(in.data() + 16, 1))
+        << "lane " << lane;
+  }
+
+  aig::Aig small;
+  auto s = small.create_input();
+  auto t = small.create_input();
+  auto e = small.create_input();
+  auto x = small.create_and(aig::negate(small.create_and(s, t)),
+                            aig::negate(small.create_and(aig::negate(s),
+                                                         aig::negate(t))));
+  auto mux = small.create_or(small.create_and(s, t),
+                             small.create_and(aig::negate(s), e));
+  cells = aig::find_cells(small);
+  ASSERT_EQ(cells.size(), 2);
+  EXPECT_EQ(cells[0].kind, aig::CellKind::Xor);
+  EXPECT_EQ(cells[0].outputs, std::vector<aig::Lit>{x});
+  EXPECT_EQ(cells[1].kind, aig::CellKind::Mux);
+  EXPECT_EQ(cells[1].inputs, (std::vector<aig::Lit>{s, t, e}));
+  EXPECT_EQ(cells[1].outputs, std::vector<aig::Lit>{mux});
+}
+
+TEST(Aig, OptimizedChips) {
+  check_optimized(gen::ripple_carry_adder(16), 256);
+  check_optimized(gen::carry_lookahead_adder(16), 256);
+  check_optimized(gen::array_multiplier(6), 256);
+  check_optimized(gen::register_file(8, 4), 256);
+  check_optimized(gen::shift_register(16), 64);
+
+  CompileOptions options;
+  options.optimize_aig = true;
+  auto chip = create_chip(g_code, "CallArrayOfOne", options);
+  int8_t in = 1;
+  int8_t out = 0;
+  chip->run(&in, &out);
+  EXPECT_EQ(out, 1);
+}
@@ -1,64 +1,17 @@
 #include "gtest_util.h"
+#include "hdlc/async.h"
 #include "hdlc/ast/parser.h"
 #include "hdlc/ast/parser_error.h"
 #include "hdlc/chip.h"
+#include "test_designs.h"
 #include "gtest/gtest.h"
 
-std::string g_code = R"(
-chip And (a, b) res {
-    tmp := Nand(a, b)
-    res := Nand(tmp, tmp)
-    return res
-}
-
-chip And3(a, b, c) res {
-	tmp := And(a, b)
-	res := And(tmp, c)
-	return res
-}
-
-chip And4Way(a[4], b[4]) res[4] {
-  return [
-    And(a[0], b[0]), 
-    And(a[1], b[1]), 
-    And(a[2], b[2]), 
-    And(a[3], b[3])
-  ]
-}
-
-chip StrangeAnd2Way(a[2], b[2]) res[2] {
-  tmp := And4Way([a[0], a[1], a[0], a[1]], [b[0], b[1], b[0], b[1]])
-  return tmp[0:2]
-}
-
-chip ArrayOfOne(a[1]) res[1] {
-  return a
-}
-
-chip CallArrayOfOne(a) res {
-  tmp:= ArrayOfOne([a])
-  return tmp[0]
-}
-
-chip Prev(a) res {
-  r := Register()
-  r <- a
-  return <- r
-}
-
-chip PrevSlice(a[4]) res[4] {
-  r := Register(4)
-  r <- a
-  return <- r
-}
-
-chip PrevSlice8(a[8]) res[8] {
-  p1 := PrevSlice(a[0:4])
-  p2 := PrevSlice(a[4:8])
-
-  return [p1[0], p1[1], p1[2], p1[3], p2[0], p2[1], p2[2], p2[3]]
-}
-)";
+#include <fstream>
+#include <future>
+#include <limits>
+#include <optional>
+#include <sstream>
+#include <thread>
 
 class TestChips : public ::testing::Test {
 protected:
@@ -71,6 +24,18 @@ protected:
       EXPECT_EQ(real_outputs[i], expected_outputs[i]);
     }
   }
+
+  // Counter of a compile phase, 0 if no phase has it.
+  static size_t compile_counter(hdlc::Chip &chip, const std::string &counter) {
+    for (auto &phase : chip.compile_stats().phases) {
+      for (auto &[name, value] : phase.counters) {
+        if (name == counter) {
+          return value;
+        }
+      }
+    }
+    return 0;
+  }
 };
 
 TEST_F(TestChips, And) {
@@ -167,4 +132,1005 @@ TEST_F(TestChips, PrevSlice8) {
   compare_results(*chip, {1, 0, 0, 1, 0, 0, 1, 1}, {1, 0, 1, 0, 0, 1, 1, 1});
   compare_results(*chip, {1, 1, 1, 0, 0, 1, 0, 0}, {1, 0, 0, 1, 0, 0, 1, 1});
   compare_results(*chip, {0, 0, 1, 0, 0, 0, 0, 1}, {1, 1, 1, 0, 0, 1, 0, 0});
-}
\ No newline at end of file
+}
+
+TEST_F(TestChips, NandOutput) {
+  std::string code = R"(
+chip NandOut(a, b) res {
+  res := Nand(a, b)
+  return res
+}
+)";
+  auto chip = hdlc::create_chip(code, "NandOut");
+  compare_results(*chip, {0, 0}, {1});
+  compare_results(*chip, {0, 1}, {1});
+  compare_results(*chip, {1, 0}, {1});
+  compare_results(*chip, {1, 1}, {0});
+}
+
+TEST_F(TestChips, AssignSliceOfRegister) {
+  std::string code = R"(
+chip PrevCopy(a[2]) res[2] {
+  r := Register(2)
+  r <- a
+  cur := <- r
+  return cur
+}
+)";
+  auto chip = hdlc::create_chip(code, "PrevCopy");
+  compare_results(*chip, {1, 0}, {0, 0});
+  compare_results(*chip, {0, 1}, {1, 0});
+  compare_results(*chip, {1, 1}, {0, 1});
+}
+
+TEST_F(TestChips, RegisterWriteCast) {
+  std::string code = R"(
+chip PrevHigh(a[2]) res {
+  r := Register()
+  r <- a[1]
+  return <- r
+}
+)";
+  auto chip = hdlc::create_chip(code, "PrevHigh");
+  compare_results(*chip, {0, 1}, {0});
+  compare_results(*chip, {1, 0}, {1});
+  compare_results(*chip, {0, 0}, {0});
+}
+
+TEST_F(TestChips, UnpackSliceOutput) {
+  std::string code = R"(
+chip Split(a[2], b) x, y[2] {
+  return b, a
+}
+
+chip Swap(a[2], b) res[2] {
+  x, y := Split(a, b)
+  return [y[1], y[0]]
+}
+)";
+  auto chip = hdlc::create_chip(code, "Swap");
+  compare_results(*chip, {1, 0, 0}, {0, 1});
+  compare_results(*chip, {0, 1, 1}, {1, 0});
+}
+
+TEST_F(TestChips, OptLevels) {
+  for (auto level : {hdlc::OptLevel::O0, hdlc::OptLevel::O3}) {
+    hdlc::CompileOptions options;
+    options.opt_level = level;
+    auto chip = hdlc::create_chip(g_code, "And3", options);
+    EXPECT_EQ(chip->is_optimized(), level == hdlc::OptLevel::O3);
+    for (size_t x = 0; x < 8; x++) {
+      char a = x & 1;
+      char b = (x >> 1) & 1;
+      char c = (x >> 2) & 1;
+      compare_results(*chip, {a, b, c}, {a && b && c});
+    }
+  }
+}
+
+TEST_F(TestChips, TieredKeepsRegisterState) {
+  hdlc::CompileOptions options;
+  options.opt_level = hdlc::OptLevel::Tiered;
+  options.hot_threshold = 1;
+  auto chip = hdlc::create_chip(g_code, "PrevSlice8", options);
+
+  std::vector<int8_t> prev(8, 0);
+  size_t runs_after_swap = 0;
+  for (size_t i = 0; i < 1000000 && runs_after_swap < 100; ++i) {
+    if (chip->is_optimized()) {
+      runs_after_swap++;
+    }
+    std::vector<int8_t> inputs;
+    for (size_t offset = 0; offset < 8; ++offset) {
+      inputs.push_back((i >> offset) & 1);
+    }
+    compare_results(*chip, inputs, prev);
+    prev = inputs;
+  }
+  EXPECT_TRUE(chip->is_optimized());
+
+  // Dropping a chip stops its tier-up compile after the current step.
+  options.hot_threshold = 0;
+  chip = hdlc::create_chip(g_code, "PrevSlice8", options);
+  compare_results(*chip, std::vector<int8_t>(8, 1), std::vector<int8_t>(8));
+  chip.reset();
+
+  // Chips stay on the unoptimized build unless asked otherwise.
+  chip = hdlc::create_chip(g_code, "PrevSlice8");
+  for (size_t i = 0; i < 2000; ++i) {
+    compare_results(*chip, std::vector<int8_t>(8), std::vector<int8_t>(8));
+  }
+  EXPECT_FALSE(chip->is_optimized());
+}
+
+TEST_F(TestChips, CompileStats) {
+  hdlc::CompileOptions options;
+  options.opt_level = hdlc::OptLevel::O3;
+  options.chrome_trace_path = ::testing::TempDir() + "compile_trace.json";
+  auto chip = hdlc::create_chip(g_code, "StrangeAnd2Way", options);
+
+  auto &stats = chip->compile_stats();
+  std::vector<std::string> phases;
+  for (auto &p : stats.phases) {
+    phases.push_back(p.name);
+    EXPECT_GE(p.wall_us, 0);
+    EXPECT_GT(p.max_rss_kb, 0u);
+    EXPECT_LE(p.max_rss_growth_kb, p.max_rss_kb);
+  }
+  EXPECT_EQ(phases,
+            std::vector<std::string>({"parse", "insert_casts", "codegen",
+                                      "optimize", "materialize"}));
+  EXPECT_EQ(stats.chips, 10u);
+  EXPECT_EQ(stats.gates, 8u);
+  EXPECT_EQ(hdlc::create_chip(g_code, "PrevSlice8")->compile_stats().registers,
+            8u);
+  // Register bits, not the bytes of the state buffer.
+  hdlc::CompileOptions double_buffer;
+  double_buffer.double_buffer_registers = true;
+  EXPECT_EQ(hdlc::create_chip(g_code, "Prev", double_buffer)
+                ->compile_stats()
+                .registers,
+            1u);
+  EXPECT_GT(stats.ir_instructions, 0u);
+  EXPECT_GT(stats.optimized_ir_instructions, 0u);
+  EXPECT_GT(stats.code_bytes, 0u);
+
+  std::ifstream trace(options.chrome_trace_path);
+  std::stringstream ss;
+  ss << trace.rdbuf();
+  EXPECT_NE(ss.str().find("\"traceEvents\""), std::string::npos);
+  EXPECT_NE(ss.str().find("\"name\": \"materialize\""), std::string::npos);
+}
+
+TEST_F(TestChips, Profile) {
+  hdlc::CompileOptions options;
+  options.opt_level = hdlc::OptLevel::O3;
+  options.profile_cycles = true;
+  auto chip = hdlc::create_chip(g_code, "PrevSlice8", options);
+
+  std::vector<int8_t> prev(8, 0);
+  for (size_t i = 0; i < 10; ++i) {
+    std::vector<int8_t> inputs;
+    for (size_t offset = 0; offset < 8; ++offset) {
+      inputs.push_back(((i * 37) >> offset) & 1);
+    }
+    compare_results(*chip, inputs, prev);
+    prev = inputs;
+  }
+
+  auto profile = chip->profile();
+  ASSERT_EQ(profile.size(), 3u);
+  EXPECT_EQ(profile[0].path, "PrevSlice8");
+  EXPECT_EQ(profile[1].path, "PrevSlice8/p1");
+  EXPECT_EQ(profile[2].path, "PrevSlice8/p2");
+  EXPECT_EQ(profile[1].chip, "PrevSlice");
+  for (auto &entry : profile) {
+    EXPECT_EQ(entry.evaluations, 10u);
+    EXPECT_GT(entry.cycles, 0u);
+  }
+  EXPECT_EQ(profile[0].self_cycles,
+            profile[0].cycles - profile[1].cycles - profile[2].cycles);
+
+  options.profile_cycles = false;
+  options.profile = true;
+  chip = hdlc::create_chip(g_code, "StrangeAnd2Way", options);
+  compare_results(*chip, {1, 1, 1, 0}, {1, 0});
+  profile = chip->profile();
+  ASSERT_EQ(profile.size(), 6u);
+  EXPECT_EQ(profile[1].path, "StrangeAnd2Way/tmp");
+  EXPECT_EQ(profile[5].path, "StrangeAnd2Way/tmp/And#3");
+  EXPECT_EQ(profile[5].evaluations, 1u);
+  EXPECT_EQ(profile[5].cycles, 0u);
+
+  EXPECT_TRUE(hdlc::create_chip(g_code, "And")->profile().empty());
+}
+
+TEST_F(TestChips, Builtins) {
+  const std::string code = R"(
+chip Top(x[16], y[16], c[6]) out[16], zr, ng, sum[16], inc[16], m {
+    o, z, n := ALU(x, y, c[0], c[1], c[2], c[3], c[4], c[5])
+    s := Add16(x, y)
+    i := Inc16(x)
+    return o, z, n, s, i, Mux(c[0], c[1], c[2])
+}
+)";
+  auto alu = [](uint16_t x, uint16_t y, unsigned c) {
+    x = c & 1 ? 0 : x;
+    x = c & 2 ? ~x : x;
+    y = c & 4 ? 0 : y;
+    y = c & 8 ? ~y : y;
+    uint16_t out = c & 16 ? x + y : x & y;
+    return uint16_t(c & 32 ? ~out : out);
+  };
+
+  for (auto opt_level : {hdlc::OptLevel::O0, hdlc::OptLevel::O3}) {
+    hdlc::CompileOptions options;
+    options.opt_level = opt_level;
+    auto chip = hdlc::create_chip(code, "Top", options);
+    uint64_t state = 12345;
+    for (size_t i = 0; i < 100; ++i) {
+      state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+      uint16_t x = state >> 16;
+      uint16_t y = state >> 32;
+      unsigned c = (state >> 58) & 63;
+      std::vector<int8_t> inputs;
+      for (size_t bit = 0; bit < 16; ++bit) {
+        inputs.push_back((x >> bit) & 1);
+      }
+      for (size_t bit = 0; bit < 16; ++bit) {
+        inputs.push_back((y >> bit) & 1);
+      }
+      for (size_t bit = 0; bit < 6; ++bit) {
+        inputs.push_back((c >> bit) & 1);
+      }
+
+      auto out = alu(x, y, c);
+      std::vector<int8_t> expected;
+      for (size_t bit = 0; bit < 16; ++bit) {
+        expected.push_back((out >> bit) & 1);
+      }
+      expected.push_back(out == 0);
+      expected.push_back(out >> 15);
+      for (size_t bit = 0; bit < 16; ++bit) {
+        expected.push_back((uint16_t(x + y) >> bit) & 1);
+      }
+      for (size_t bit = 0; bit < 16; ++bit) {
+        expected.push_back((uint16_t(x + 1) >> bit) & 1);
+      }
+      expected.push_back(c & 4 ? (c >> 1) & 1 : c & 1);
+      compare_results(*chip, inputs, expected);
+    }
+  }
+
+  hdlc::CompileOptions options;
+  options.profile = true;
+  auto chip = hdlc::create_chip(g_code, "StrangeAnd2Way", options);
+  EXPECT_EQ(chip->profile().size(), 6u);
+  options.prefer_builtins = true;
+  chip = hdlc::create_chip(g_code, "StrangeAnd2Way", options);
+  compare_results(*chip, {1, 1, 1, 0}, {1, 0});
+  auto profile = chip->profile();
+  ASSERT_EQ(profile.size(), 2u);
+  EXPECT_EQ(profile[1].chip, "And4Way");
+
+  EXPECT_THROW(hdlc::create_chip("chip Top(a) res {\n  return Missing(a)\n}",
+                                 "Top"),
+               hdlc::ast::ParserError);
+}
+
+TEST_F(TestChips, Trace) {
+  hdlc::CompileOptions options;
+  options.trace_path = ::testing::TempDir() + "prev_slice8.vcd";
+  const size_t cycles = 10000;
+  {
+    auto chip = hdlc::create_chip(g_code, "PrevSlice8", options);
+    std::vector<int8_t> prev(8, 0);
+    for (size_t i = 0; i < cycles; ++i) {
+      std::vector<int8_t> inputs;
+      for (size_t offset = 0; offset < 8; ++offset) {
+        inputs.push_back((i >> offset) & 1);
+      }
+      compare_results(*chip, inputs, prev);
+      prev = inputs;
+    }
+  }
+
+  std::ifstream vcd(options.trace_path);
+  std::string header;
+  std::vector<std::string> lines;
+  for (std::string line; std::getline(vcd, line);) {
+    if (lines.empty() && line != "#0") {
+      header += line + "\n";
+      continue;
+    }
+    lines.push_back(line);
+  }
+  EXPECT_NE(header.find("$scope module p1 $end\n$var wire 4 # r [3:0] $end"),
+            std::string::npos);
+  EXPECT_NE(header.find("$var wire 8 \" out0 [7:0] $end"), std::string::npos);
+
+  // The input changes every cycle, so every cycle has a timestamp followed
+  // by the new value of a.
+  size_t cycle = 0;
+  for (size_t i = 0; i < lines.size(); ++i) {
+    if (lines[i][0] != '#') {
+      continue;
+    }
+    ASSERT_EQ(lines[i], "#" + std::to_string(cycle));
+    std::string a;
+    for (size_t bit = 0; bit < 8; ++bit) {
+      a = char('0' + ((cycle >> bit) & 1)) + a;
+    }
+    ASSERT_EQ(lines[i + 1], "b" + a + " !");
+    cycle++;
+  }
+  EXPECT_EQ(cycle, cycles);
+  EXPECT_EQ(lines.back(), "b1111 #");
+
+  const std::string wide = R"(
+chip Wide(a[65537]) res {
+    return a[0]
+}
+)";
+  options.trace_path = ::testing::TempDir() + "wide.vcd";
+  EXPECT_THROW(hdlc::create_chip(wide, "Wide", options),
+               std::invalid_argument);
+}
+
+TEST_F(TestChips, SnapshotRestoreFork) {
+  auto chip = hdlc::create_chip(g_code, "PrevSlice8");
+  std::vector<int8_t> ones(8, 1), zeros(8, 0), alt{1, 0, 1, 0, 1, 0, 1, 0};
+
+  compare_results(*chip, ones, zeros);
+  auto snapshot = chip->snapshot();
+  EXPECT_EQ(snapshot.size(), 8u);
+
+  compare_results(*chip, zeros, ones);
+  compare_results(*chip, alt, zeros);
+
+  chip->restore(snapshot);
+  compare_results(*chip, zeros, ones);
+  chip->restore(snapshot);
+  compare_results(*chip, alt, ones);
+
+  auto fork = chip->fork();
+  compare_results(*fork, zeros, alt);
+  compare_results(*chip, ones, alt);
+  compare_results(*fork, zeros, zeros);
+  compare_results(*chip, ones, ones);
+
+  EXPECT_THROW(hdlc::create_chip(g_code, "Prev")->restore(snapshot),
+               std::invalid_argument);
+  // Same design and size, but separately compiled code.
+  EXPECT_THROW(hdlc::create_chip(g_code, "PrevSlice8")->restore(snapshot),
+               std::invalid_argument);
+  EXPECT_THROW(chip->restore(hdlc::Snapshot()), std::invalid_argument);
+  // Forks share the code and accept each other's snapshots.
+  fork->restore(snapshot);
+  compare_results(*fork, zeros, ones);
+
+  hdlc::CompileOptions options;
+  options.trace_path = ::testing::TempDir() + "fork.vcd";
+  EXPECT_THROW(hdlc::create_chip(g_code, "Prev", options)->fork(),
+               std::logic_error);
+}
+
+TEST_F(TestChips, ConcurrentStates) {
+  hdlc::CompileOptions options;
+  options.hot_threshold = 50;
+  auto chip = hdlc::create_chip(g_code, "PrevSlice8", options);
+  auto fork = chip->fork();
+
+  std::vector<std::thread> threads;
+  std::vector<size_t> failures(8);
+  for (size_t t = 0; t < failures.size(); ++t) {
+    threads.emplace_back([&, t]() {
+      auto &c = t % 2 ? *fork : *chip;
+      auto state = c.make_state();
+      std::vector<int8_t> prev(8, 0);
+      std::vector<int8_t> outputs(8);
+      for (size_t i = 0; i < 500; ++i) {
+        std::vector<int8_t> inputs;
+        for (size_t offset = 0; offset < 8; ++offset) {
+          inputs.push_back(((i * 29 + t) >> offset) & 1);
+        }
+        c.run(state, inputs.data(), outputs.data());
+        failures[t] += outputs != prev;
+        prev = inputs;
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  for (auto f : failures) {
+    EXPECT_EQ(f, 0u);
+  }
+
+  // The chip's own state is not affected.
+  compare_results(*chip, std::vector<int8_t>(8, 1), std::vector<int8_t>(8));
+
+  auto other = hdlc::create_chip(g_code, "PrevSlice8");
+  auto state = other->make_state();
+  std::vector<int8_t> inputs(8), outputs(8);
+  EXPECT_THROW(chip->run(state, inputs.data(), outputs.data()),
+               std::invalid_argument);
+  hdlc::ChipState empty;
+  EXPECT_THROW(chip->run(empty, inputs.data(), outputs.data()),
+               std::invalid_argument);
+
+  // A state outliving its chip is not taken for the state of a chip
+  // compiled later, even at the same address.
+  other.reset();
+  auto prev = hdlc::create_chip(g_code, "Prev");
+  EXPECT_THROW(prev->run(state, inputs.data(), outputs.data()),
+               std::invalid_argument);
+  other = hdlc::create_chip(g_code, "PrevSlice8");
+  EXPECT_THROW(other->run(state, inputs.data(), outputs.data()),
+               std::invalid_argument);
+
+  options.trace_path = ::testing::TempDir() + "state.vcd";
+  EXPECT_THROW(hdlc::create_chip(g_code, "Prev", options)->make_state(),
+               std::logic_error);
+}
+
+TEST_F(TestChips, ConcurrentCreate) {
+  std::vector<std::thread> threads;
+  std::vector<std::shared_ptr<hdlc::Chip>> chips(4);
+  for (size_t t = 0; t < chips.size(); ++t) {
+    threads.emplace_back([&, t]() {
+      hdlc::CompileOptions options;
+      options.opt_level = t % 2 ? hdlc::OptLevel::O3 : hdlc::OptLevel::O0;
+      chips[t] = hdlc::create_chip(g_code, "And3", options);
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  for (auto &chip : chips) {
+    compare_results(*chip, {1, 1, 1}, {1});
+    compare_results(*chip, {1, 0, 1}, {0});
+  }
+}
+
+// Coroutine handle calling a function on resume.
+struct Resumer {
+  std::function<void()> on_resume;
+  void resume() { on_resume(); }
+};
+
+TEST_F(TestChips, Async) {
+  auto future = hdlc::create_chip_async(g_code, "And3");
+  compare_results(*future.get(), {1, 1, 1}, {1});
+  EXPECT_TRUE(future.ready());
+  EXPECT_FALSE(future.cancel());
+  EXPECT_FALSE(future.await_suspend(Resumer{}));
+
+  auto error = hdlc::create_chip_async("chip X() { return Y() }", "X");
+  EXPECT_THROW(error.get(), hdlc::ast::ParserError);
+
+  // The only thread is held by the callback of a compile, retried until
+  // the callback is registered before the compile finishes.
+  std::promise<void> blocked;
+  std::promise<void> release;
+  std::promise<void> finished;
+  std::vector<std::string> order;
+  auto hold = [&]() {
+    blocked.set_value();
+    release.get_future().wait();
+    order.push_back("And");
+  };
+  hdlc::CompilePool pool(1, 3);
+  while (!pool.submit(g_code, "And").await_suspend(Resumer{hold})) {
+  }
+  blocked.get_future().wait();
+
+  auto low = pool.submit(g_code, "And3", {}, std::numeric_limits<int>::min());
+  auto normal = pool.submit(g_code, "Prev", {}, 0);
+  auto high = pool.submit(g_code, "ArrayOfOne", {}, 1);
+  auto canceled = pool.submit(g_code, "PrevSlice", {}, 1);
+  EXPECT_TRUE(normal.cancel());
+  EXPECT_FALSE(normal.cancel());
+  EXPECT_THROW(normal.get(), hdlc::CompileCanceled);
+  canceled = pool.submit(g_code, "PrevSlice", {}, 1);
+  auto rejected =
+      pool.submit(g_code, "And4Way", {}, std::numeric_limits<int>::max());
+  EXPECT_THROW(rejected.get(), hdlc::CompileCanceled);
+
+  EXPECT_FALSE(high.await_ready());
+  EXPECT_TRUE(high.await_suspend(
+      Resumer{[&]() { order.push_back("ArrayOfOne"); }}));
+  EXPECT_TRUE(low.await_suspend(Resumer{[&]() {
+    order.push_back("And3");
+    finished.set_value();
+  }}));
+  EXPECT_TRUE(canceled.cancel());
+  release.set_value();
+
+  compare_results(*high.get(), {1}, {1});
+  compare_results(*low.await_resume(), {1, 1, 0}, {0});
+  finished.get_future().wait();
+  EXPECT_EQ(order, (std::vector<std::string>{"And", "ArrayOfOne", "And3"}));
+
+  // Destroying the pool cancels the queued compile, which releases the
+  // running one.
+  std::promise<void> holding;
+  std::promise<void> stop;
+  std::optional<hdlc::ChipFuture> dropped;
+  {
+    hdlc::CompilePool stopping(1);
+    auto wait = [&]() {
+      holding.set_value();
+      stop.get_future().wait();
+    };
+    while (!stopping.submit(g_code, "And").await_suspend(Resumer{wait})) {
+    }
+    holding.get_future().wait();
+    dropped = stopping.submit(g_code, "Prev");
+    EXPECT_TRUE(dropped->await_suspend(Resumer{[&]() { stop.set_value(); }}));
+  }
+  EXPECT_THROW(dropped->get(), hdlc::CompileCanceled);
+}
+
+TEST_F(TestChips, LookupTables) {
+  auto lookup_tables = [](hdlc::Chip &chip) {
+    return compile_counter(chip, "lookup_tables");
+  };
+
+  for (auto level : {hdlc::OptLevel::O0, hdlc::OptLevel::O3,
+                     hdlc::OptLevel::Tiered}) {
+    hdlc::CompileOptions options;
+    options.opt_level = level;
+    options.hot_threshold = 4;
+    options.lut_max_inputs = 4;
+
+    auto and3 = hdlc::create_chip(g_code, "And3", options);
+    // And, And3, StrangeAnd2Way, ArrayOfOne and CallArrayOfOne.
+    EXPECT_EQ(lookup_tables(*and3), 5u);
+    for (size_t x = 0; x < 8; x++) {
+      char a = x & 1;
+      char b = (x >> 1) & 1;
+      char c = (x >> 2) & 1;
+      compare_results(*and3, {a, b, c}, {a && b && c});
+    }
+
+    auto strange = hdlc::create_chip(g_code, "StrangeAnd2Way", options);
+    compare_results(*strange, {1, 1, 0, 1}, {0, 1});
+    compare_results(*strange, {1, 0, 1, 1}, {1, 0});
+
+    options.double_buffer_registers = true;
+    auto chip = hdlc::create_chip(g_code, "PrevSlice8", options);
+    std::vector<int8_t> prev(8, 0);
+    for (size_t i = 0; i < 20; ++i) {
+      std::vector<int8_t> inputs;
+      for (size_t offset = 0; offset < 8; ++offset) {
+        inputs.push_back(((i * 29) >> offset) & 1);
+      }
+      compare_results(*chip, inputs, prev);
+      prev = inputs;
+    }
+
+    options.profile = true;
+    EXPECT_EQ(lookup_tables(*hdlc::create_chip(g_code, "And3", options)), 0u);
+  }
+
+  hdlc::CompileOptions options;
+  options.lut_max_inputs = 16;
+  // And4Way has 8 inputs.
+  EXPECT_EQ(lookup_tables(*hdlc::create_chip(g_code, "And3", options)), 6u);
+  for (size_t max_inputs : {17, 64}) {
+    options.lut_max_inputs = max_inputs;
+    EXPECT_THROW(hdlc::create_chip(g_code, "And3", options),
+                 std::invalid_argument);
+  }
+}
+
+TEST_F(TestChips, FixedInputs) {
+  for (auto level : {hdlc::OptLevel::O0, hdlc::OptLevel::O3,
+                     hdlc::OptLevel::Tiered}) {
+    for (auto prefer_builtins : {false, true}) {
+      hdlc::CompileOptions options;
+      options.opt_level = level;
+      options.prefer_builtins = prefer_builtins;
+      // Tiered chips recompile their bitcode right away.
+      options.hot_threshold = 0;
+
+      // The passed value of a fixed input is ignored.
+      options.fixed_inputs = {{"c", {0}}};
+      auto and3 = hdlc::create_chip(g_code, "And3", options);
+      compare_results(*and3, {1, 1, 1}, {0});
+      options.fixed_inputs = {{"c", {1}}};
+      and3 = hdlc::create_chip(g_code, "And3", options);
+      for (size_t x = 0; x < 8; x++) {
+        char a = x & 1;
+        char b = (x >> 1) & 1;
+        compare_results(*and3, {a, b, 0}, {a && b});
+      }
+
+      options.fixed_inputs = {{"b", {1, 0}}};
+      auto strange = hdlc::create_chip(g_code, "StrangeAnd2Way", options);
+      compare_results(*strange, {1, 1, 0, 0}, {1, 0});
+      compare_results(*strange, {0, 1, 1, 1}, {0, 0});
+      if (!prefer_builtins) {
+        // StrangeAnd2Way, And4Way for b and for the two used outputs, And
+        // with b = 0 and b = 1.
+        EXPECT_EQ(compile_counter(*strange, "specializations"), 5u);
+      }
+
+      options.fixed_inputs = {{"a", {1, 0, 1, 1, 0, 0, 1, 0}}};
+      auto chip = hdlc::create_chip(g_code, "PrevSlice8", options);
+      compare_results(*chip, std::vector<int8_t>(8), std::vector<int8_t>(8));
+      compare_results(*chip, std::vector<int8_t>(8),
+                      {1, 0, 1, 1, 0, 0, 1, 0});
+    }
+  }
+
+  hdlc::CompileOptions options;
+  options.fixed_inputs = {{"d", {0}}};
+  EXPECT_THROW(hdlc::create_chip(g_code, "And3", options),
+               std::invalid_argument);
+  options.fixed_inputs = {{"a", {0, 1}}};
+  EXPECT_THROW(hdlc::create_chip(g_code, "And3", options),
+               std::invalid_argument);
+}
+
+TEST_F(TestChips, WideSlices) {
+  const std::string code = R"(
+chip Echo(a[1024]) res[1024] {
+  return a
+}
+
+chip Wide(a[1024]) res[1024] {
+  e := Echo(a)
+  r := Register(1024)
+  r <- e
+  return <- r
+}
+)";
+  std::vector<int8_t> inputs;
+  for (size_t i = 0; i < 1024; ++i) {
+    inputs.push_back((i * 7 / 3) & 1);
+  }
+
+  std::vector<size_t> instructions;
+  for (size_t unroll : {16, 4096}) {
+    hdlc::CompileOptions options;
+    options.opt_level = hdlc::OptLevel::O0;
+    options.unroll_max_width = unroll;
+    auto chip = hdlc::create_chip(code, "Wide", options);
+    compare_results(*chip, inputs, std::vector<int8_t>(1024));
+    compare_results(*chip, std::vector<int8_t>(1024), inputs);
+    instructions.push_back(chip->compile_stats().ir_instructions);
+  }
+  // The code of copies does not grow with their width.
+  EXPECT_LT(instructions[0], 100u);
+  EXPECT_GT(instructions[1], 4096u);
+}
+
+TEST_F(TestChips, SsaSlices) {
+  const std::string code = R"(
+chip Swap(a[4]) res[4] {
+  j := [a[2], a[3], a[0], a[1]]
+  return j
+}
+
+chip Mix(a[4], b) res[4], y {
+  s := Swap([a[0], b, a[2], a[3]])
+  j := [s[1], s[0], And(s[3], b), s[2]]
+  k := j[1:3]
+  r := Register(4)
+  r <- [k[0], k[1], j[0], b]
+  return <- r, k[1]
+}
+)";
+  for (auto level : {hdlc::OptLevel::O0, hdlc::OptLevel::O3}) {
+    for (auto double_buffer : {false, true}) {
+      hdlc::CompileOptions options;
+      options.opt_level = level;
+      options.double_buffer_registers = double_buffer;
+      auto expected = hdlc::create_chip(g_code + code, "Mix", options);
+      options.ssa_slices = true;
+      auto chip = hdlc::create_chip(g_code + code, "Mix", options);
+      options.fixed_inputs = {{"b", {1}}};
+      auto fixed = hdlc::create_chip(g_code + code, "Mix", options);
+
+      for (size_t i = 0; i < 32; ++i) {
+        std::vector<int8_t> inputs;
+        for (size_t bit = 0; bit < 5; ++bit) {
+          inputs.push_back(((i * 13) >> bit) & 1);
+        }
+        std::vector<int8_t> outputs(5);
+        expected->run(inputs.data(), outputs.data());
+        compare_results(*chip, inputs, outputs);
+      }
+      options.ssa_slices = false;
+      options.fixed_inputs = {};
+      expected = hdlc::create_chip(g_code + code, "Mix", options);
+      for (size_t i = 0; i < 16; ++i) {
+        std::vector<int8_t> inputs;
+        for (size_t bit = 0; bit < 4; ++bit) {
+          inputs.push_back(((i * 7) >> bit) & 1);
+        }
+        inputs.push_back(1);
+        std::vector<int8_t> outputs(5);
+        expected->run(inputs.data(), outputs.data());
+        inputs.back() = 0;
+        compare_results(*fixed, inputs, outputs);
+      }
+    }
+  }
+}
+
+TEST_F(TestChips, RegisterLayouts) {
+  const std::string pipe_code = R"(
+chip Pipe(a[2]) res[4] {
+  r1 := Register(2)
+  r2 := Register(2)
+  r1 <- a
+  r2 <- <- r1
+  x := <- r1
+  y := <- r2
+  return [x[0], x[1], y[0], y[1]]
+}
+)";
+
+  for (auto level : {hdlc::OptLevel::O0, hdlc::OptLevel::O3}) {
+    for (bool align : {false, true}) {
+      for (bool double_buffer : {false, true}) {
+        hdlc::CompileOptions options;
+        options.opt_level = level;
+        options.align_registers = align;
+        options.double_buffer_registers = double_buffer;
+        options.profile = true;
+
+        auto pipe = hdlc::create_chip(pipe_code, "Pipe", options);
+        compare_results(*pipe, {1, 0}, {0, 0, 0, 0});
+        compare_results(*pipe, {0, 1}, {1, 0, 0, 0});
+        compare_results(*pipe, {1, 1}, {0, 1, 1, 0});
+        compare_results(*pipe, {0, 0}, {1, 1, 0, 1});
+
+        auto chip = hdlc::create_chip(g_code, "PrevSlice8", options);
+        std::vector<int8_t> prev(8, 0);
+        for (size_t i = 0; i < 100; ++i) {
+          std::vector<int8_t> inputs;
+          for (size_t offset = 0; offset < 8; ++offset) {
+            inputs.push_back(((i * 29) >> offset) & 1);
+          }
+          compare_results(*chip, inputs, prev);
+          prev = inputs;
+        }
+        for (auto &entry : chip->profile()) {
+          EXPECT_EQ(entry.evaluations, 100u);
+        }
+      }
+    }
+  }
+}
+
+TEST_F(TestChips, Ram) {
+  const std::string code = R"(
+chip Mem(addr[15], in[16], load) out[16] {
+  out := RAM(32768, 16)(addr, in, load)
+  return out
+}
+
+chip Small(addr[2], in, load) out {
+  return RAM(3, 1)(addr, in, load)
+}
+)";
+  for (auto level : {hdlc::OptLevel::O0, hdlc::OptLevel::O3,
+                     hdlc::OptLevel::Tiered}) {
+    for (bool double_buffer : {false, true}) {
+      hdlc::CompileOptions options;
+      options.opt_level = level;
+      options.double_buffer_registers = double_buffer;
+
+      auto mem = hdlc::create_chip(code, "Mem", options);
+      // The memory takes no code per word.
+      EXPECT_LT(mem->compile_stats().ir_instructions, 500u);
+      std::vector<uint16_t> model(32768);
+      for (size_t i = 0; i < 300; ++i) {
+        size_t addr = (i * 7919) % 32768;
+        if (i % 3 == 2) {
+          addr = ((i - 1) * 7919) % 32768;
+        }
+        uint16_t value = uint16_t(i * 40503);
+        bool load = i % 2 == 0;
+        std::vector<int8_t> inputs;
+        for (size_t bit = 0; bit < 15; ++bit) {
+          inputs.push_back((addr >> bit) & 1);
+        }
+        for (size_t bit = 0; bit < 16; ++bit) {
+          inputs.push_back((value >> bit) & 1);
+        }
+        inputs.push_back(load);
+        std::vector<int8_t> expected;
+        for (size_t bit = 0; bit < 16; ++bit) {
+          expected.push_back((model[addr] >> bit) & 1);
+        }
+        compare_results(*mem, inputs, expected);
+        if (load) {
+          model[addr] = value;
+        }
+      }
+
+      // Address 3 is past the last word, it reads 0 and is not written.
+      auto small = hdlc::create_chip(code, "Small", options);
+      compare_results(*small, {1, 1, 1, 1}, {0});
+      compare_results(*small, {1, 1, 1, 0}, {0});
+      compare_results(*small, {0, 1, 1, 1}, {0});
+      compare_results(*small, {0, 1, 0, 0}, {1});
+      compare_results(*small, {0, 0, 0, 0}, {0});
+    }
+  }
+}
+
+TEST_F(TestChips, RegisterEnables) {
+  const std::string code = R"(
+chip Counter(a[2], en, load) res[2], y, z {
+  r := Register(2)
+  c := Register()
+  d := Register()
+  x := <- r
+  r <- a if load
+  c <- Nand(<- c, <- c) if en
+  d <- x[1] if And(en, load)
+  return x, <- c, <- d
+}
+)";
+  auto run_model = [this](hdlc::Chip &chip) {
+    int r = 0;
+    int c = 0;
+    int d = 0;
+    for (size_t i = 0; i < 64; ++i) {
+      int a = int(i * 5 / 3) & 3;
+      int en = (i * 7 / 4) & 1;
+      int load = (i / 3) & 1;
+      compare_results(chip, {int8_t(a & 1), int8_t(a >> 1), int8_t(en),
+                             int8_t(load)},
+                      {int8_t(r & 1), int8_t(r >> 1), int8_t(c), int8_t(d)});
+      auto x = r;
+      if (load) {
+        r = a;
+      }
+      if (en) {
+        c = !c;
+      }
+      if (en && load) {
+        d = x >> 1;
+      }
+    }
+  };
+  for (auto level : {hdlc::OptLevel::O0, hdlc::OptLevel::O3,
+                     hdlc::OptLevel::Tiered}) {
+    for (bool double_buffer : {false, true}) {
+      for (bool ssa : {false, true}) {
+        hdlc::CompileOptions options;
+        options.opt_level = level;
+        options.double_buffer_registers = double_buffer;
+        options.ssa_slices = ssa;
+        auto chip = hdlc::create_chip(g_code + code, "Counter", options);
+        run_model(*chip);
+      }
+    }
+  }
+  hdlc::CompileOptions options;
+  options.optimize_aig = true;
+  auto chip = hdlc::create_chip(g_code + code, "Counter", options);
+  run_model(*chip);
+
+  // A constant enable leaves out the write or the branch.
+  options = {};
+  options.fixed_inputs = {{"en", {0}}};
+  chip = hdlc::create_chip(g_code + code, "Counter", options);
+  compare_results(*chip, {1, 1, 1, 1}, {0, 0, 0, 0});
+  compare_results(*chip, {0, 0, 1, 1}, {1, 1, 0, 0});
+}
+
+TEST_F(TestChips, Cosimulate) {
+  const std::string code = g_code + R"(
+chip Not(a) res {
+  res := Nand(a, a)
+  return res
+}
+
+chip Xnor(a, b) res {
+  n := Nand(a, b)
+  x := Nand(a, n)
+  y := Nand(b, n)
+  res := Nand(x, y)
+  return Not(res)
+}
+
+chip Johnson() res[8] {
+  r := Register(8)
+  x := <- r
+  r <- [Not(x[7]), x[0], x[1], x[2], x[3], x[4], x[5], x[6]]
+  return x
+}
+
+chip CheckPrev(a[8], res[8]) ok {
+  p := Register(8)
+  p <- a
+  q := <- p
+  e1 := And(And(Xnor(q[0], res[0]), Xnor(q[1], res[1])),
+            And(Xnor(q[2], res[2]), Xnor(q[3], res[3])))
+  e2 := And(And(Xnor(q[4], res[4]), Xnor(q[5], res[5])),
+            And(Xnor(q[6], res[6]), Xnor(q[7], res[7])))
+  ok := And(e1, e2)
+  return ok
+}
+)";
+
+  for (bool double_buffer : {false, true}) {
+    hdlc::CompileOptions options;
+    options.opt_level = hdlc::OptLevel::O3;
+    options.double_buffer_registers = double_buffer;
+    options.testbench.stimulus_chip = "Johnson";
+    options.testbench.checker_chip = "CheckPrev";
+    auto chip = hdlc::create_chip(code, "PrevSlice8", options);
+    auto res = chip->cosimulate(1000);
+    EXPECT_EQ(res.cycles, 1000u);
+    EXPECT_TRUE(res.mismatches.empty());
+  }
+
+  struct Context {
+    std::vector<std::vector<int8_t>> inputs;
+  } context;
+
+  hdlc::CompileOptions options;
+  options.testbench.context = &context;
+  options.testbench.stimulus = [](void *ctx, uint64_t cycle, int8_t *inputs) {
+    for (size_t i = 0; i < 8; ++i) {
+      inputs[i] = ((cycle * 37) >> i) & 1;
+    }
+    static_cast<Context *>(ctx)->inputs.emplace_back(inputs, inputs + 8);
+  };
+  // Claims a mismatch every tenth cycle.
+  options.testbench.checker = [](void *, uint64_t cycle, const int8_t *,
+                                 const int8_t *) { return int(cycle % 10); };
+  auto chip = hdlc::create_chip(code, "PrevSlice8", options);
+
+  auto res = chip->cosimulate(100, 0);
+  EXPECT_EQ(res.cycles, 100u);
+  ASSERT_EQ(res.mismatches.size(), 10u);
+  EXPECT_EQ(res.mismatches[3].cycle, 30u);
+  EXPECT_EQ(res.mismatches[3].inputs, context.inputs[30]);
+  EXPECT_EQ(res.mismatches[3].outputs, context.inputs[29]);
+
+  res = chip->cosimulate(100, 2);
+  EXPECT_EQ(res.cycles, 11u);
+  EXPECT_EQ(res.mismatches.size(), 2u);
+  compare_results(*chip, std::vector<int8_t>(8, 0), context.inputs.back());
+
+  EXPECT_THROW(hdlc::create_chip(code, "PrevSlice8")->cosimulate(1),
+               std::logic_error);
+  options = {};
+  options.testbench.stimulus_chip = "Johnson";
+  EXPECT_THROW(hdlc::create_chip(code, "StrangeAnd2Way", options),
+               std::invalid_argument);
+  options = {};
+  options.testbench.checker_chip = "CheckPrev";
+  EXPECT_THROW(hdlc::create_chip(code, "PrevSlice8", options),
+               std::invalid_argument);
+}
+
+TEST_F(TestChips, CosimulateMismatch) {
+  const std::string code = g_code + R"(
+chip Not(a) res {
+  res := Nand(a, a)
+  return res
+}
+
+chip Johnson() res[8] {
+  r := Register(8)
+  x := <- r
+  r <- [Not(x[7]), x[0], x[1], x[2], x[3], x[4], x[5], x[6]]
+  return x
+}
+
+chip CheckZero(a[8], res[8]) ok {
+  return Not(res[0])
+}
+)";
+
+  // PrevSlice8 outputs the Johnson state of the previous cycle, whose
+  // lowest bit is 1 from cycle 2 to 9.
+  for (bool double_buffer : {false, true}) {
+    hdlc::CompileOptions options;
+    options.double_buffer_registers = double_buffer;
+    options.testbench.stimulus_chip = "Johnson";
+    options.testbench.checker_chip = "CheckZero";
+    auto chip = hdlc::create_chip(code, "PrevSlice8", options);
+
+    auto res = chip->cosimulate(16, 0);
+    EXPECT_EQ(res.cycles, 16u);
+    ASSERT_EQ(res.mismatches.size(), 8u);
+    EXPECT_EQ(res.mismatches[0].cycle, 2u);
+    EXPECT_EQ(res.mismatches[0].inputs,
+              std::vector<int8_t>({1, 1, 0, 0, 0, 0, 0, 0}));
+    EXPECT_EQ(res.mismatches[0].outputs,
+              std::vector<int8_t>({1, 0, 0, 0, 0, 0, 0, 0}));
+    EXPECT_EQ(res.mismatches[7].cycle, 9u);
+  }
+}
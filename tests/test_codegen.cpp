@@ -0,0 +1,179 @@
+#include "hdlc/ast/parser.h"
+#include "hdlc/ast/transforms.h"
+#include "hdlc/jit/codegen.h"
+#include "test_designs.h"
+#include "gtest/gtest.h"
+
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/raw_ostream.h>
+
+using namespace hdlc;
+
+namespace {
+std::unique_ptr<jit::IRModule> generate(const std::string &code,
+                                        const std::string &top,
+                                        const jit::CodegenOptions &options) {
+  auto pkg = ast::parse_package(code, "gates");
+  ast::insert_casts(pkg);
+  return jit::generate_ir(pkg, top, options);
+}
+} // namespace
+
+TEST(Codegen, Effects) {
+  auto ir = generate(g_code, "PrevSlice8", {});
+  auto &m = *ir->module;
+
+  for (auto name : {"Nand", "And", "And4Way", "Prev", "PrevSlice8"}) {
+    auto f = m.getFunction(name);
+    ASSERT_TRUE(f) << name;
+    EXPECT_TRUE(f->doesNotThrow()) << name;
+    EXPECT_TRUE(f->willReturn()) << name;
+    EXPECT_TRUE(f->onlyAccessesArgMemory()) << name;
+    EXPECT_TRUE(f->hasParamAttribute(0, llvm::Attribute::NoAlias)) << name;
+  }
+  EXPECT_TRUE(m.getFunction("Nand")->hasFnAttribute(
+      llvm::Attribute::AlwaysInline));
+  EXPECT_TRUE(
+      m.getFunction("And")->hasFnAttribute(llvm::Attribute::InlineHint));
+  EXPECT_FALSE(
+      m.getFunction("Prev")->hasFnAttribute(llvm::Attribute::InlineHint));
+
+  // Slice inputs are only read.
+  auto and4 = m.getFunction("And4Way");
+  EXPECT_TRUE(and4->hasParamAttribute(2, llvm::Attribute::ReadOnly));
+  EXPECT_TRUE(and4->hasParamAttribute(3, llvm::Attribute::NoAlias));
+
+  // Lookup tables and the cycle counter are memory of their own.
+  jit::CodegenOptions options;
+  options.lut_max_inputs = 2;
+  ir = generate(g_code, "And3", options);
+  EXPECT_FALSE(ir->module->getFunction("And")->onlyAccessesArgMemory());
+  EXPECT_FALSE(ir->module->getFunction("And3")->onlyAccessesArgMemory());
+  EXPECT_TRUE(ir->module->getFunction("And.eval")->onlyAccessesArgMemory());
+
+  options = {};
+  options.profile = true;
+  options.profile_cycles = true;
+  ir = generate(g_code, "And3", options);
+  EXPECT_FALSE(ir->module->getFunction("And3")->onlyAccessesArgMemory());
+  EXPECT_FALSE(
+      ir->module->getFunction("And")->hasFnAttribute(
+          llvm::Attribute::InlineHint));
+}
+
+TEST(Codegen, FixedInputs) {
+  jit::CodegenOptions options;
+  options.fixed_inputs = {{"c", {0}}};
+  auto ir = generate(g_code, "And3", options);
+  EXPECT_FALSE(llvm::verifyModule(*ir->module, &llvm::errs()));
+  // And(tmp, 0) and And3 are 0 for any tmp, so run calls nothing.
+  EXPECT_TRUE(ir->module->getFunction("And.x.0"));
+  auto clone = ir->module->getFunction("And3.x.x.0");
+  ASSERT_TRUE(clone);
+  for (auto &bb : *ir->module->getFunction("run")) {
+    for (auto &inst : bb) {
+      EXPECT_FALSE(llvm::isa<llvm::CallInst>(inst));
+    }
+  }
+  EXPECT_TRUE(clone->use_empty());
+}
+
+TEST(Codegen, LiveOutputs) {
+  auto ir = generate(g_code, "StrangeAnd2Way", {});
+  auto &m = *ir->module;
+  EXPECT_FALSE(llvm::verifyModule(m, &llvm::errs()));
+  EXPECT_EQ(ir->specializations, 1u);
+
+  auto calls = [](llvm::Function &f) {
+    std::vector<std::string> res;
+    for (auto &bb : f) {
+      for (auto &inst : bb) {
+        if (auto call = llvm::dyn_cast<llvm::CallInst>(&inst)) {
+          res.push_back(call->getCalledFunction()->getName().str());
+        }
+      }
+    }
+    return res;
+  };
+  // Only the first two bits of And4Way are used.
+  EXPECT_EQ(calls(*m.getFunction("StrangeAnd2Way")),
+            std::vector<std::string>{"And4Way.o1100"});
+  EXPECT_EQ(calls(*m.getFunction("And4Way.o1100")),
+            std::vector<std::string>({"And", "And"}));
+  EXPECT_EQ(calls(*m.getFunction("And4Way")).size(), 4u);
+
+  // Registers are written even if the outputs are unused.
+  auto pipe = R"(
+chip Pipe(a[2]) res {
+  p := PrevSlice([a[0], a[1], a[0], a[1]])
+  return p[3]
+}
+)";
+  ir = generate(g_code + pipe, "Pipe", {});
+  EXPECT_FALSE(llvm::verifyModule(*ir->module, &llvm::errs()));
+  EXPECT_EQ(calls(*ir->module->getFunction("Pipe")),
+            std::vector<std::string>{"PrevSlice.o0001"});
+}
+
+TEST(Codegen, SsaSlices) {
+  auto allocas = [](llvm::Function &f) {
+    size_t res = 0;
+    for (auto &bb : f) {
+      for (auto &inst : bb) {
+        res += llvm::isa<llvm::AllocaInst>(inst);
+      }
+    }
+    return res;
+  };
+
+  jit::CodegenOptions options;
+  auto ir = generate(g_code, "PrevSlice8", options);
+  // Results of the two calls and the joined result.
+  EXPECT_EQ(allocas(*ir->module->getFunction("PrevSlice8")), 3u);
+
+  options.ssa_slices = true;
+  ir = generate(g_code, "PrevSlice8", options);
+  EXPECT_FALSE(llvm::verifyModule(*ir->module, &llvm::errs()));
+  EXPECT_EQ(allocas(*ir->module->getFunction("PrevSlice8")), 2u);
+  // Joins passed to a sub-chip are stored to the stack.
+  EXPECT_EQ(allocas(*ir->module->getFunction("StrangeAnd2Way")), 3u);
+}
+
+TEST(Codegen, RegisterEnables) {
+  const std::string code = R"(
+chip Bank(a[4], b, en, load) res[4], y {
+  r1 := Register(4)
+  r2 := Register()
+  r3 := Register()
+  m := RAM(4, 1)([a[0], a[1]], b, load)
+  r1 <- a if en
+  r2 <- b if load
+  r3 <- m if en
+  return <- r1, And(<- r2, <- r3)
+}
+)";
+  auto branches = [](llvm::Function &f) {
+    size_t res = 0;
+    for (auto &bb : f) {
+      if (auto br = llvm::dyn_cast<llvm::BranchInst>(bb.getTerminator())) {
+        res += br->isConditional();
+      }
+    }
+    return res;
+  };
+
+  // One branch per enable, shared with the write of the RAM.
+  jit::CodegenOptions options;
+  auto ir = generate(g_code + code, "Bank", options);
+  EXPECT_FALSE(llvm::verifyModule(*ir->module, &llvm::errs()));
+  EXPECT_EQ(branches(*ir->module->getFunction("Bank")), 2u);
+
+  // Disabled registers are copied to the next bank.
+  options.double_buffer = true;
+  ir = generate(g_code + code, "Bank", options);
+  EXPECT_FALSE(llvm::verifyModule(*ir->module, &llvm::errs()));
+  EXPECT_EQ(branches(*ir->module->getFunction("Bank")), 1u);
+}
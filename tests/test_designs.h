@@ -0,0 +1,60 @@
+#pragma once
+
+#include <string>
+
+// Chips shared by the tests and the benchmarks.
+inline const std::string g_code = R"(
+chip And (a, b) res {
+    tmp := Nand(a, b)
+    res := Nand(tmp, tmp)
+    return res
+}
+
+chip And3(a, b, c) res {
+	tmp := And(a, b)
+	res := And(tmp, c)
+	return res
+}
+
+chip And4Way(a[4], b[4]) res[4] {
+  return [
+    And(a[0], b[0]), 
+    And(a[1], b[1]), 
+    And(a[2], b[2]), 
+    And(a[3], b[3])
+  ]
+}
+
+chip StrangeAnd2Way(a[2], b[2]) res[2] {
+  tmp := And4Way([a[0], a[1], a[0], a[1]], [b[0], b[1], b[0], b[1]])
+  return tmp[0:2]
+}
+
+chip ArrayOfOne(a[1]) res[1] {
+  return a
+}
+
+chip CallArrayOfOne(a) res {
+  tmp:= ArrayOfOne([a])
+  return tmp[0]
+}
+
+chip Prev(a) res {
+  r := Register()
+  r <- a
+  return <- r
+}
+
+chip PrevSlice(a[4]) res[4] {
+  r := Register(4)
+  r <- a
+  return <- r
+}
+
+chip PrevSlice8(a[8]) res[8] {
+  p1 := PrevSlice(a[0:4])
+  p2 := PrevSlice(a[4:8])
+
+  return [p1[0], p1[1], p1[2], p1[3], p2[0], p2[1], p2[2], p2[3]]
+}
+)";
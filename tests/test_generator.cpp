@@ -0,0 +1,148 @@
+#include "hdlc/chip.h"
+#include "hdlc/gen/generator.h"
+#include "gtest/gtest.h"
+
+#include <random>
+
+using namespace hdlc;
+
+namespace {
+void push_bits(std::vector<int8_t> &bits, uint64_t value, size_t width) {
+  for (size_t i = 0; i < width; ++i) {
+    bits.push_back((value >> i) & 1);
+  }
+}
+
+uint64_t pop_bits(const std::vector<int8_t> &bits, size_t begin,
+                  size_t width) {
+  uint64_t res = 0;
+  for (size_t i = 0; i < width; ++i) {
+    EXPECT_TRUE(bits[begin + i] == 0 || bits[begin + i] == 1);
+    res |= uint64_t(bits[begin + i]) << i;
+  }
+  return res;
+}
+
+void check_adder(const gen::Design &design, size_t width) {
+  auto chip = create_chip(design.code, design.top);
+  std::mt19937_64 rng(width);
+  const uint64_t mask = (uint64_t(1) << width) - 1;
+
+  for (size_t i = 0; i < 256; ++i) {
+    auto a = rng() & mask;
+    auto b = rng() & mask;
+    auto cin = rng() & 1;
+
+    std::vector<int8_t> inputs;
+    push_bits(inputs, a, width);
+    push_bits(inputs, b, width);
+    push_bits(inputs, cin, 1);
+    std::vector<int8_t> outputs(design.outputs);
+    chip->run(inputs.data(), outputs.data());
+
+    EXPECT_EQ(pop_bits(outputs, 0, width + 1), a + b + cin);
+  }
+}
+} // namespace
+
+TEST(Generator, RippleCarryAdder) {
+  for (size_t width : {1, 4, 13, 32}) {
+    check_adder(gen::ripple_carry_adder(width), width);
+  }
+}
+
+TEST(Generator, CarryLookaheadAdder) {
+  for (size_t width : {1, 4, 13, 32}) {
+    check_adder(gen::carry_lookahead_adder(width), width);
+  }
+}
+
+TEST(Generator, ArrayMultiplier) {
+  const size_t width = 4;
+  auto design = gen::array_multiplier(width);
+  auto chip = create_chip(design.code, design.top);
+
+  for (uint64_t a = 0; a < 16; ++a) {
+    for (uint64_t b = 0; b < 16; ++b) {
+      std::vector<int8_t> inputs;
+      push_bits(inputs, a, width);
+      push_bits(inputs, b, width);
+      std::vector<int8_t> outputs(design.outputs);
+      chip->run(inputs.data(), outputs.data());
+
+      EXPECT_EQ(pop_bits(outputs, 0, 2 * width), a * b);
+    }
+  }
+}
+
+TEST(Generator, RegisterFile) {
+  const size_t entries = 8;
+  const size_t width = 4;
+  auto design = gen::register_file(entries, width);
+  auto chip = create_chip(design.code, design.top);
+
+  auto run = [&](uint64_t in, bool load, uint64_t addr) {
+    std::vector<int8_t> inputs;
+    push_bits(inputs, in, width);
+    push_bits(inputs, load, 1);
+    push_bits(inputs, addr, 3);
+    std::vector<int8_t> outputs(design.outputs);
+    chip->run(inputs.data(), outputs.data());
+    return pop_bits(outputs, 0, width);
+  };
+
+  for (uint64_t e = 0; e < entries; ++e) {
+    run(e + 5, true, e);
+  }
+  for (uint64_t e = 0; e < entries; ++e) {
+    EXPECT_EQ(run(0, false, e), (e + 5) & 15);
+  }
+}
+
+TEST(Generator, ShiftRegister) {
+  const size_t length = 5;
+  auto design = gen::shift_register(length);
+
+  for (bool double_buffer : {false, true}) {
+    CompileOptions options;
+    options.opt_level = OptLevel::O3;
+    options.double_buffer_registers = double_buffer;
+    auto chip = create_chip(design.code, design.top, options);
+
+    std::vector<int8_t> history;
+    for (size_t cycle = 0; cycle < 20; ++cycle) {
+      std::vector<int8_t> inputs{int8_t(cycle % 3 == 0)};
+      std::vector<int8_t> outputs(length);
+      chip->run(inputs.data(), outputs.data());
+
+      for (size_t i = 0; i < length; ++i) {
+        auto expected = cycle > i ? history[cycle - i - 1] : 0;
+        EXPECT_EQ(outputs[i], expected);
+      }
+      history.push_back(inputs[0]);
+    }
+  }
+}
+
+TEST(Generator, NandDagIsDeterministic) {
+  gen::NandDagOptions options;
+  options.inputs = 8;
+  options.depth = 12;
+  options.width = 6;
+  options.seed = 42;
+
+  auto design = gen::nand_dag(options);
+  EXPECT_EQ(design.code, gen::nand_dag(options).code);
+
+  options.seed = 43;
+  EXPECT_NE(design.code, gen::nand_dag(options).code);
+
+  auto chip = create_chip(design.code, design.top);
+  for (uint64_t x = 0; x < 256; ++x) {
+    std::vector<int8_t> inputs;
+    push_bits(inputs, x, options.inputs);
+    std::vector<int8_t> outputs(design.outputs);
+    chip->run(inputs.data(), outputs.data());
+    pop_bits(outputs, 0, options.width);
+  }
+}
@@ -1,8 +1,10 @@
 #include "gtest_util.h"
 #include "hdlc/ast/parser.h"
 #include "hdlc/ast/parser_error.h"
+#include "hdlc/ast/transforms.h"
 #include "gtest/gtest.h"
 #include <sstream>
+#include <stdexcept>
 
 using namespace hdlc;
 
@@ -74,6 +76,63 @@ chip And(a, b, c) res {
       "Parser error: chip with name And already declared (line 7, pos 0)");
 }
 
+TEST(ParsePackage, DefinitionAfterBuiltinCall) {
+  std::string code = R"(
+chip Not (a) res {
+    return Nand(a, a)
+}
+
+chip And3 (a, b, c) res {
+    return And(And(a, b), c)
+}
+
+chip And (a, b) res {
+    return Not(Nand(a, b))
+}
+)";
+  auto pkg = ast::parse_package(code, "test_pkg");
+  std::vector<std::string> names;
+  for (auto &chip : pkg->chips) {
+    names.push_back(chip->ident);
+  }
+  // The definition takes the place of the builtin, before its first caller.
+  EXPECT_EQ(names, (std::vector<std::string>{"Nand", "Not", "And", "And3"}));
+  EXPECT_FALSE(pkg->chips[2]->builtin);
+
+  // Different ports.
+  EXPECT_THROW_WITH_MESSAGE(
+      ast::parse_package(R"(
+chip And3 (a, b, c) res {
+    return And(And(a, b), c)
+}
+
+chip And (a, b, c) res {
+    return Nand(a, b)
+}
+)",
+                         "test_pkg"),
+      ast::ParserError,
+      "Parser error: chip with name And already declared as a builtin by an "
+      "earlier call (line 5, pos 0)");
+
+  // A chip declared after the first call.
+  EXPECT_THROW(ast::parse_package(R"(
+chip And3 (a, b, c) res {
+    return And(And(a, b), c)
+}
+
+chip Not (a) res {
+    return Nand(a, a)
+}
+
+chip And (a, b) res {
+    return Not(Nand(a, b))
+}
+)",
+                                  "test_pkg"),
+               ast::ParserError);
+}
+
 TEST(ParserPackage, HaveNoReturnError) {
   GTEST_SKIP();
   std::string code = R"(
@@ -153,6 +212,66 @@ chip And4Way (a[4], b[4], ) res[4], {
   EXPECT_EQ(expected_result, ss.str());
 }
 
+TEST(ParsePackage, Symbols) {
+  std::string code = R"(
+chip And (a, b) res {
+    tmp := Nand(a, b)
+    res := Nand(tmp, tmp)
+    return res
+}
+
+chip And3(a, b, c) res {
+    tmp := And(a, b)
+    res := And(tmp, c)
+    return res
+})";
+
+  auto pkg = ast::parse_package(code, "test_pkg");
+  ast::number_symbols(*pkg);
+  auto &symbols = pkg->symbols;
+  ASSERT_EQ(pkg->chips.size(), 3);
+  for (auto &chip : pkg->chips) {
+    EXPECT_EQ(symbols.find(chip->ident), chip->id);
+    EXPECT_EQ(symbols.name(chip->id), chip->ident);
+  }
+  EXPECT_EQ(symbols.find("missing"), ast::Symbols::none);
+  // Names shared by both chips, like tmp, are interned once.
+  EXPECT_EQ(symbols.intern("tmp"), symbols.find("tmp"));
+
+  auto &and3 = *pkg->chips[2];
+  EXPECT_EQ(and3.value_count, 5);
+  for (uint32_t i = 0; i < and3.inputs.size(); ++i) {
+    EXPECT_EQ(and3.inputs[i]->id, i);
+  }
+  auto stmt = std::dynamic_pointer_cast<ast::AssignStmt>(and3.body[1]);
+  ASSERT_TRUE(stmt);
+  EXPECT_EQ(stmt->assignees[0]->id, 4);
+  auto call = std::dynamic_pointer_cast<ast::CallExpr>(stmt->rhs);
+  ASSERT_TRUE(call);
+  EXPECT_EQ(call->chip_id, symbols.find("And"));
+}
+
+TEST(ParsePackage, Kinds) {
+  std::string code = R"(
+chip Low (a[2]) res {
+    return a[0]
+})";
+
+  auto pkg = ast::parse_package(code, "test_pkg");
+  auto &chip = *pkg->chips.back();
+  EXPECT_TRUE(ast::isa<ast::SliceType>(chip.inputs[0]->type));
+  EXPECT_FALSE(ast::isa<ast::WireType>(chip.inputs[0]->type));
+  EXPECT_EQ(ast::dyn_cast<ast::TupleType>(chip.inputs[0]->type), nullptr);
+
+  auto ret = std::dynamic_pointer_cast<ast::RetStmt>(chip.body[0]);
+  ASSERT_TRUE(ret);
+  auto cast = ast::dyn_cast<ast::CastExpr>(ret->results[0]);
+  ASSERT_TRUE(cast);
+  EXPECT_TRUE(ast::isa<ast::SliceToWireCast>(cast));
+  EXPECT_FALSE(ast::isa<ast::TupleToWireCast>(cast));
+  EXPECT_TRUE(ast::isa<ast::SliceIdxExpr>(cast->expr));
+}
+
 TEST(RegistersTest, CreateAssignReadNoSlices) {
   std::string code = R"(
 chip Prev (a) res {
@@ -179,6 +298,130 @@ chip Prev (a, ) res, {
   EXPECT_EQ(expected_result, ss.str());
 }
 
+TEST(RegistersTest, Enable) {
+  std::string code = R"(
+chip Hold (a, en) res {
+    r := Register()
+    r <- a if en
+    return <- r
+}
+)";
+
+  std::string expected_result = R"(Package: test_pkg
+
+chip Hold (a, en, ) res, {
+    r, := Register()
+    r <- a if en
+    return <- r, 
+}
+
+)";
+
+  auto pkg = ast::parse_package(code, "test_pkg");
+  std::stringstream ss;
+  ast::print_package(ss, pkg);
+
+  EXPECT_EQ(expected_result, ss.str());
+}
+
+TEST(RegistersTest, IfOnNextLine) {
+  std::string code = R"(
+chip Hold (a, b) res {
+    r := Register()
+    r <- a
+    if := Nand(a, b)
+    return if
+}
+)";
+  std::string expected_result = R"(Package: test_pkg
+
+chip Hold (a, b, ) res, {
+    r, := Register()
+    r <- a
+    if, := Nand(a, b, )
+    return if, 
+}
+
+)";
+  auto pkg = ast::parse_package(code, "test_pkg");
+  std::stringstream ss;
+  ast::print_package(ss, pkg);
+  EXPECT_EQ(expected_result, ss.str());
+
+  code = R"(
+chip Hold (a, b) res {
+    r := Register()
+    if := Register()
+    r <- a
+    if <- b
+    return <- if
+}
+)";
+  expected_result = R"(Package: test_pkg
+
+chip Hold (a, b, ) res, {
+    r, := Register()
+    if, := Register()
+    r <- a
+    if <- b
+    return <- if, 
+}
+
+)";
+  pkg = ast::parse_package(code, "test_pkg");
+  ss.str("");
+  ast::print_package(ss, pkg);
+  EXPECT_EQ(expected_result, ss.str());
+}
+
+TEST(RegistersTest, Ram) {
+  std::string code = R"(
+chip Mem (a[3], d[4], w) res[4] {
+    res := RAM(8, 4)(a, d, w)
+    return res
+}
+)";
+
+  std::string expected_result = R"(Package: test_pkg
+
+chip Mem (a[3], d[4], w, ) res[4], {
+    res, := RAM(8, 4)(a, d, w)
+    return res, 
+}
+
+)";
+
+  auto pkg = ast::parse_package(code, "test_pkg");
+  std::stringstream ss;
+  ast::print_package(ss, pkg);
+
+  EXPECT_EQ(expected_result, ss.str());
+
+  EXPECT_THROW(ast::parse_package(R"(
+chip Mem (a, d, w) res {
+    return RAM(0, 1)(a, d, w)
+}
+)",
+                                  "test_pkg"),
+               ast::ParserError);
+
+  // Data and address must have the widths of the RAM.
+  EXPECT_THROW(ast::parse_package(R"(
+chip Mem (a[3], d[2], w) res[4] {
+    return RAM(8, 4)(a, d, w)
+}
+)",
+                                  "test_pkg"),
+               std::invalid_argument);
+  EXPECT_THROW(ast::parse_package(R"(
+chip Mem (a[2], d[4], w) res[4] {
+    return RAM(8, 4)(a, d, w)
+}
+)",
+                                  "test_pkg"),
+               std::invalid_argument);
+}
+
 TEST(RegistersTest, MultipleAssignee) {
   GTEST_SKIP();
   std::string code = R"(
@@ -0,0 +1,182 @@
+#include "hdlc/gen/generator.h"
+#include "hdlc/verify.h"
+#include "test_designs.h"
+#include "gtest/gtest.h"
+
+#include <stdexcept>
+
+using namespace hdlc;
+
+namespace {
+const std::string g_alternatives = R"(
+chip Nand2(a, b) res {
+    tmp := Nand(a, b)
+    res := Nand(tmp, tmp)
+    return res
+}
+
+chip And(a, b) res {
+    na := Nand(a, a)
+    a2 := Nand(na, na)
+    tmp := Nand(a2, b)
+    res := Nand(tmp, tmp)
+    return res
+}
+
+chip Or(a, b) res {
+    na := Nand(a, a)
+    nb := Nand(b, b)
+    res := Nand(na, nb)
+    return res
+}
+)";
+} // namespace
+
+TEST(Verify, TruthTable) {
+  auto table = truth_table(g_code, "And");
+  EXPECT_EQ(table.inputs, 2);
+  EXPECT_EQ(table.outputs, 1);
+  for (uint64_t row = 0; row < table.rows(); ++row) {
+    EXPECT_EQ(table.get(row, 0), row == 3);
+  }
+
+  VerifyOptions options;
+  options.lanes = 64;
+  options.threads = 2;
+  table = truth_table(g_code, "And4Way", options);
+  EXPECT_EQ(table.inputs, 8);
+  EXPECT_EQ(table.outputs, 4);
+  for (uint64_t row = 0; row < table.rows(); ++row) {
+    auto res = row & (row >> 4);
+    for (size_t bit = 0; bit < 4; ++bit) {
+      EXPECT_EQ(table.get(row, bit), (res >> bit) & 1);
+    }
+  }
+
+  options.max_exhaustive_inputs = 4;
+  EXPECT_THROW(truth_table(g_code, "And4Way", options), std::invalid_argument);
+  EXPECT_THROW(truth_table(g_code, "Missing"), std::invalid_argument);
+}
+
+TEST(Verify, Equivalent) {
+  auto res = verify_equivalent(g_code, "And", g_alternatives, "And");
+  EXPECT_TRUE(res.equivalent);
+  EXPECT_TRUE(res.exhaustive);
+  EXPECT_EQ(res.vectors, 4);
+
+  res = verify_equivalent(g_alternatives, "Nand2", "And");
+  EXPECT_TRUE(res.equivalent);
+
+  EXPECT_THROW(verify_equivalent(g_code, "And", "And4Way"),
+               std::invalid_argument);
+}
+
+TEST(Verify, Counterexample) {
+  auto res = verify_equivalent(g_alternatives, "And", "Or");
+  EXPECT_FALSE(res.equivalent);
+  ASSERT_EQ(res.counterexample.size(), 2);
+  EXPECT_NE(res.counterexample[0], res.counterexample[1]);
+}
+
+TEST(Verify, FirstCounterexample) {
+  const std::string code = g_code + R"(
+chip High(a[16]) res {
+    return a[15]
+}
+
+chip HighAnd(a[16]) res {
+    return And(a[14], a[15])
+}
+)";
+  // The chips differ from row 2^15 on, in blocks run by different threads.
+  VerifyOptions options;
+  options.lanes = 64;
+  options.threads = 4;
+  std::vector<int8_t> expected(16);
+  expected[15] = 1;
+  for (int i = 0; i < 8; ++i) {
+    auto res = verify_equivalent(code, "High", "HighAnd", options);
+    EXPECT_FALSE(res.equivalent);
+    EXPECT_TRUE(res.exhaustive);
+    EXPECT_EQ(res.counterexample, expected);
+  }
+}
+
+TEST(Verify, WideExhaustive) {
+  const std::string code = g_code + R"(
+chip Wide(a[64]) res {
+    return a[63]
+}
+)";
+  VerifyOptions options;
+  options.max_exhaustive_inputs = 64;
+  options.random_vectors = 1 << 10;
+  auto res = verify_equivalent(code, "Wide", "Wide", options);
+  EXPECT_TRUE(res.equivalent);
+  EXPECT_FALSE(res.exhaustive);
+  EXPECT_EQ(res.vectors, 1 << 10);
+  EXPECT_THROW(truth_table(code, "Wide", options), std::invalid_argument);
+}
+
+TEST(Verify, Builtins) {
+  EXPECT_TRUE(verify_builtin(g_code, "And").equivalent);
+  EXPECT_TRUE(verify_builtin(g_alternatives, "Or").equivalent);
+
+  // And is defined after a call bound the builtin.
+  const std::string late = R"(
+chip And3(a, b, c) res {
+    return And(And(a, b), c)
+}
+
+chip And(a, b) res {
+    tmp := Nand(a, b)
+    return Nand(tmp, tmp)
+}
+)";
+  EXPECT_TRUE(verify_builtin(late, "And").equivalent);
+
+  // A 16-bit ripple-carry adder with the carry in tied to 0.
+  auto ripple = gen::ripple_carry_adder(16);
+  auto code = ripple.code + R"(
+chip Add16(a[16], b[16]) out[16] {
+    na := Nand(a[0], a[0])
+    one := Nand(a[0], na)
+    zero := Nand(one, one)
+    s, c := RippleAdder16(a, b, zero)
+    return s
+}
+
+chip Inc16(in[16]) out[16] {
+    return in
+}
+)";
+  for (auto gate : {"Not", "And", "Or", "Xor", "Mux"}) {
+    EXPECT_TRUE(verify_builtin(code, gate).equivalent) << gate;
+  }
+  VerifyOptions options;
+  options.random_vectors = 1 << 14;
+  EXPECT_TRUE(verify_builtin(code, "Add16", options).equivalent);
+  EXPECT_FALSE(verify_builtin(code, "Inc16").equivalent);
+  EXPECT_THROW(verify_builtin(code, ripple.top), std::invalid_argument);
+  EXPECT_THROW(verify_builtin(g_code, "And4Way"), std::invalid_argument);
+}
+
+TEST(Verify, Adders) {
+  auto ripple = gen::ripple_carry_adder(8);
+  auto lookahead = gen::carry_lookahead_adder(8);
+  auto res =
+      verify_equivalent(ripple.code, ripple.top, lookahead.code, lookahead.top);
+  EXPECT_TRUE(res.equivalent);
+  EXPECT_TRUE(res.exhaustive);
+  EXPECT_EQ(res.vectors, uint64_t(1) << 17);
+
+  ripple = gen::ripple_carry_adder(32);
+  lookahead = gen::carry_lookahead_adder(32);
+  VerifyOptions options;
+  options.random_vectors = 1 << 16;
+  res = verify_equivalent(ripple.code, ripple.top, lookahead.code,
+                          lookahead.top, options);
+  EXPECT_TRUE(res.equivalent);
+  EXPECT_FALSE(res.exhaustive);
+  EXPECT_EQ(res.vectors, 1 << 16);
+}